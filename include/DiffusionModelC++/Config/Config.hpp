@@ -5,6 +5,7 @@
 #include <DiffusionModelC++/Util/Logging.hpp>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <string>
 
 namespace dmcpp {
@@ -146,10 +147,35 @@ enum class DiffusionWeightingType {
   INVALID
 };
 
-inline static const std::vector<std::string> str_OptimizerType = {"adamw"};
+inline static const std::vector<std::string> str_ResampleType = {"bilinear",
+                                                                 "avg_pool",
+                                                                 "nearest"};
+
+enum class ResampleType {
+  BILINEAR,
+  AVG_POOL,
+  NEAREST,
+  INVALID
+};
+
+inline static const std::vector<std::string> str_OptimizerType = {"adamw", "fused_adamw", "adafactor", "adamw8bit"};
 
 enum class OptimizerType {
   ADAMW,
+  FUSED_ADAMW,
+  ADAFACTOR,
+  ADAMW_8BIT,
+  INVALID
+};
+
+inline static const std::vector<std::string> str_DatasetMode = {"memory", "streaming", "packed", "shards", "encoded"};
+
+enum class DatasetMode {
+  MEMORY,     // Decode and resize all images up front
+  STREAMING,  // Decode on demand in the data loader workers, with a bounded cache
+  PACKED,     // Read pre-resized records from a file written by pack_dataset, `root` is that file
+  SHARDS,     // Stream tar shards under `root` sequentially through a shuffle buffer
+  ENCODED,    // Keep the encoded images in memory and decode them in the data loader workers
   INVALID
 };
 
@@ -163,6 +189,15 @@ enum class LRSchedulerType {
 // ===============================================================================================
 // Config
 // ===============================================================================================
+struct TokenMergeConfig {
+  // Merge ratio of the self attention tokens at each depth level, applied while sigma is in [sigmaMin, sigmaMax]
+  double sigmaMin = 0.0;
+  double sigmaMax = std::numeric_limits<double>::infinity();
+  std::vector<double> ratio = {};
+
+  static TokenMergeConfig load(const picojson::value &json);
+};
+
 struct ModelConfig {
   int64_t inChannels = 3LL;
   int64_t inFeatures = 256LL;
@@ -177,6 +212,8 @@ struct ModelConfig {
   bool hasVariance = false;
   DiffusionWeightingType weighting = DiffusionWeightingType::KARRAS;
   double lossScale = 1.0;
+  ResampleType resample = ResampleType::BILINEAR;
+  std::vector<TokenMergeConfig> tokenMerge = {};
 
   static ModelConfig load(const picojson::value &json);
 };
@@ -186,6 +223,23 @@ struct DatasetConfig {
   std::string extension = ".png";
   size_t batchSize = 32;
   size_t numWorkers = 4;
+  // Run the workers as separate processes pinned to their own cores (memory, streaming and packed modes)
+  bool workerProcesses = false;
+  DatasetMode mode = DatasetMode::MEMORY;
+  // Dataset manifest that saves the directory walk of the image folder modes: empty to walk the tree every time,
+  // "auto" for a file in the dataset directory (or the log dir when that is read-only), or a path
+  std::string manifest = "";
+  // Share the decoded images of the memory mode with other processes on the host through /dev/shm
+  bool sharedCache = false;
+  // Memory budget of the decoded image cache in streaming mode
+  size_t cacheMB = 4096;
+  // JPEG quality the images are re-encoded with at image_size in encoded mode, 0 keeps the original file bytes
+  int encodedQuality = 0;
+  // Number of decoded images each rank shuffles over in shards mode
+  size_t shuffleBuffer = 4096;
+  // Number of training batches (with noise and sigmas, on the device) prepared ahead on a prefetch thread.
+  // 0 prepares each batch on the training thread.
+  size_t prefetchDepth = 2;
 
   static DatasetConfig load(const picojson::value &json);
 };
@@ -219,6 +273,7 @@ struct SamplerConfig {
   double sigmaMin = 1e-2;
   double sigmaMax = 160.0;
   double noiseDLow = 32.0;
+  int64_t featureCacheInterval = 1;
 
   static SamplerConfig load(const picojson::value &json);
 };
@@ -236,12 +291,23 @@ struct Config {
   int64_t deviceID = 0;
   int64_t imageSize{};
 
+  int64_t gradAccumSteps = 1;
+  int64_t microBatchSize = 0;
+
   int64_t maxSteps = 100000;
   int64_t logEveryStep = 100;
   int64_t sampleEveryStep = 1000;
   int64_t checkpointEveryStep = 5000;
 
   int64_t nSamples = 16;
+  int64_t previewThreads = 1;
+
+  bool paramArena = false;
+  int64_t ddpBucketMB = 25;
+  bool zeroSharding = false;
+  bool pipelineParallel = false;
+  bool convAutotune = false;
+  std::string convTuningCache{};
 
   static Config load(const std::string &path);
 };
@@ -3,8 +3,13 @@
 #include <torch/torch.h>
 
 #include <DiffusionModelC++/Config/Config.hpp>
+#include <DiffusionModelC++/Model/FlatWeights.hpp>
 #include <DiffusionModelC++/Model/Model.hpp>
+#include <DiffusionModelC++/Util/CheckpointUtil.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <chrono>
 #include <functional>
+#include <memory>
 
 namespace dmcpp {
 namespace diffusion {
@@ -28,6 +33,10 @@ struct KarrasDiffusionImpl : public torch::nn::Cloneable<KarrasDiffusionImpl> {
 
   void reset() override;
 
+  void clearFeatureCache();
+
+  model::ImageUNetModel getInnerModel() const;
+
   static torch::Tensor toD(const torch::Tensor& x,
                            const torch::Tensor& sigma,
                            const torch::Tensor& denoised);
@@ -43,7 +52,10 @@ TORCH_MODULE(KarrasDiffusion);
 
 }  // namespace diffusion
 
-inline diffusion::KarrasDiffusion getDiffusionModel(const config::Config& config) {
+// NOTE: With skipInit, the weights are left uninitialized. Use it only when they are overwritten right after.
+inline diffusion::KarrasDiffusion getDiffusionModel(const config::Config& config, bool skipInit = false) {
+  std::unique_ptr<model::SkipInitGuard> skipInitGuard = skipInit ? std::make_unique<model::SkipInitGuard>() : nullptr;
+
   model::ImageUNetModel innerModel(config.model.inChannels,
                                    config.model.inFeatures,
                                    config.model.depth,
@@ -54,7 +66,25 @@ inline diffusion::KarrasDiffusion getDiffusionModel(const config::Config& config
                                    config.model.unetCondDim,
                                    config.model.crossCondDim,
                                    config.model.dropoutRate,
-                                   config.model.hasVariance);
+                                   config.model.hasVariance,
+                                   config.model.resample);
+
+  // Token merging
+  if (!config.model.tokenMerge.empty()) {
+    std::vector<std::vector<model::TokenMergeRange>> rangesPerDepth(config.model.depth.size());
+
+    for (const auto& tokenMerge : config.model.tokenMerge) {
+      for (size_t iDepth = 0; iDepth < rangesPerDepth.size() && iDepth < tokenMerge.ratio.size(); ++iDepth) {
+        model::TokenMergeRange range;
+        range.sigmaMin = tokenMerge.sigmaMin;
+        range.sigmaMax = tokenMerge.sigmaMax;
+        range.ratio = tokenMerge.ratio[iDepth];
+        rangesPerDepth[iDepth].push_back(range);
+      }
+    }
+
+    innerModel->setTokenMerging(rangesPerDepth);
+  }
 
   // Diffusion model
   return diffusion::KarrasDiffusion(innerModel,
@@ -63,4 +93,42 @@ inline diffusion::KarrasDiffusion getDiffusionModel(const config::Config& config
                                     config.model.lossScale);
 }
 
+// Build the diffusion model without initializing the weights and fill them from a flat weights file,
+// or from the `key` shard of a checkpoint directory (`<key>.pt`) or a single-file checkpoint.
+inline diffusion::KarrasDiffusion loadDiffusionModel(const config::Config& config,
+                                                     const std::string& filePath,
+                                                     const std::string& key = "ema_model") {
+  const auto startTime = std::chrono::high_resolution_clock::now();
+
+  diffusion::KarrasDiffusion model = getDiffusionModel(config, true);
+
+  const auto builtTime = std::chrono::high_resolution_clock::now();
+
+  if (model::isFlatWeightsFile(filePath)) {
+    model::loadFlatWeights(*model, filePath);
+  } else if (util::FileUtil::exists(filePath) && !util::FileUtil::isFile(filePath)) {
+    const std::string shardPath = util::FileUtil::join(filePath, key + ".pt");
+    LOG_INFO("Load '" + key + "' from checkpoint: " + shardPath);
+
+    util::loadModuleState(*model, shardPath);
+  } else {
+    LOG_INFO("Load '" + key + "' from checkpoint: " + filePath);
+
+    torch::serialize::InputArchive archive;
+    archive.load_from(filePath);
+
+    torch::serialize::InputArchive modelArchive;
+    archive.read(key, modelArchive);
+    model->load(modelArchive);
+  }
+
+  const auto loadedTime = std::chrono::high_resolution_clock::now();
+
+  LOG_INFO("Model ready in " + std::to_string(std::chrono::duration<double, std::milli>(loadedTime - startTime).count()) + " [ms] (" +
+           "construction : " + std::to_string(std::chrono::duration<double, std::milli>(builtTime - startTime).count()) + " [ms], " +
+           "weights : " + std::to_string(std::chrono::duration<double, std::milli>(loadedTime - builtTime).count()) + " [ms])");
+
+  return model;
+}
+
 }  // namespace dmcpp
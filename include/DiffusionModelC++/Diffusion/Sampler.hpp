@@ -8,6 +8,7 @@
 
 #include <DiffusionModelC++/Config/Config.hpp>
 #include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <chrono>
 
 namespace dmcpp {
 namespace diffusion {
@@ -36,6 +37,8 @@ inline torch::Tensor getSigmasKarras(int n,
   return sigmas;
 };
 
+// NOTE: With featureCacheInterval > 1, the full network is evaluated only at every featureCacheInterval-th step
+// and the remaining evaluations reuse the cached deep features of the UNet (DeepCache).
 inline torch::Tensor sample_heun(
     KarrasDiffusion& model,
     torch::Tensor x,
@@ -43,19 +46,46 @@ inline torch::Tensor sample_heun(
     float s_churn = 0.0,
     float s_tmin = 0.0,
     float s_tmax = std::numeric_limits<float>::infinity(),
-    float s_noise = 1.0) {
+    float s_noise = 1.0,
+    int64_t featureCacheInterval = 1,
+    torch::optional<torch::Generator> generator = torch::nullopt) {
   torch::NoGradGuard no_grad;
 
   const torch::Tensor s_in = torch::ones({x.size(0)}, x.options());
 
   model::ImageUNetModelForwardArgs args;
 
+  const bool useFeatureCache = featureCacheInterval > 1;
+
+  int64_t nFullEvals = 0;
+  int64_t nCachedEvals = 0;
+  double fullEvalTime = 0.0;
+  double cachedEvalTime = 0.0;
+
+  const auto evaluate = [&](const torch::Tensor& input, const torch::Tensor& sigma) {
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    const torch::Tensor& denoised = model->forward(input, sigma, args);
+
+    const double elapsedTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    if (args.featureCacheMode == model::FeatureCacheMode::REUSE) {
+      ++nCachedEvals;
+      cachedEvalTime += elapsedTime;
+    } else {
+      ++nFullEvals;
+      fullEvalTime += elapsedTime;
+    }
+
+    return denoised;
+  };
+
   for (int i = 0; i < sigmas.size(0) - 1; ++i) {
     const float iSigma = sigmas[i].item<float>();
 
     const float gamma = (s_tmin <= iSigma && iSigma <= s_tmax) ? std::min(s_churn / (sigmas.size(0) - 1.0f), std::sqrt(2.0f) - 1.0f) : 0.0f;
 
-    const torch::Tensor eps = torch::randn_like(x) * s_noise;
+    const torch::Tensor eps = (generator.has_value() ? torch::randn(x.sizes(), *generator, x.options().device(generator->device())).to(x.device()) : torch::randn_like(x)) * s_noise;
 
     const torch::Tensor sigma_hat = sigmas[i] * (gamma + 1.0f);
 
@@ -63,7 +93,11 @@ inline torch::Tensor sample_heun(
       x = x + eps * torch::sqrt(sigma_hat * sigma_hat - iSigma * iSigma);
     }
 
-    const torch::Tensor& denoised = model->forward(x, sigma_hat * s_in, args);
+    if (useFeatureCache) {
+      args.featureCacheMode = (i % featureCacheInterval == 0) ? model::FeatureCacheMode::UPDATE : model::FeatureCacheMode::REUSE;
+    }
+
+    const torch::Tensor& denoised = evaluate(x, sigma_hat * s_in);
     const torch::Tensor& d = KarrasDiffusionImpl::toD(x, sigma_hat * s_in, denoised);
 
     const torch::Tensor dt = sigmas[i + 1] - sigma_hat;
@@ -71,14 +105,35 @@ inline torch::Tensor sample_heun(
     if (sigmas[i + 1].item<float>() == 0) {
       x = x + d * dt;
     } else {
+      if (useFeatureCache) {
+        args.featureCacheMode = model::FeatureCacheMode::REUSE;
+      }
+
       const auto x_2 = x + d * dt;
-      const torch::Tensor& denoised_2 = model->forward(x_2, sigmas[i + 1] * s_in, args);
+      const torch::Tensor& denoised_2 = evaluate(x_2, sigmas[i + 1] * s_in);
       const auto d_2 = KarrasDiffusionImpl::toD(x_2, sigmas[i + 1] * s_in, denoised_2);
       const auto d_prime = (d + d_2) / 2.0;
       x = x + d_prime * dt;
     }
   }
 
+  if (useFeatureCache) {
+    model->clearFeatureCache();
+
+    // Speedup against evaluating the full network every time
+    const int64_t nEvals = nFullEvals + nCachedEvals;
+    const double totalTime = fullEvalTime + cachedEvalTime;
+
+    if (nFullEvals > 0 && totalTime > 0.0) {
+      const double fullEvalTimeAvg = fullEvalTime / static_cast<double>(nFullEvals);
+      const double speedup = fullEvalTimeAvg * static_cast<double>(nEvals) / totalTime;
+
+      LOG_INFO("Feature cache (interval " + std::to_string(featureCacheInterval) + ") : " +
+               std::to_string(nFullEvals) + " full / " + std::to_string(nCachedEvals) + " cached evaluations, " +
+               "estimated speedup x" + std::to_string(speedup));
+    }
+  }
+
   return x;
 };
 
@@ -122,10 +177,11 @@ inline torch::Tensor randCosineInterpolated(const at::IntArrayRef& shape,
                                             double min_value = 1e-3,
                                             double max_value = 1e3,
                                             torch::Device device = torch::kCPU,
-                                            torch::Dtype dtype = torch::kFloat32) {
+                                            torch::Dtype dtype = torch::kFloat32,
+                                            torch::optional<torch::Generator> generator = torch::nullopt) {
   double logsnr_min = -2.0 * std::log(min_value / sigma_data);
   double logsnr_max = -2.0 * std::log(max_value / sigma_data);
-  const torch::Tensor& u = torch::rand(shape, torch::TensorOptions().device(device).dtype(dtype));
+  const torch::Tensor& u = torch::rand(shape, generator, torch::TensorOptions().device(device).dtype(dtype));
   const torch::Tensor& logsnr = logSNRScheduleCosineInterpolated(u, image_d, noise_d_low, noise_d_high, logsnr_min, logsnr_max);
   return torch::exp(-logsnr / 2.0) * sigma_data;
 }
@@ -136,7 +192,8 @@ class DiffusionSampler {
 
   virtual torch::Tensor sample(const at::IntArrayRef& shape,
                                const torch::Device& device,
-                               const torch::Dtype& dtype) = 0;
+                               const torch::Dtype& dtype,
+                               torch::optional<torch::Generator> generator = torch::nullopt) = 0;
 };
 
 class CosineInterpolatedSampler : public DiffusionSampler {
@@ -146,7 +203,8 @@ class CosineInterpolatedSampler : public DiffusionSampler {
 
   torch::Tensor sample(const at::IntArrayRef& shape,
                        const torch::Device& device,
-                       const torch::Dtype& dtype) override;
+                       const torch::Dtype& dtype,
+                       torch::optional<torch::Generator> generator = torch::nullopt) override;
 
  private:
   double _imageD;
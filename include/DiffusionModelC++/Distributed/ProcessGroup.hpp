@@ -0,0 +1,120 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dmcpp {
+namespace distributed {
+
+// ====================================================================================================
+// Process group
+// ====================================================================================================
+// A full mesh of TCP connections between `worldSize` processes. Rank 0 listens on the master address and port,
+// hands out the listening ports of all ranks, and every pair of ranks then connects directly.
+//
+// All collectives are executed in submission order on one communication thread, so asynchronous and blocking
+// calls can be mixed. Every rank must issue the same collectives in the same order with the same sizes.
+// Tensors on other devices are staged through host memory.
+class ProcessGroup {
+ public:
+  ProcessGroup(int rank,
+               int worldSize,
+               const std::string& masterAddr,
+               int masterPort);
+  ~ProcessGroup();
+
+  // From RANK, WORLD_SIZE, MASTER_ADDR and MASTER_PORT. nullptr when WORLD_SIZE is not set or 1, exits on values
+  // that are not integers or out of range.
+  static std::shared_ptr<ProcessGroup> fromEnv();
+
+  int getRank() const;
+  int getWorldSize() const;
+
+  // Sum over all ranks in place, then multiply by `scale` (float, double and int64 tensors)
+  void allReduce(torch::Tensor& tensor, double scale = 1.0);
+  std::future<void> allReduceAsync(torch::Tensor tensor, double scale = 1.0);
+
+  void broadcast(torch::Tensor& tensor, int root);
+
+  // [worldSize, *tensor.sizes()]
+  torch::Tensor allGather(const torch::Tensor& tensor);
+
+  // Fill the flattened tensor from its `worldSize` equal chunks, where each rank contributes chunk `rank`
+  void allGatherInPlace(torch::Tensor& tensor);
+
+  // Tensors of all ranks stacked on `root`, undefined on the other ranks
+  torch::Tensor gather(const torch::Tensor& tensor, int root);
+
+  // Byte strings of all ranks on `root` (of any length), empty on the other ranks
+  std::vector<std::string> gatherBytes(const std::string& bytes, int root);
+
+  // Sum over all ranks of the `rank`-th of `worldSize` equal chunks of the flattened tensor
+  torch::Tensor reduceScatter(const torch::Tensor& tensor);
+
+  void send(const torch::Tensor& tensor, int dstRank);
+  void recv(torch::Tensor& tensor, int srcRank);
+
+  // Queue a send of a copy of `tensor` and return without waiting for the peer. Queued sends are written out while
+  // this rank waits in any later call, so schedules where two ranks send to each other do not deadlock.
+  std::future<void> isend(const torch::Tensor& tensor, int dstRank);
+  // Wait until all queued sends are written out
+  void flush();
+
+  void barrier();
+
+ private:
+  std::future<void> enqueue(std::function<void()> task);
+  void runCommThread();
+
+  void connectMesh(const std::string& masterAddr, int masterPort);
+
+  // Blocking collectives on contiguous host tensors, run on the communication thread
+  void ringReduceScatter(torch::Tensor& flat, const std::vector<int64_t>& offsets);
+  void ringAllGather(torch::Tensor& flat, const std::vector<int64_t>& offsets);
+
+  // Write out queued sends and read `recvSize` bytes from `srcPeer` (if >= 0) until the read is done
+  // and the queue of `flushPeer` (if >= 0) is empty
+  void progress(int srcPeer, void* recvData, size_t recvSize, int flushPeer);
+
+  void sendBytes(int peer, const void* data, size_t size);
+  void recvBytes(int peer, void* data, size_t size);
+  void sendRecvBytes(int dstPeer, const void* sendData, size_t sendSize, int srcPeer, void* recvData, size_t recvSize);
+
+  int _rank;
+  int _worldSize;
+  std::vector<int> _sockets;
+
+  std::thread _commThread;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<std::packaged_task<void()>> _tasks;
+  bool _toStop;
+
+  struct PendingSend {
+    torch::Tensor owner;  // Keeps the data of isend() alive, undefined for blocking sends
+    const char* data;
+    size_t size;
+    size_t nSent;
+  };
+
+  // Per peer, only touched on the communication thread
+  std::vector<std::deque<PendingSend>> _pendingSends;
+};
+
+// Fork `nProcs` local processes with RANK / WORLD_SIZE / LOCAL_RANK / LOCAL_WORLD_SIZE / MASTER_ADDR / MASTER_PORT set.
+// Returns true in the parent once all children have exited, with the first non-zero exit code in `exitCode`,
+// and false in the children, which simply carry on.
+// NOTE: Call it before libtorch starts any thread.
+bool spawnLocalProcesses(int nProcs, int& exitCode);
+
+}  // namespace distributed
+}  // namespace dmcpp
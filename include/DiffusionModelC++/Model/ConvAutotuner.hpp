@@ -0,0 +1,68 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace dmcpp {
+namespace model {
+
+inline static const std::vector<std::string> str_ConvAlgorithm = {"native",
+                                                                  "channels_last",
+                                                                  "im2col_gemm",
+                                                                  "winograd",
+                                                                  "mkldnn"};
+
+enum class ConvAlgorithm {
+  NATIVE,         // ATen's default dispatch
+  CHANNELS_LAST,  // oneDNN on NHWC activations
+  IM2COL_GEMM,    // Explicit im2col + GEMM (thnn_conv2d)
+  WINOGRAD,       // NNPACK, 3x3 stride 1 only
+  MKLDNN,         // oneDNN direct convolution
+  INVALID
+};
+
+// ====================================================================================================
+// ConvAutotuner
+// ====================================================================================================
+// Benchmarks the available CPU convolution backends for every distinct (conv, input) shape on first use
+// and keeps the fastest one for the rest of the run.
+// The decisions are persisted to a json file keyed by the CPU model, the number of threads and the shape.
+class ConvAutotuner {
+ public:
+  static ConvAutotuner& getInstance();
+
+  void enable(const std::string& cachePath);
+  bool isEnabled() const;
+
+  torch::Tensor forward(torch::nn::Conv2dImpl& conv, const torch::Tensor& x);
+
+ private:
+  ConvAutotuner();
+
+  ConvAlgorithm tune(torch::nn::Conv2dImpl& conv, const torch::Tensor& x, const std::string& key);
+  void loadCache();
+  void saveCache() const;
+
+  static std::string getCPUModel();
+  static bool isSupported(const torch::nn::Conv2dImpl& conv, ConvAlgorithm algorithm);
+  static torch::Tensor run(torch::nn::Conv2dImpl& conv, const torch::Tensor& x, ConvAlgorithm algorithm);
+
+  bool _enabled;
+  std::string _cachePath;
+  std::string _cpuModel;
+  std::unordered_map<std::string, ConvAlgorithm> _algorithms;
+  // Keys being benchmarked by some thread
+  std::unordered_set<std::string> _tuningKeys;
+  mutable std::mutex _mutex;
+};
+
+// Convolution through the autotuner, or the module's own forward when it is disabled
+torch::Tensor tunedConv2d(torch::nn::Conv2dImpl& conv, const torch::Tensor& x);
+
+}  // namespace model
+}  // namespace dmcpp
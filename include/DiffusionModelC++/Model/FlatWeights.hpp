@@ -0,0 +1,46 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <string>
+
+namespace dmcpp {
+namespace model {
+
+// ====================================================================================================
+// Flat weights
+// ====================================================================================================
+// A header, a tensor table and a contiguous, page aligned blob of weights.
+//
+//   [FlatWeightsHeader]
+//   [entry]*nTensors     : uint32 name length, name, int32 dtype, uint32 ndim, int64 sizes[ndim], uint64 offset, uint64 nbytes
+//   [padding]            : up to dataOffset (page aligned)
+//   [weights]            : each tensor aligned to FLAT_WEIGHTS_ALIGNMENT bytes, offsets relative to dataOffset
+//
+// The weights are mmap'ed read-only and the module parameters point directly at the mapped pages,
+// so several processes loading the same file share the weights through the page cache.
+
+inline static constexpr char FLAT_WEIGHTS_MAGIC[8] = {'D', 'M', 'C', 'P', 'P', 'F', 'W', '\0'};
+inline static constexpr uint32_t FLAT_WEIGHTS_VERSION = 1;
+inline static constexpr uint64_t FLAT_WEIGHTS_ALIGNMENT = 64;
+inline static constexpr uint64_t FLAT_WEIGHTS_PAGE_SIZE = 4096;
+
+struct FlatWeightsHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nTensors;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+
+// Write all parameters and buffers of the module
+void exportFlatWeights(torch::nn::Module& module, const std::string& filePath);
+
+// Point all parameters and buffers of the module at the mmap'ed file.
+// NOTE: The mapping is read-only, the parameters are detached from autograd and must not be modified in place.
+void loadFlatWeights(torch::nn::Module& module, const std::string& filePath);
+
+bool isFlatWeightsFile(const std::string& filePath);
+
+}  // namespace model
+}  // namespace dmcpp
@@ -51,7 +51,8 @@ struct DownBlockImpl : public ConditionedSequentialImpl {
                 bool downSample = false,
                 bool selfAttention = false,
                 bool crossAttention = false,
-                int64_t encChannels = 0);
+                int64_t encChannels = 0,
+                config::ResampleType resampleType = config::ResampleType::BILINEAR);
 };
 
 TORCH_MODULE(DownBlock);
@@ -71,7 +72,8 @@ struct UpBlockImpl : public ConditionedSequentialImpl {
               bool upSample = false,
               bool selfAttention = false,
               bool crossAttention = false,
-              int64_t encChannels = 0);
+              int64_t encChannels = 0,
+              config::ResampleType resampleType = config::ResampleType::BILINEAR);
 
   torch::Tensor forward(torch::Tensor& x, ConditionContext& conditionCtx) override;
   torch::Tensor forward(torch::Tensor& x, ConditionContext& conditionCtx, torch::Tensor& skip);
@@ -97,15 +99,27 @@ TORCH_MODULE(MappingNet);
 // ====================================================================================================
 // UNet
 // ====================================================================================================
+enum class FeatureCacheMode {
+  NONE,    // Run the full network
+  UPDATE,  // Run the full network and cache the input of the shallowest up block
+  REUSE    // Run only the shallowest down/up block pair on top of the cached feature
+};
+
 struct UNetImpl : public torch::nn::Cloneable<UNetImpl> {
   UNetImpl(const std::vector<DownBlock>& downBlocks, const std::vector<UpBlock>& upBlocks);
 
-  torch::Tensor forward(torch::Tensor& x, ConditionContext& conditionCtx);
+  torch::Tensor forward(torch::Tensor& x,
+                        ConditionContext& conditionCtx,
+                        FeatureCacheMode cacheMode = FeatureCacheMode::NONE);
 
   void reset() override;
 
+  void clearFeatureCache();
+
   torch::nn::ModuleList _downBlocks = nullptr;
   torch::nn::ModuleList _upBlocks = nullptr;
+
+  torch::Tensor _cachedFeature;
 };
 
 TORCH_MODULE(UNet);
@@ -119,13 +133,15 @@ struct ImageUNetModelForwardArgs {
         unetCond(),
         crossCond(),
         crossCondPadding(),
-        returnVariance(false) {};
+        returnVariance(false),
+        featureCacheMode(FeatureCacheMode::NONE) {};
 
   torch::Tensor mappingCond;
   torch::Tensor unetCond;
   torch::Tensor crossCond;
   torch::Tensor crossCondPadding;
   bool returnVariance = false;
+  FeatureCacheMode featureCacheMode = FeatureCacheMode::NONE;
 };
 
 struct ImageUNetModelForwardReturn {
@@ -148,7 +164,8 @@ struct ImageUNetModelImpl : public torch::nn::Cloneable<ImageUNetModelImpl> {
                      int64_t unetCondDim = 0,
                      int64_t crossCondDim = 0,
                      double dropoutRate = 0.0,
-                     bool hasVariance = false);
+                     bool hasVariance = false,
+                     config::ResampleType resampleType = config::ResampleType::BILINEAR);
 
   ImageUNetModelForwardReturn forward(const torch::Tensor& input,
                                       const torch::Tensor& sigma,
@@ -156,6 +173,11 @@ struct ImageUNetModelImpl : public torch::nn::Cloneable<ImageUNetModelImpl> {
 
   void reset() override;
 
+  void clearFeatureCache();
+
+  // Set the token merging ranges of the self attention layers for each depth level
+  void setTokenMerging(const std::vector<std::vector<TokenMergeRange>>& rangesPerDepth);
+
   bool _hasVariance;
 
   FourierFeatures _timestepEmbed = nullptr;
@@ -2,21 +2,82 @@
 
 #include <torch/torch.h>
 
+#include <DiffusionModelC++/Config/Config.hpp>
 #include <DiffusionModelC++/Util/Logging.hpp>
+#include <limits>
 #include <vector>
 
 namespace dmcpp {
 namespace model {
 
+// ====================================================================================================
+// SkipInitGuard
+// ====================================================================================================
+// While alive, modules constructed on the current thread skip their weight initialization
+// (orthogonal_, randn, zeros_). Used when the weights are overwritten right after construction.
+class SkipInitGuard {
+ public:
+  SkipInitGuard()
+      : _prevEnabled(isEnabled()) {
+    getFlag() = true;
+  }
+
+  ~SkipInitGuard() {
+    getFlag() = _prevEnabled;
+  }
+
+  SkipInitGuard(const SkipInitGuard&) = delete;
+  SkipInitGuard& operator=(const SkipInitGuard&) = delete;
+
+  static bool isEnabled() {
+    return getFlag();
+  }
+
+ private:
+  static bool& getFlag() {
+    thread_local bool enabled = false;
+    return enabled;
+  }
+
+  bool _prevEnabled;
+};
+
 struct ConditionContext {
   ConditionContext()
       : condition(),
         cross(),
-        crossPadding() {};
+        crossPadding(),
+        sigma() {};
 
   torch::Tensor condition;
   torch::Tensor cross;
   torch::Tensor crossPadding;
+  torch::Tensor sigma;
+};
+
+// ====================================================================================================
+// TokenMerge
+// ====================================================================================================
+// Bipartite soft matching (ToMe). Even tokens are merged into their most similar odd token.
+struct TokenMerge {
+  static TokenMerge compute(const torch::Tensor& metric, int64_t nMerged);
+
+  torch::Tensor merge(const torch::Tensor& x) const;
+  torch::Tensor unmerge(const torch::Tensor& x) const;
+
+  int64_t _nTokens = 0;
+  int64_t _nSrc = 0;
+  int64_t _nDst = 0;
+  int64_t _nMerged = 0;
+  torch::Tensor _unmergedIdx;
+  torch::Tensor _srcIdx;
+  torch::Tensor _dstIdx;
+};
+
+struct TokenMergeRange {
+  double sigmaMin = 0.0;
+  double sigmaMax = std::numeric_limits<double>::infinity();
+  double ratio = 0.0;
 };
 
 // ====================================================================================================
@@ -104,11 +165,17 @@ struct SelfAttention2DImpl : public ConditionedModuleImpl /*, public torch::nn::
 
   void reset() override;
 
+  void setTokenMerging(const std::vector<TokenMergeRange>& ranges);
+
+  int64_t getNumMergedTokens(int64_t nTokens, const ConditionContext& conditionCtx) const;
+
   int64_t _nHeads;
   float _dropoutRate;
   AdaGN _norm = nullptr;
   torch::nn::Conv2d _qkvProj = nullptr;
   torch::nn::Conv2d _outProj = nullptr;
+
+  std::vector<TokenMergeRange> _tokenMergeRanges;
 };
 
 TORCH_MODULE(SelfAttention2D);
@@ -145,12 +212,14 @@ TORCH_MODULE(CrossAttention2D);
 struct Downsample2DImpl : public ConditionedModuleImpl /*, public torch::nn::Cloneable<Downsample2DImpl>*/ {
   inline static const std::vector<double> SCALE_FACTOR = {0.5, 0.5};
 
-  explicit Downsample2DImpl(torch::nn::functional::InterpolateFuncOptions::mode_t interp = torch::kBilinear);
+  explicit Downsample2DImpl(config::ResampleType resampleType = config::ResampleType::BILINEAR,
+                            torch::nn::functional::InterpolateFuncOptions::mode_t interp = torch::kBilinear);
 
   torch::Tensor forward(torch::Tensor& x, ConditionContext& conditionCtx) override;
 
   void reset() override;
 
+  config::ResampleType _resampleType;
   torch::nn::functional::InterpolateFuncOptions::mode_t _interp;
 };
 
@@ -162,12 +231,14 @@ TORCH_MODULE(Downsample2D);
 struct Upsample2DImpl : public ConditionedModuleImpl /*, public torch::nn::Cloneable<Upsample2DImpl>*/ {
   inline static const std::vector<double> SCALE_FACTOR = {2.0, 2.0};
 
-  explicit Upsample2DImpl(torch::nn::functional::InterpolateFuncOptions::mode_t interp = torch::kBilinear);
+  explicit Upsample2DImpl(config::ResampleType resampleType = config::ResampleType::BILINEAR,
+                          torch::nn::functional::InterpolateFuncOptions::mode_t interp = torch::kBilinear);
 
   torch::Tensor forward(torch::Tensor& x, ConditionContext& conditionCtx) override;
 
   void reset() override;
 
+  config::ResampleType _resampleType;
   torch::nn::functional::InterpolateFuncOptions::mode_t _interp;
 };
 
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <torch/torch.h>
+
+namespace dmcpp {
+namespace model {
+
+// ====================================================================================================
+// 2x resampling kernels
+// ====================================================================================================
+// Dedicated CPU kernels for the fixed 2x block boundaries of the UNet.
+// Both NCHW and channels-last float tensors with even spatial sizes take the fast path, other inputs fall back to ATen.
+// The average pooling and nearest upsampling kernels are adjoint to each other, so each one is used for the
+// backward pass of the other.
+
+// 2x2 average pooling
+torch::Tensor avgPoolDownsample2x(const torch::Tensor& x);
+
+// 2x nearest neighbor upsampling
+torch::Tensor nearestUpsample2x(const torch::Tensor& x);
+
+// 2x nearest neighbor downsampling (top-left pixel of each 2x2 patch)
+torch::Tensor nearestDownsample2x(const torch::Tensor& x);
+
+// 0.5x and 2x bilinear resampling with align_corners=true, the default BILINEAR resample type. The source taps
+// and weights of each output row and column are computed once per call, and the backward scatters with the same
+// taps.
+torch::Tensor bilinearDownsample2x(const torch::Tensor& x);
+torch::Tensor bilinearUpsample2x(const torch::Tensor& x);
+
+}  // namespace model
+}  // namespace dmcpp
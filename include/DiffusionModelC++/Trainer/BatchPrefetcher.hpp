@@ -0,0 +1,75 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Diffusion/Sampler.hpp>
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace dmcpp {
+namespace trainer {
+
+// Everything a training step draws from the data, on the training device
+struct TrainingBatch {
+  torch::Tensor image;
+  torch::Tensor noise;
+  torch::Tensor sigma;
+};
+
+// ====================================================================================================
+// Batch prefetcher
+// ====================================================================================================
+// Pulls batches from the loader on a background thread, applies the random flip, moves them to the device and
+// draws the noise and the sigmas, keeping up to `depth` finished batches ahead of the training step.
+//
+// The random draws of each batch come from a generator seeded with (seed, epoch, batch), so they do not depend on
+// how far ahead the thread runs and are reproduced on resume. They are drawn on the CPU, which also makes them
+// independent of the device.
+class BatchPrefetcher {
+ public:
+  BatchPrefetcher(ImageBatchLoader& loader,
+                  std::shared_ptr<diffusion::DiffusionSampler> sampler,
+                  const torch::Device& device,
+                  size_t depth,
+                  uint64_t seed);
+  ~BatchPrefetcher();
+
+  // Start an epoch at batch `batchInEpoch`. The sampler position of the loader has to be set before.
+  void start(int64_t epoch, int64_t batchInEpoch);
+  // nullopt at the end of the epoch. Rethrows an exception of the loader on the training thread.
+  torch::optional<TrainingBatch> next();
+  // Abandon the rest of the epoch
+  void stop();
+
+ private:
+  TrainingBatch prepare(const torch::Tensor& image, int64_t batchIndex);
+  void run();
+
+  ImageBatchLoader& _loader;
+  std::shared_ptr<diffusion::DiffusionSampler> _sampler;
+  torch::Device _device;
+  size_t _depth;
+  uint64_t _seed;
+
+  int64_t _epoch;
+  int64_t _batchIndex;
+
+  // Finished batches, nullopt marks the end of the epoch
+  std::deque<torch::optional<TrainingBatch>> _batches;
+  std::mutex _mutex;
+  std::condition_variable _notEmpty;
+  std::condition_variable _notFull;
+  std::atomic<bool> _toStop;
+  // Thrown by the loader or while preparing a batch, rethrown by next()
+  std::exception_ptr _error;
+  std::thread _thread;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Util/CheckpointUtil.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// One file of a checkpoint directory. Either a tensor shard or pre-serialized bytes.
+struct CheckpointShard {
+  std::string fileName;
+  util::NamedTensors tensors;
+  std::string bytes;
+};
+
+// ====================================================================================================
+// Asynchronous checkpoint writer
+// ====================================================================================================
+// The caller hands over an in-memory snapshot and returns to training. A background thread writes the shards
+// in parallel into `<dir>.tmp`, fsyncs them and renames the directory to `<dir>`, so a checkpoint directory
+// is either complete or absent. The previous `<dir>` is renamed to `<dir>.old` first and deleted last, so a
+// crash while publishing still leaves one complete checkpoint.
+class CheckpointWriter {
+ public:
+  CheckpointWriter();
+  ~CheckpointWriter();
+
+  // Blocks only while a previous write is still in flight
+  void submit(const std::string& dirPath, std::vector<CheckpointShard> shards);
+  void wait();
+
+  // Wall time of the last finished write [ms]
+  double getLastWriteTime() const;
+
+ private:
+  void write(const std::string& dirPath, const std::vector<CheckpointShard>& shards);
+
+  std::thread _thread;
+  std::atomic<double> _lastWriteTime;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
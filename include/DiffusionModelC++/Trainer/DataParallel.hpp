@@ -0,0 +1,59 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Gradient reducer for data-parallel training
+// ====================================================================================================
+// Averages the flat gradient buffer of a parameter arena over all ranks in buckets. Buckets cover the parameters
+// in reverse registration order, which is roughly the order backward produces them. Parameter hooks count the
+// gradients of each bucket, and a complete bucket is all-reduced on the communication thread while backward
+// goes on. finish() launches the remaining buckets and waits for all of them.
+//
+// NOTE: A hook runs right before its gradient is accumulated, so a bucket is launched from the hook that
+//       follows its last gradient. Overlap is only used for CPU arenas, other devices reduce in finish().
+class GradReducer {
+ public:
+  GradReducer(std::shared_ptr<distributed::ProcessGroup> processGroup,
+              ParameterArena& arena,
+              int64_t bucketBytes);
+
+  // Reduce during the next backward (disable it for the non-final micro-batches of an accumulation)
+  void setSyncEnabled(bool isEnabled);
+  bool isSyncEnabled() const;
+
+  void finish();
+
+ private:
+  struct Bucket {
+    int64_t offset;
+    int64_t numel;
+    int64_t nParams;
+    int64_t nPending;
+    bool isLaunched;
+    std::future<void> work;
+  };
+
+  void onGradReady(size_t iParam);
+  void launch(size_t iBucket);
+
+  std::shared_ptr<distributed::ProcessGroup> _processGroup;
+  torch::Tensor _flatGrads;
+  std::vector<Bucket> _buckets;
+  std::vector<size_t> _bucketOfParam;
+  std::vector<size_t> _completedBuckets;
+  bool _isSyncEnabled;
+  bool _canOverlap;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -2,27 +2,196 @@
 
 #include <torch/torch.h>
 
+#include <DiffusionModelC++/Config/Config.hpp>
 #include <DiffusionModelC++/Util/ImageUtil.hpp>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace dmcpp {
 namespace trainer {
 
-class ImageFolderDataset : public torch::data::Dataset<ImageFolderDataset, torch::data::Example<torch::Tensor>> {
+// Image files with `extension` under `root`, recursively, in sorted order. With a `manifestPath`, the list comes
+// from that dataset manifest, which is created or brought up to date first.
+std::vector<std::string> listImageFiles(const std::string& root, const std::string& extension, const std::string& manifestPath = "");
+
+// ====================================================================================================
+// Image batch loader
+// ====================================================================================================
+// What the trainer pulls batches from, independent of the dataset and data loader types behind it
+class ImageBatchLoader {
+ public:
+  virtual ~ImageBatchLoader() = default;
+
+  // Start a new pass over the data
+  virtual void reset() = 0;
+  // [B, C, H, W] float in [-1, 1], or nullopt at the end of the pass
+  virtual torch::optional<torch::Tensor> next() = 0;
+};
+
+// Adapts a torch::data data loader. Examples are reduced to their data.
+template <typename DataLoader>
+class DataLoaderAdapter : public ImageBatchLoader {
+ public:
+  explicit DataLoaderAdapter(std::unique_ptr<DataLoader> dataLoader)
+      : _dataLoader(std::move(dataLoader)),
+        _iter(),
+        _end() {
+  }
+
+  void reset() override {
+    // NOTE: begin() resets the sampler, so the sampler position must be set before
+    _iter.reset();
+    _end.reset();
+    _iter = _dataLoader->begin();
+    _end = _dataLoader->end();
+  }
+
+  torch::optional<torch::Tensor> next() override {
+    if (!_iter.has_value() || *_iter == *_end) {
+      return torch::nullopt;
+    }
+
+    torch::Tensor batch = toTensor(**_iter);
+    ++(*_iter);
+
+    return batch;
+  }
+
+ private:
+  using Iterator = decltype(std::declval<DataLoader&>().begin());
+
+  static torch::Tensor toTensor(const torch::data::Example<>& example) {
+    return example.data;
+  }
+
+  static torch::Tensor toTensor(const torch::Tensor& tensor) {
+    return tensor;
+  }
+
+  std::unique_ptr<DataLoader> _dataLoader;
+  torch::optional<Iterator> _iter;
+  torch::optional<Iterator> _end;
+};
+
+template <typename DataLoader>
+std::unique_ptr<ImageBatchLoader> makeImageBatchLoader(std::unique_ptr<DataLoader> dataLoader) {
+  return std::make_unique<DataLoaderAdapter<DataLoader>>(std::move(dataLoader));
+}
+
+// ====================================================================================================
+// Image cache
+// ====================================================================================================
+// Thread-safe LRU cache of decoded and resized images, bounded by the total bytes of the cached pixels
+class ImageCache {
+ public:
+  explicit ImageCache(size_t capacityBytes);
+
+  // False on a miss
+  bool get(size_t index, cv::Mat& image);
+  void put(size_t index, const cv::Mat& image);
+
+  size_t getSizeBytes() const;
+  int64_t getNumHits() const;
+  int64_t getNumMisses() const;
+
+ private:
+  using Entry = std::pair<size_t, cv::Mat>;
+
+  std::list<Entry> _entries;  // Most recently used first
+  std::unordered_map<size_t, std::list<Entry>::iterator> _lookup;
+  size_t _capacityBytes;
+  size_t _sizeBytes;
+  std::atomic<int64_t> _nHits;
+  std::atomic<int64_t> _nMisses;
+  mutable std::mutex _mutex;
+};
+
+// Encoded images back to back in one allocation. Image i is bytes[offsets[i], offsets[i + 1]).
+struct EncodedImageArena {
+  std::vector<uchar> bytes;
+  std::vector<size_t> offsets;
+};
+
+// ====================================================================================================
+// Image folder dataset
+// ====================================================================================================
+// In MEMORY mode, all images are decoded and resized in the constructor. In STREAMING mode, the constructor only
+// lists the files and each image is decoded on its first request, in the data loader worker that asks for it,
+// then kept in an LRU cache of `cacheBytes`. In ENCODED mode, the constructor reads the file bytes (or, with an
+// `encodedQuality` above 0, re-encodes each image as a JPEG at the target size) into one arena, and the images are
+// decoded again for every batch.
+// A batch is collated as uint8 BGR pixels into a staging buffer that each worker thread reuses, and converted to
+// RGB float in one pass over the whole batch.
+class ImageFolderDataset : public torch::data::datasets::BatchDataset<ImageFolderDataset, torch::Tensor> {
  public:
   explicit ImageFolderDataset(const std::string& root,
                               const int& imageWidth,
                               const int& imageHeight,
-                              const std::string& extension = ".jpg");
+                              const std::string& extension = ".jpg",
+                              bool randomFlip = true,
+                              config::DatasetMode mode = config::DatasetMode::MEMORY,
+                              size_t cacheBytes = 0,
+                              int encodedQuality = 0,
+                              const std::string& manifestPath = "");
 
-  torch::data::Example<torch::Tensor> get(size_t index) override;
+  // [B, C, H, W] float in [-1, 1]
+  torch::Tensor get_batch(torch::ArrayRef<size_t> indices) override;
 
   torch::optional<size_t> size() const override;
 
  private:
+  cv::Mat loadResizedImage(size_t index) const;
+  void loadEncodedImages(int encodedQuality);
+  // Decoded and resized image, from memory, the arena, the cache or the file
+  cv::Mat getImage(size_t index);
+
   std::vector<std::string> _imagePaths;
   std::vector<cv::Mat> _images;
+  // Shared by the copies of the dataset
+  std::shared_ptr<ImageCache> _cache;
+  std::shared_ptr<const EncodedImageArena> _encoded;
   int _imageWidth;
   int _imageHeight;
+  bool _randomFlip;
+};
+
+// ====================================================================================================
+// Resumable random sampler
+// ====================================================================================================
+// The permutation of each epoch is derived from (seed, epoch) only, so the data order does not depend on the
+// global RNG or on the data loader workers. The position is shared with the trainer, which sets it before each
+// epoch and can move it into the middle of an epoch on resume.
+// For data-parallel training, every rank draws the same permutation and takes every `worldSize`-th index of it.
+struct SamplerPosition {
+  int64_t epoch = 0;
+  int64_t index = 0;
+};
+
+class ResumableRandomSampler : public torch::data::samplers::Sampler<> {
+ public:
+  ResumableRandomSampler(int64_t size, uint64_t seed, int rank = 0, int worldSize = 1);
+
+  void reset(torch::optional<size_t> new_size = torch::nullopt) override;
+  torch::optional<std::vector<size_t>> next(size_t batch_size) override;
+
+  void save(torch::serialize::OutputArchive& archive) const override;
+  void load(torch::serialize::InputArchive& archive) override;
+
+  std::shared_ptr<SamplerPosition> getPosition() const;
+
+ private:
+  std::shared_ptr<SamplerPosition> _position;
+  torch::Tensor _indices;
+  int64_t _size;
+  int64_t _index;
+  uint64_t _seed;
+  int _rank;
+  int _worldSize;
 };
 
 }  // namespace trainer
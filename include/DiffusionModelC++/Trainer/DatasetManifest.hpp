@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Dataset manifest
+// ====================================================================================================
+// The image files of a dataset with their sizes, modification times and pixel sizes, and the modification time
+// of every directory, saved to a file so that later runs do not walk the whole tree.
+//
+// On refresh, all known directories are stat'ed in parallel. Only the directories whose modification time
+// changed (files or subdirectories added, removed or renamed) are listed again, and only their new or changed
+// files are stat'ed and probed. Contents rewritten in place under the same name are not detected, since they do
+// not touch the directory.
+class DatasetManifest {
+ public:
+  struct Entry {
+    std::string path;  // Relative to the root
+    uint64_t size = 0;
+    int64_t mtime = 0;  // [ns]
+    // From the PNG or JPEG header, 0 when unknown
+    int32_t width = 0;
+    int32_t height = 0;
+  };
+
+  struct Directory {
+    std::string path;  // Relative to the root, empty for the root
+    int64_t mtime = 0;  // [ns]
+  };
+
+  // Load the manifest at `filePath` if it was written for the same absolute `root` and `extension`, bring it up
+  // to date and write it back if anything changed. A manifest that cannot be written is only reported.
+  static DatasetManifest loadOrBuild(const std::string& root, const std::string& extension, const std::string& filePath);
+
+  // `root` joined with the entry paths, in sorted order
+  std::vector<std::string> getImagePaths() const;
+  const std::vector<Entry>& getEntries() const;
+
+ private:
+  DatasetManifest(std::string root, std::string extension);
+
+  std::string getAbsoluteRoot() const;
+
+  bool load(const std::string& filePath);
+  bool save(const std::string& filePath) const;
+  // Record the modification time that writing the manifest gave to its own directory, if it is in the dataset
+  void patchOwnDirectoryTime(const std::string& filePath);
+  // Returns whether anything changed
+  bool refresh();
+
+  std::string _root;
+  std::string _extension;
+  std::vector<Directory> _directories;
+  std::vector<Entry> _entries;
+};
+
+inline constexpr char kManifestFilePrefix[] = ".dmcpp_manifest";
+inline constexpr char kFallbackManifestFilePrefix[] = "dataset_manifest";
+// NOTE: Keeps the manifest from carrying the image extension, so it is never listed as an image
+inline constexpr char kManifestFileSuffix[] = ".bin";
+
+// `<root>/.dmcpp_manifest<extension>.bin` when the dataset directory is writable, else
+// `<fallbackDir>/dataset_manifest<extension>.bin`
+std::string getDefaultManifestPath(const std::string& root, const std::string& extension, const std::string& fallbackDir);
+
+// Manifest files (and their temporary files) found next to the images, skipped when listing them
+bool isManifestFileName(const std::string& fileName);
+
+}  // namespace trainer
+}  // namespace dmcpp
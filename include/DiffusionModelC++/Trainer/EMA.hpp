@@ -3,6 +3,7 @@
 #include <torch/torch.h>
 
 #include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
 #include <unordered_map>
 
 namespace dmcpp {
@@ -12,6 +13,20 @@ void updateEMAModel(diffusion::KarrasDiffusion& model,
                     diffusion::KarrasDiffusion& avgModel,
                     double decay);
 
+// Same as above with both models in parameter arenas, a single lerp over the flat buffers
+void updateEMAModel(const ParameterArena& arena,
+                    ParameterArena& avgArena,
+                    double decay);
+
+// Same as above over the given parameters only, e.g. those of one pipeline stage. Buffers are left as they are.
+void updateEMAModel(const std::vector<torch::Tensor>& params,
+                    const std::vector<torch::Tensor>& avgParams,
+                    double decay);
+
+// Copy all parameters and buffers of the model to the EMA model
+void copyEMAModel(diffusion::KarrasDiffusion& model,
+                  diffusion::KarrasDiffusion& avgModel);
+
 class EMAWarmup {
  public:
   explicit EMAWarmup(double invGamma = 1.0,
@@ -10,6 +10,9 @@ class ConstantLRWithWarmup : public torch::optim::LRScheduler {
   ConstantLRWithWarmup(torch::optim::Optimizer& optimizer,
                        const double warmup);
 
+  int64_t getStepCount() const;
+  void setStepCount(int64_t stepCount);
+
  private:
   std::vector<double> get_lrs() override;
 
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <torch/torch.h>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Fused AdamW
+// ====================================================================================================
+// Same update, options and state as torch::optim::AdamW, so checkpoints are interchangeable. On CPU, the
+// decoupled weight decay, both moments, the bias correction and the update of all parameters are done in one
+// OpenMP loop that touches each parameter, gradient and moment once. Anything the fused loop does not cover
+// (non-CPU or non-float tensors, amsgrad, sparse gradients) falls back to torch::optim::AdamW::step.
+class FusedAdamW : public torch::optim::AdamW {
+ public:
+  explicit FusedAdamW(std::vector<torch::Tensor> params,
+                      torch::optim::AdamWOptions defaults = {});
+
+  torch::Tensor step(LossClosure closure = nullptr) override;
+
+ private:
+  bool isFusable() const;
+};
+
+// ====================================================================================================
+// Adafactor
+// ====================================================================================================
+// Adafactor (Shazeer & Stern, 2018) with an explicit learning rate. The second moment of each matrix-shaped
+// parameter (conv weights are viewed as [out, in * kh * kw]) is kept as row and column averages, so its state is
+// O(rows + cols) instead of O(rows * cols). The first moment is only kept when beta1 > 0.
+struct AdafactorOptions : public torch::optim::OptimizerCloneableOptions<AdafactorOptions> {
+  AdafactorOptions(double lr = 1e-3);
+  TORCH_ARG(double, lr) = 1e-3;
+  TORCH_ARG(double, eps) = 1e-30;
+  TORCH_ARG(double, clip_threshold) = 1.0;
+  TORCH_ARG(double, decay_rate) = -0.8;
+  TORCH_ARG(double, beta1) = 0.0;
+  TORCH_ARG(double, weight_decay) = 0.0;
+
+ public:
+  void serialize(torch::serialize::InputArchive& archive) override;
+  void serialize(torch::serialize::OutputArchive& archive) const override;
+  double get_lr() const override;
+  void set_lr(const double lr) override;
+};
+
+struct AdafactorParamState : public torch::optim::OptimizerCloneableParamState<AdafactorParamState> {
+  TORCH_ARG(int64_t, step) = 0;
+  TORCH_ARG(torch::Tensor, exp_avg_sq_row);
+  TORCH_ARG(torch::Tensor, exp_avg_sq_col);
+  TORCH_ARG(torch::Tensor, exp_avg_sq);
+  TORCH_ARG(torch::Tensor, exp_avg);
+
+ public:
+  void serialize(torch::serialize::InputArchive& archive) override;
+  void serialize(torch::serialize::OutputArchive& archive) const override;
+};
+
+class Adafactor : public torch::optim::Optimizer {
+ public:
+  explicit Adafactor(std::vector<torch::Tensor> params,
+                     AdafactorOptions defaults = {});
+
+  torch::Tensor step(LossClosure closure = nullptr) override;
+  void save(torch::serialize::OutputArchive& archive) const override;
+  void load(torch::serialize::InputArchive& archive) override;
+
+ private:
+  template <typename Self, typename Archive>
+  static void serialize(Self& self, Archive& archive) {
+    _TORCH_OPTIM_SERIALIZE_WITH_TEMPLATE_ARG(Adafactor);
+  }
+};
+
+// ====================================================================================================
+// 8-bit AdamW
+// ====================================================================================================
+// AdamW with both moments quantized block-wise: the first moment as int8 with a per-block absmax scale, the
+// second moment as a uint8 log code of its square root relative to the per-block max, so entries far below the
+// max of their block keep their relative precision.
+// The update itself is computed in float from the dequantized moments. Takes the same options as AdamW.
+using AdamW8bitOptions = torch::optim::AdamWOptions;
+
+struct AdamW8bitParamState : public torch::optim::OptimizerCloneableParamState<AdamW8bitParamState> {
+  TORCH_ARG(int64_t, step) = 0;
+  TORCH_ARG(torch::Tensor, exp_avg);
+  TORCH_ARG(torch::Tensor, exp_avg_scale);
+  TORCH_ARG(torch::Tensor, exp_avg_sq);
+  TORCH_ARG(torch::Tensor, exp_avg_sq_scale);
+
+ public:
+  void serialize(torch::serialize::InputArchive& archive) override;
+  void serialize(torch::serialize::OutputArchive& archive) const override;
+};
+
+class AdamW8bit : public torch::optim::Optimizer {
+ public:
+  // Number of elements sharing one quantization scale
+  static constexpr int64_t kBlockSize = 256;
+  // Codes 1..255 of the second moment cover 254 / kSqrtCodesPerOctave octaves below the block max
+  static constexpr double kSqrtCodesPerOctave = 8.0;
+
+  explicit AdamW8bit(std::vector<torch::Tensor> params,
+                     AdamW8bitOptions defaults = {});
+
+  torch::Tensor step(LossClosure closure = nullptr) override;
+  void save(torch::serialize::OutputArchive& archive) const override;
+  void load(torch::serialize::InputArchive& archive) override;
+
+ private:
+  template <typename Self, typename Archive>
+  static void serialize(Self& self, Archive& archive) {
+    _TORCH_OPTIM_SERIALIZE_WITH_TEMPLATE_ARG(AdamW8bit);
+  }
+};
+
+// Total size of the tensors held in the optimizer state [bytes]
+int64_t getOptimizerStateBytes(const torch::optim::Optimizer& optimizer);
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Util/ImageUtil.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Packed dataset format
+// ====================================================================================================
+// A header, the fixed-size records (uint8 RGB, CHW, already resized) starting on a page boundary, and the source
+// file names, NUL separated, after the records. Record i starts at dataOffset + i * recordBytes.
+struct PackedDatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t channels;
+  uint32_t height;
+  uint32_t width;
+  uint64_t nRecords;
+  uint64_t recordBytes;
+  uint64_t dataOffset;
+  uint64_t namesOffset;
+  uint64_t namesBytes;
+};
+
+inline constexpr char kPackedDatasetMagic[8] = {'D', 'M', 'C', 'P', 'A', 'C', 'K', '\0'};
+inline constexpr uint32_t kPackedDatasetVersion = 1;
+
+// Copy a BGR image (as loaded by util::loadImage) into a uint8 RGB CHW record
+void imageToRecord(const cv::Mat& image, uint8_t* record);
+
+// Decode, resize (Lanczos) and pack the images, `chunkSize` images at a time in parallel
+void writePackedDataset(const std::vector<std::string>& imagePaths,
+                        int imageSize,
+                        const std::string& filePath,
+                        int64_t chunkSize = 1024);
+
+// Path of a packed dataset in /dev/shm for the images with `extension` under `root` at `imageSize`, written
+// by the first process that asks for it. Other processes wait on a file lock while it is written, then reuse it.
+// The key also covers the names, sizes and modification times of the files, stat'ed on every call even when the
+// list comes from a manifest, so a changed dataset gets a new file. The files stay until removed.
+std::string acquireSharedPackedDataset(const std::string& root, const std::string& extension, int imageSize, const std::string& manifestPath = "");
+
+// ====================================================================================================
+// Mapped file
+// ====================================================================================================
+// Read-only memory mapping of a whole file
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filePath);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* getData() const;
+  size_t getSize() const;
+
+ private:
+  void* _data;
+  size_t _size;
+};
+
+// ====================================================================================================
+// Packed image dataset
+// ====================================================================================================
+// Maps a packed dataset file. Nothing is read up front, the pages are faulted in by the data loader workers.
+// A batch is a single gather over a uint8 tensor that wraps the mapped records, followed by the conversion to float.
+class PackedImageDataset : public torch::data::datasets::BatchDataset<PackedImageDataset, torch::Tensor> {
+ public:
+  explicit PackedImageDataset(const std::string& filePath);
+
+  // [B, C, H, W] float in [-1, 1]
+  torch::Tensor get_batch(torch::ArrayRef<size_t> indices) override;
+
+  torch::optional<size_t> size() const override;
+
+  int64_t getImageWidth() const;
+  int64_t getImageHeight() const;
+
+  // uint8 CHW view of a record over the mapped pages, valid while the dataset lives
+  torch::Tensor getRecord(size_t index) const;
+  std::string getSourcePath(size_t index) const;
+
+ private:
+  // Shared by the copies of the dataset
+  std::shared_ptr<MappedFile> _file;
+  PackedDatasetHeader _header;
+  // [N, C, H, W] uint8 over the mapped records
+  torch::Tensor _records;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Util/CheckpointUtil.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Parameter arena
+// ====================================================================================================
+// Relocates all parameters of a module into one contiguous buffer, and optionally their gradients into another
+// one, keeping every parameter as a view. Whole-model operations are then a single pass over the flat buffer.
+// NOTE: The gradient views must not be reset, so zero the gradients with zeroGrad() instead of
+//       Optimizer::zero_grad().
+class ParameterArena {
+ public:
+  struct Segment {
+    std::string name;
+    int64_t offset;
+    int64_t numel;
+  };
+
+  // Segments are padded to this number of elements (64 bytes for float)
+  static constexpr int64_t kAlignment = 16;
+
+  // With nShards > 1, the flat buffers are padded so that they split into nShards aligned, equal shards
+  ParameterArena(torch::nn::Module& module, bool withGrads, int64_t nShards = 1);
+
+  const torch::Tensor& getFlatParams() const;
+  const torch::Tensor& getFlatGrads() const;
+  const std::vector<Segment>& getSegments() const;
+  const std::vector<torch::Tensor>& getParams() const;
+  const std::vector<torch::Tensor>& getBuffers() const;
+
+  void zeroGrad();
+  double gradNorm() const;
+
+  // CPU copy of the parameters (views into one clone of the flat buffer) and buffers
+  util::NamedTensors snapshot() const;
+
+  // Flat buffer with the arena layout, filled from named parameter tensors
+  torch::Tensor flatten(const std::unordered_map<std::string, torch::Tensor>& tensors) const;
+
+ private:
+  torch::Tensor _flatParams;
+  torch::Tensor _flatGrads;
+  std::vector<Segment> _segments;
+  std::vector<torch::Tensor> _params;
+  std::vector<torch::Tensor> _buffers;
+  std::vector<std::string> _bufferNames;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
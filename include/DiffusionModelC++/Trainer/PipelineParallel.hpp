@@ -0,0 +1,98 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Pipeline parallelism
+// ====================================================================================================
+// Splits the UNet over the ranks of a process group. The blocks are taken in execution order (down blocks, then
+// up blocks from the deepest level) and cut into contiguous stages of about equal cost, one stage per rank. Rank 0
+// additionally runs the condition mapping and the input projection, the last rank the output projection and the
+// loss.
+//
+// Each stage sends its output feature and the mapped condition to the next stage, and every skip feature (from
+// `hidden` in UNetImpl::forward) directly to the stage that owns the matching up block. Gradients flow back along
+// the same routes. Micro-batches run on a 1F1B schedule: after a warm-up of (nStages - stage - 1) forwards, each
+// stage alternates one forward and one backward, which keeps at most nStages micro-batches of activations alive.
+//
+// All ranks see the same batch, noise and sigmas, so only activations cross stage boundaries.
+class PipelineParallel {
+ public:
+  // `microBatchSize` of 0 splits every batch into 2 x nStages micro-batches
+  PipelineParallel(std::shared_ptr<distributed::ProcessGroup> processGroup,
+                   diffusion::KarrasDiffusion& model,
+                   int64_t microBatchSize = 0);
+
+  int getStage() const;
+  int getNumStages() const;
+  bool isLastStage() const;
+
+  // Parameters owned by `stage` (by default this rank's) of `module`, the model or another model of the same
+  // architecture such as the EMA model
+  std::vector<torch::Tensor> getStageParameters(torch::nn::Module& module, int stage = -1) const;
+
+  // Forward and backward of the diffusion loss over the batch. The gradients of the stage parameters accumulate
+  // the loss sum multiplied by `lossScale`. Returns that scaled loss on the last stage and zero on the others.
+  torch::Tensor forwardBackward(const torch::Tensor& image,
+                                const torch::Tensor& noise,
+                                const torch::Tensor& sigma,
+                                double lossScale);
+
+  // Collective: copy the stage parameters of all ranks into `module` on rank 0
+  void gatherParameters(torch::nn::Module& module);
+
+ private:
+  // Activations of one micro-batch kept on this stage between its forward and its backward
+  struct MicroBatch {
+    torch::Tensor xInput;
+    torch::Tensor condition;
+    std::vector<std::pair<int, torch::Tensor>> skipInputs;  // (producer block, feature), in production order
+    std::vector<std::pair<int, torch::Tensor>> skipOutputs;  // (consumer block, feature), in production order
+    torch::Tensor xOutput;
+    torch::Tensor loss;
+  };
+
+  void forwardMicroBatch(const torch::Tensor& image,
+                         const torch::Tensor& noise,
+                         const torch::Tensor& sigma,
+                         double lossScale);
+  void backwardMicroBatch();
+
+  void sendTensor(const torch::Tensor& tensor, int dstRank);
+  torch::Tensor recvTensor(int srcRank);
+
+  int getBlockStage(int block) const;
+  // Block that produces the skip feature of the up block `block`, or -1
+  int getSkipProducer(int block) const;
+  // Up block that consumes the output of the down block `block`, or -1
+  int getSkipConsumer(int block) const;
+
+  std::shared_ptr<distributed::ProcessGroup> _processGroup;
+  diffusion::KarrasDiffusion _model = nullptr;
+  model::ImageUNetModel _innerModel = nullptr;
+  int64_t _microBatchSize;
+
+  int _nDepth;
+  // First block of each stage, with the number of blocks appended
+  std::vector<int> _stageBoundaries;
+  // Parameter name prefixes owned by each stage
+  std::vector<std::vector<std::string>> _stagePrefixes;
+  // Dtype and device of the activations
+  torch::TensorOptions _options;
+
+  std::deque<MicroBatch> _inFlight;
+  torch::Tensor _lossSum;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Config/Config.hpp>
+#include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Preview worker
+// ====================================================================================================
+// Renders preview samples on a background thread with its own copy of the EMA model, its own OpenMP thread
+// budget and its own generator, so that training neither waits for it nor sees its RNG draws.
+// A preview requested while the previous one is still rendering is skipped.
+class PreviewWorker {
+ public:
+  PreviewWorker(const config::Config& config, const torch::Device& device);
+  ~PreviewWorker();
+
+  // Copy the EMA weights and start rendering. Returns false if the preview is skipped.
+  bool submit(diffusion::KarrasDiffusion& emaModel, int64_t step);
+  void wait();
+
+  int64_t getNumSkipped() const;
+
+ private:
+  void run();
+  void render(int64_t step);
+
+  config::Config _config;
+  torch::Device _device;
+  diffusion::KarrasDiffusion _model = nullptr;
+  torch::Generator _generator;
+
+  std::thread _thread;
+  mutable std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _hasJob;
+  bool _isBusy;
+  bool _toStop;
+  int64_t _step;
+  int64_t _nSkipped;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
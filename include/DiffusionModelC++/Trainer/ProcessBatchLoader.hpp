@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sys/types.h>
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Process batch loader
+// ====================================================================================================
+// Runs `nWorkers` decode workers as forked processes, each pinned to its own core, so they do not compete with
+// the intra-op threads of the trainer. The trainer process is restricted to the remaining cores. Under several
+// local ranks (LOCAL_RANK / LOCAL_WORLD_SIZE), each rank first takes its own share of the affinity mask.
+//
+// Requests and finished batches go through a shared memory region without locks: each worker owns a ring of
+// `slotsPerWorker` slots, the trainer writes the sample indices into a slot and publishes it by bumping the
+// worker's request counter, and the worker writes the batch into the same slot and bumps its done counter.
+// Batch k goes to worker k % nWorkers, so batches come back in sampler order. The returned tensors are views of
+// the slots, which are only reused after the last reference to the tensor is gone.
+//
+// The workers are forked in the constructor and see the dataset as it was then. Each has its own copy of any
+// state the dataset changes, e.g. the decode cache in streaming mode.
+class ProcessBatchLoader : public ImageBatchLoader {
+ public:
+  using GetBatchFunc = std::function<torch::Tensor(torch::ArrayRef<size_t>)>;
+
+  ProcessBatchLoader(GetBatchFunc getBatch,
+                     ResumableRandomSampler sampler,
+                     std::vector<int64_t> sampleShape,
+                     size_t batchSize,
+                     size_t nWorkers,
+                     size_t slotsPerWorker = 2);
+  ~ProcessBatchLoader() override;
+
+  void reset() override;
+  torch::optional<torch::Tensor> next() override;
+
+ private:
+  class SharedRegion;
+
+  // Fill the free slots with requests
+  void issue();
+  // Wait until the worker of batch `sequence` has finished it
+  void waitForBatch(uint64_t sequence);
+  size_t getSlot(uint64_t sequence) const;
+  [[noreturn]] void work(size_t iWorker, const GetBatchFunc& getBatch, int core);
+
+  std::shared_ptr<SharedRegion> _region;
+  ResumableRandomSampler _sampler;
+  std::vector<int64_t> _batchShape;
+  size_t _batchSize;
+  size_t _nWorkers;
+  size_t _slotsPerWorker;
+  std::vector<pid_t> _workerPids;
+
+  uint64_t _nIssued;
+  uint64_t _nConsumed;
+  bool _isExhausted;
+};
+
+template <typename Dataset>
+std::unique_ptr<ImageBatchLoader> makeProcessBatchLoader(Dataset dataset,
+                                                         ResumableRandomSampler sampler,
+                                                         std::vector<int64_t> sampleShape,
+                                                         size_t batchSize,
+                                                         size_t nWorkers) {
+  auto sharedDataset = std::make_shared<Dataset>(std::move(dataset));
+
+  return std::make_unique<ProcessBatchLoader>(
+      [sharedDataset](torch::ArrayRef<size_t> indices) { return sharedDataset->get_batch(indices); },
+      std::move(sampler),
+      std::move(sampleShape),
+      batchSize,
+      nWorkers);
+}
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// Tar reader
+// ====================================================================================================
+// Sequential reader of the regular file members of a (ustar or GNU) tar archive, through a large read buffer
+class TarReader {
+ public:
+  explicit TarReader(const std::string& filePath, size_t bufferBytes = 8 * 1024 * 1024);
+
+  bool isOpen() const;
+
+  // False at the end of the archive or on a malformed header
+  bool next(std::string& name, std::vector<uchar>& data);
+  // Like next(), but seeks over the member data
+  bool skip(std::string& name);
+
+ private:
+  bool readHeader(std::string& name, uint64_t& size);
+
+  std::vector<char> _buffer;
+  std::ifstream _file;
+};
+
+// Tar files under `root`, recursively, in sorted order
+std::vector<std::string> listTarShards(const std::string& root);
+
+// ====================================================================================================
+// Tar shard loader
+// ====================================================================================================
+// Streams images from tar shards of encoded images. Shards are dealt to the ranks (shard i to rank i % worldSize)
+// and then to the worker threads of each rank. A worker reads its shards front to back, decodes and resizes the
+// members with `extension`, and passes them through its share of the shuffle buffer: each new image replaces a
+// random buffered one, which goes to the batch being filled. Workers cycle over their shards in a new order each
+// time, so the stream never runs dry.
+//
+// An epoch is a fixed number of batches, the number of images over all shards divided by (worldSize x
+// batchSize), so all ranks run the same number of steps. The order is not reproducible: on resume, the epoch
+// only continues with the right number of batches.
+class TarShardLoader : public ImageBatchLoader {
+ public:
+  TarShardLoader(const std::string& root,
+                 const int& imageWidth,
+                 const int& imageHeight,
+                 const std::string& extension,
+                 size_t batchSize,
+                 size_t nWorkers,
+                 size_t shuffleBuffer,
+                 std::shared_ptr<SamplerPosition> position,
+                 uint64_t seed,
+                 int rank = 0,
+                 int worldSize = 1);
+  ~TarShardLoader() override;
+
+  void reset() override;
+  torch::optional<torch::Tensor> next() override;
+
+  int64_t getNumImages() const;
+  int64_t getNumBatchesPerEpoch() const;
+
+ private:
+  void work(size_t iWorker, std::vector<std::string> shardPaths);
+  void push(torch::Tensor batch);
+
+  int _imageWidth;
+  int _imageHeight;
+  std::string _extension;
+  size_t _batchSize;
+  size_t _shuffleBuffer;
+  std::shared_ptr<SamplerPosition> _position;
+  uint64_t _seed;
+  int _rank;
+
+  int64_t _nImages;
+  int64_t _nBatchesPerEpoch;
+  int64_t _nBatchesLeft;
+
+  std::deque<torch::Tensor> _batches;
+  size_t _maxQueuedBatches;
+  std::mutex _mutex;
+  std::condition_variable _notEmpty;
+  std::condition_variable _notFull;
+  std::atomic<bool> _toStop;
+  std::vector<std::thread> _workers;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
@@ -5,8 +5,15 @@
 #include <DiffusionModelC++/Config/Config.hpp>
 #include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
 #include <DiffusionModelC++/Diffusion/Sampler.hpp>
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/BatchPrefetcher.hpp>
+#include <DiffusionModelC++/Trainer/CheckpointWriter.hpp>
+#include <DiffusionModelC++/Trainer/DataParallel.hpp>
 #include <DiffusionModelC++/Trainer/Dataloader.hpp>
 #include <DiffusionModelC++/Trainer/EMA.hpp>
+#include <DiffusionModelC++/Trainer/PipelineParallel.hpp>
+#include <DiffusionModelC++/Trainer/PreviewWorker.hpp>
+#include <DiffusionModelC++/Trainer/ZeroSharding.hpp>
 #include <memory>
 
 namespace dmcpp {
@@ -20,23 +27,53 @@ class Trainer {
   ~Trainer();
 
   void fit();
-  void save(const std::string& filePath);
+
+  // Restore the full training state from a checkpoint directory. Training continues with the next unseen batch.
+  void resume(const std::string& dirPath);
+  // Snapshot the training state and write it to the `dirPath` checkpoint directory in the background
+  void save(const std::string& dirPath);
+
+  // Time the training step was blocked by the last save [ms]
+  double getCheckpointBlockedTime() const;
+  // Time the last background checkpoint write took [ms]
+  double getCheckpointWriteTime() const;
 
  private:
   std::string getCheckpointDirPath() const;
+  // Rank 0, or the only process. Logs, writes checkpoints and renders previews.
+  bool isMaster() const;
+  // Collective: assemble the full EMA model on rank 0 from the EMA shards
+  void gatherEMAModel();
+  // Each rank holds the optimizer state of its own parameters (ZeRO shard or pipeline stage)
+  bool hasShardedOptimizer() const;
+  int64_t getLRSchedulerStepCount() const;
+  void setLRSchedulerStepCount(int64_t stepCount);
 
   config::Config _config;
   diffusion::KarrasDiffusion _model = nullptr;
   diffusion::KarrasDiffusion _modelEMA = nullptr;
+  std::shared_ptr<distributed::ProcessGroup> _processGroup = nullptr;
+  std::unique_ptr<GradReducer> _gradReducer = nullptr;
+  std::unique_ptr<ZeroSharding> _zeroSharding = nullptr;
+  std::unique_ptr<PipelineParallel> _pipeline = nullptr;
+  std::unique_ptr<ParameterArena> _paramArena = nullptr;
+  std::unique_ptr<ParameterArena> _paramArenaEMA = nullptr;
   std::shared_ptr<torch::optim::Optimizer> _optimizer = nullptr;
   std::shared_ptr<torch::optim::LRScheduler> _lrScheduler = nullptr;
   std::shared_ptr<EMAWarmup> _EMAScheduler = nullptr;
-  std::unique_ptr<torch::data::StatelessDataLoader<torch::data::datasets::MapDataset<ImageFolderDataset, torch::data::transforms::Stack<torch::data::Example<>>>, torch::data::samplers::RandomSampler>> _dataLoader = nullptr;
+  std::unique_ptr<ImageBatchLoader> _dataLoader = nullptr;
+  std::unique_ptr<BatchPrefetcher> _prefetcher = nullptr;
+  std::shared_ptr<SamplerPosition> _samplerPosition = nullptr;
   std::shared_ptr<diffusion::DiffusionSampler> _sampler = nullptr;
+  std::unique_ptr<CheckpointWriter> _checkpointWriter = nullptr;
+  std::unique_ptr<PreviewWorker> _previewWorker = nullptr;
 
   torch::Device _device = torch::Device(torch::kCPU);
 
   int64_t _step;
+  int64_t _epoch;
+  int64_t _batchInEpoch;
+  double _checkpointBlockedTime;
 };
 
 }  // namespace trainer
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
+#include <memory>
+
+namespace dmcpp {
+namespace trainer {
+
+// ====================================================================================================
+// ZeRO-style state sharding
+// ====================================================================================================
+// Splits the flat parameter buffer of an arena (built with nShards = worldSize) into equal shards. Each rank
+// hands only its shard to the optimizer and keeps only the EMA of its shard, so optimizer moments and EMA weights
+// take 1 / worldSize of the memory on every rank. After each optimizer step the updated shards are all-gathered
+// into the full parameters.
+class ZeroSharding {
+ public:
+  ZeroSharding(std::shared_ptr<distributed::ProcessGroup> processGroup,
+               ParameterArena& arena);
+
+  // View of this rank's shard with the matching gradient view, the only tensor the optimizer sees
+  const torch::Tensor& getShardParam() const;
+
+  int64_t getShardOffset() const;
+  int64_t getShardNumel() const;
+
+  void allGatherParams();
+
+  void updateEMA(double decay);
+
+  // Collective: the full flat EMA buffer on `root`, undefined on the other ranks
+  torch::Tensor gatherEMA(int root);
+
+  // Take this rank's shard of a full flat EMA buffer
+  void loadEMA(const torch::Tensor& flatEMA);
+
+ private:
+  std::shared_ptr<distributed::ProcessGroup> _processGroup;
+  torch::Tensor _flatParams;
+  torch::Tensor _shardParam;
+  torch::Tensor _shardEMA;
+  int64_t _shardOffset;
+  int64_t _shardNumel;
+};
+
+}  // namespace trainer
+}  // namespace dmcpp
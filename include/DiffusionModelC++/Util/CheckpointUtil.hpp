@@ -0,0 +1,38 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dmcpp {
+namespace util {
+
+using NamedTensors = std::vector<std::pair<std::string, torch::Tensor>>;
+
+// ====================================================================================================
+// Checkpoint shards
+// ====================================================================================================
+// A checkpoint is a directory of shard files. Tensor shards hold a flat {name: tensor} dict,
+// so they can be written from detached copies without the module they came from.
+
+// CPU copies of all parameters and buffers of the module
+NamedTensors snapshotNamedTensors(torch::nn::Module& module);
+
+// Serialize an archive into memory
+std::string serializeArchive(torch::serialize::OutputArchive& archive);
+
+void saveNamedTensors(const NamedTensors& tensors, const std::string& filePath);
+std::unordered_map<std::string, torch::Tensor> loadNamedTensors(const std::string& filePath);
+
+// Copy a tensor shard into the parameters and buffers of the module
+void loadModuleState(torch::nn::Module& module, const std::string& filePath);
+
+void writeFile(const std::string& filePath, const std::string& bytes);
+void syncFile(const std::string& filePath);
+void syncDirectory(const std::string& dirPath);
+
+}  // namespace util
+}  // namespace dmcpp
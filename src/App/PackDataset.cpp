@@ -0,0 +1,80 @@
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <DiffusionModelC++/Trainer/PackedDataset.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <iostream>
+
+struct Arguments {
+  std::string root = "";
+  std::string outPath = "";
+  std::string extension = ".png";
+  int imageSize = 256;
+  int64_t chunkSize = 1024;
+
+  static Arguments parseArgs(int argc, char* argv[]) {
+    Arguments args;
+
+    bool toShowHelp = false;
+
+    if (argc < 2) {
+      toShowHelp = true;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = std::string(argv[i]);
+
+      if (arg == "-h") {
+        toShowHelp = true;
+        break;
+      } else if (arg == "--out" && i + 1 < argc) {
+        args.outPath = std::string(argv[++i]);
+      } else if (arg == "--size" && i + 1 < argc) {
+        args.imageSize = std::stoi(argv[++i]);
+      } else if (arg == "--ext" && i + 1 < argc) {
+        args.extension = std::string(argv[++i]);
+      } else if (arg == "--chunk" && i + 1 < argc) {
+        args.chunkSize = std::stoll(argv[++i]);
+      } else {
+        args.root = std::string(arg);
+      }
+    }
+
+    if (args.root.empty() || args.outPath.empty()) {
+      toShowHelp = true;
+    }
+
+    if (toShowHelp) {
+      std::cout << "############################################### diffuion-model-C++ ##############################################\n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "Packs an image folder into pre-resized records for the 'packed' dataset mode.                                   \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "usege: ./pack_dataset [Options] --out path image_root                                                           \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "[Options]                                                                                                        \n";
+      std::cout << "  General                                                                                                        \n";
+      std::cout << "    -h                                                                  Show this help message                   \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "  Packing                                                                                                        \n";
+      std::cout << "    --out path                                                          Output file                              \n";
+      std::cout << "    --size n                                                            Image size (default: 256)                \n";
+      std::cout << "    --ext extension                                                     Image file extension (default: .png)     \n";
+      std::cout << "    --chunk n                                                           Images decoded per chunk (default: 1024) \n";
+      exit(EXIT_SUCCESS);
+    }
+
+    return args;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  const Arguments args = Arguments::parseArgs(argc, argv);
+
+  const std::vector<std::string>& imagePaths = dmcpp::trainer::listImageFiles(args.root, args.extension);
+
+  LOG_INFO("Packing " + std::to_string(imagePaths.size()) + " images at " + std::to_string(args.imageSize) + "x" + std::to_string(args.imageSize) + " ...");
+
+  dmcpp::trainer::writePackedDataset(imagePaths, args.imageSize, args.outPath, args.chunkSize);
+
+  LOG_INFO("Bye.");
+
+  return 0;
+}
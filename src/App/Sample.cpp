@@ -1,7 +1,122 @@
-#include <iostream>
+#include <torch/torch.h>
+
+#include <DiffusionModelC++/Config/Config.hpp>
+#include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <DiffusionModelC++/Diffusion/Sampler.hpp>
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
+#include <DiffusionModelC++/Model/FlatWeights.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/ImageUtil.hpp>
+
+struct Arguments {
+  std::string config = "";
+  std::string weights = "";
+  std::string exportPath = "";
+  std::string outDir = "sampled";
+  int64_t nSteps = 50;
+
+  static Arguments parseArgs(int argc, char* argv[]) {
+    Arguments args;
+
+    bool toShowHelp = false;
+
+    if (argc < 2) {
+      toShowHelp = true;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = std::string(argv[i]);
+
+      if (arg == "-h") {
+        toShowHelp = true;
+        break;
+      } else if (arg == "--weights" && i + 1 < argc) {
+        args.weights = std::string(argv[++i]);
+      } else if (arg == "--export-flat" && i + 1 < argc) {
+        args.exportPath = std::string(argv[++i]);
+      } else if (arg == "--out" && i + 1 < argc) {
+        args.outDir = std::string(argv[++i]);
+      } else if (arg == "--steps" && i + 1 < argc) {
+        args.nSteps = std::stoll(argv[++i]);
+      } else {
+        args.config = std::string(arg);
+      }
+    }
+
+    if (args.weights.empty()) {
+      toShowHelp = true;
+    }
+
+    if (toShowHelp) {
+      std::cout << "############################################### diffuion-model-C++ ##############################################\n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "A sampler program for diffusion models.                                                                          \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "usege: ./sample [Options] --weights path config_file                                                             \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "[Options]                                                                                                        \n";
+      std::cout << "  General                                                                                                        \n";
+      std::cout << "    -h                                                                  Show this help message                   \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "  Model                                                                                                          \n";
+      std::cout << "    --weights path                                                      Checkpoint or flat weights file          \n";
+      std::cout << "    --export-flat path                                                  Export the weights as a flat file        \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "  Sampling                                                                                                       \n";
+      std::cout << "    --steps n                                                           Number of sampling steps (default: 50)   \n";
+      std::cout << "    --out dir                                                           Output directory (default: sampled)      \n";
+      exit(EXIT_SUCCESS);
+    }
+
+    return args;
+  }
+};
 
 int main(int argc, char* argv[]) {
-  std::cout << "Hellow, world!" << std::endl;
-}
+  const Arguments args = Arguments::parseArgs(argc, argv);
+
+  // Load config
+  const auto config = dmcpp::config::Config::load(args.config);
 
+  // Set seed
+  torch::manual_seed(config.seed);
 
+  // Diffusion model
+  dmcpp::diffusion::KarrasDiffusion diffusion = dmcpp::loadDiffusionModel(config, args.weights);
+
+  if (!args.exportPath.empty()) {
+    dmcpp::model::exportFlatWeights(*diffusion, args.exportPath);
+    return 0;
+  }
+
+  // Set device
+  torch::Device device = config.deviceID >= 0 ? torch::Device(torch::kCUDA, config.deviceID) : torch::Device(torch::kCPU);
+
+  diffusion->to(device);
+  diffusion->eval();
+
+  if (config.convAutotune && device.is_cpu()) {
+    dmcpp::model::ConvAutotuner::getInstance().enable(config.convTuningCache);
+  }
+
+  // Sample
+  torch::NoGradGuard no_grad;
+
+  LOG_INFO("Sampling ...");
+
+  const torch::Tensor& x = torch::randn({config.nSamples, config.model.inChannels, config.imageSize, config.imageSize}, torch::TensorOptions(device)) * config.sampler.sigmaMax;
+  const torch::Tensor& sigmas = dmcpp::diffusion::getSigmasKarras(static_cast<int>(args.nSteps), config.sampler.sigmaMin, config.sampler.sigmaMax, 7.0, device);
+  const torch::Tensor& sampled = dmcpp::diffusion::sample_heun(diffusion, x, sigmas, 0.0f, 0.0f, std::numeric_limits<float>::infinity(), 1.0f, config.sampler.featureCacheInterval);
+
+  dmcpp::util::FileUtil::mkdirs(args.outDir);
+
+  for (int64_t iImage = 0; iImage < config.nSamples; ++iImage) {
+    const std::string& filePath = dmcpp::util::FileUtil::join(args.outDir, "sample_" + std::to_string(iImage) + ".png");
+    const cv::Mat& image = dmcpp::util::tensorToCv2Mat(sampled[iImage]);
+    dmcpp::util::saveImage(image, filePath);
+  }
+
+  LOG_INFO("Bye.");
+
+  return 0;
+}
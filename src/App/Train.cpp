@@ -2,12 +2,17 @@
 
 #include <DiffusionModelC++/Config/Config.hpp>
 #include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
 #include <DiffusionModelC++/Model/Model.hpp>
+#include <DiffusionModelC++/Trainer/EMA.hpp>
 #include <DiffusionModelC++/Trainer/Trainer.hpp>
+#include <chrono>
 #include <memory>
 
 struct Arguments {
   std::string config = "";
+  std::string resume = "";
+  int nProcs = 1;
   bool printModel = false;
 
   static Arguments parseArgs(int argc, char* argv[]) {
@@ -27,6 +32,10 @@ struct Arguments {
         break;
       } else if (arg == "--print-model") {
         args.printModel = true;
+      } else if (arg == "--nproc" && i + 1 < argc) {
+        args.nProcs = std::stoi(argv[++i]);
+      } else if (arg == "--resume" && i + 1 < argc) {
+        args.resume = std::string(argv[++i]);
       } else {
         args.config = std::string(arg);
       }
@@ -45,6 +54,10 @@ struct Arguments {
       std::cout << "                                                                                                                 \n";
       std::cout << "  Model                                                                                                          \n";
       std::cout << "    --print-model                                                       Print model                              \n";
+      std::cout << "                                                                                                                 \n";
+      std::cout << "  Training                                                                                                       \n";
+      std::cout << "    --resume dir                                                        Resume from a checkpoint directory       \n";
+      std::cout << "    --nproc n                                                           Data-parallel on n local processes       \n";
       exit(EXIT_SUCCESS);
     }
 
@@ -55,6 +68,16 @@ struct Arguments {
 int main(int argc, char* argv[]) {
   const Arguments args = Arguments::parseArgs(argc, argv);
 
+  // Local data-parallel launch, before libtorch starts any thread. Each child continues as one rank.
+  // For multiple hosts, start one process per rank with RANK / WORLD_SIZE / MASTER_ADDR / MASTER_PORT instead.
+  if (args.nProcs > 1) {
+    int exitCode = EXIT_SUCCESS;
+
+    if (dmcpp::distributed::spawnLocalProcesses(args.nProcs, exitCode)) {
+      return exitCode;
+    }
+  }
+
   // Load config
   const auto config = dmcpp::config::Config::load(args.config);
 
@@ -62,8 +85,16 @@ int main(int argc, char* argv[]) {
   torch::manual_seed(config.seed);
 
   // Diffusion model
-  dmcpp::diffusion::KarrasDiffusion diffusion = dmcpp::getDiffusionModel(config);
-  dmcpp::diffusion::KarrasDiffusion diffusionEMA = dmcpp::getDiffusionModel(config);
+  const auto startTime = std::chrono::high_resolution_clock::now();
+
+  // NOTE: On resume, all weights are restored from the checkpoint
+  dmcpp::diffusion::KarrasDiffusion diffusion = dmcpp::getDiffusionModel(config, !args.resume.empty());
+
+  // NOTE: The EMA model starts as a copy of the model, so its own initialization is skipped
+  dmcpp::diffusion::KarrasDiffusion diffusionEMA = dmcpp::getDiffusionModel(config, true);
+  dmcpp::trainer::copyEMAModel(diffusion, diffusionEMA);
+
+  LOG_INFO("Models built in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()) + " [ms]");
 
   if (args.printModel) {
     std::cout << diffusion << std::endl;
@@ -72,6 +103,10 @@ int main(int argc, char* argv[]) {
   // Trainer
   auto trainer = std::make_shared<dmcpp::trainer::Trainer>(config, diffusion, diffusionEMA);
 
+  if (!args.resume.empty()) {
+    trainer->resume(args.resume);
+  }
+
   trainer->fit();
 
   LOG_INFO("Bye.");
@@ -1,6 +1,43 @@
 #include <DiffusionModelC++/Config/Config.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
 
 namespace dmcpp::config {
+TokenMergeConfig TokenMergeConfig::load(const picojson::value &json) {
+  TokenMergeConfig config;
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<double>("sigma_min", json);
+    if (ptr != nullptr) {
+      config.sigmaMin = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<double>("sigma_max", json);
+    if (ptr != nullptr) {
+      config.sigmaMax = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getVectorValues<double>("ratio", json);
+
+    if (ptr[0] != nullptr) {
+      std::vector<double> ratio;
+
+      for (auto ptr_element : ptr) {
+        if (ptr_element != nullptr) {
+          ratio.push_back(*ptr_element);
+        }
+      }
+
+      config.ratio = ratio;
+    }
+  }
+
+  return config;
+}
+
 ModelConfig ModelConfig::load(const picojson::value &json) {
   ModelConfig config;
 
@@ -131,6 +168,21 @@ ModelConfig ModelConfig::load(const picojson::value &json) {
     }
   }
 
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<std::string>("resample", json);
+    if (ptr != nullptr) {
+      config.resample = GetValueHelpers::parseEnum<ResampleType>(*ptr, str_ResampleType);
+    }
+  }
+
+  if (json.contains("token_merge") && json.get("token_merge").is<picojson::array>()) {
+    const picojson::array &array = json.get("token_merge").get<picojson::array>();
+
+    for (const auto &element : array) {
+      config.tokenMerge.push_back(TokenMergeConfig::load(element));
+    }
+  }
+
   return config;
 }
 
@@ -165,6 +217,62 @@ DatasetConfig DatasetConfig::load(const picojson::value &json) {
     }
   }
 
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<bool>("worker_processes", json);
+    if (ptr != nullptr) {
+      config.workerProcesses = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<std::string>("mode", json);
+    if (ptr != nullptr) {
+      config.mode = GetValueHelpers::parseEnum<DatasetMode>(*ptr, str_DatasetMode);
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<std::string>("manifest", json);
+    if (ptr != nullptr) {
+      config.manifest = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<bool>("shared_cache", json);
+    if (ptr != nullptr) {
+      config.sharedCache = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<int>("cache_mb", json);
+    if (ptr != nullptr) {
+      config.cacheMB = static_cast<size_t>(*ptr);
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<int>("encoded_quality", json);
+    if (ptr != nullptr) {
+      config.encodedQuality = *ptr;
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<int>("shuffle_buffer", json);
+    if (ptr != nullptr) {
+      config.shuffleBuffer = static_cast<size_t>(*ptr);
+    }
+  }
+
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<int>("prefetch_depth", json);
+    if (ptr != nullptr) {
+      config.prefetchDepth = static_cast<size_t>(*ptr);
+    }
+  }
+
   return config;
 }
 
@@ -289,6 +397,13 @@ SamplerConfig SamplerConfig::load(const picojson::value &json) {
     }
   }
 
+  {
+    const auto ptr = GetValueHelpers::getScalarValue<int>("feature_cache_interval", json);
+    if (ptr != nullptr) {
+      config.featureCacheInterval = static_cast<int64_t>(*ptr);
+    }
+  }
+
   return config;
 }
 
@@ -381,6 +496,20 @@ Config Config::load(const std::string &path) {
     }
   }
 
+  {
+    const auto ptr_gradAccumSteps = GetValueHelpers::getScalarValue<int>("grad_accum_steps", *jsonValue);
+    if (ptr_gradAccumSteps != nullptr) {
+      config.gradAccumSteps = std::max<int64_t>(1, static_cast<int64_t>(*ptr_gradAccumSteps));
+    }
+  }
+
+  {
+    const auto ptr_microBatchSize = GetValueHelpers::getScalarValue<int>("micro_batch_size", *jsonValue);
+    if (ptr_microBatchSize != nullptr) {
+      config.microBatchSize = static_cast<int64_t>(*ptr_microBatchSize);
+    }
+  }
+
   {
     const auto ptr_sampleEveryStep = GetValueHelpers::getScalarValue<int>("sample_every_step", *jsonValue);
     if (ptr_sampleEveryStep != nullptr) {
@@ -402,6 +531,57 @@ Config Config::load(const std::string &path) {
     }
   }
 
+  {
+    const auto ptr_previewThreads = GetValueHelpers::getScalarValue<int>("preview_threads", *jsonValue);
+    if (ptr_previewThreads != nullptr) {
+      config.previewThreads = static_cast<int64_t>(*ptr_previewThreads);
+    }
+  }
+
+  {
+    const auto ptr_paramArena = GetValueHelpers::getScalarValue<bool>("param_arena", *jsonValue);
+    if (ptr_paramArena != nullptr) {
+      config.paramArena = *ptr_paramArena;
+    }
+  }
+
+  {
+    const auto ptr_ddpBucketMB = GetValueHelpers::getScalarValue<int>("ddp_bucket_mb", *jsonValue);
+    if (ptr_ddpBucketMB != nullptr) {
+      config.ddpBucketMB = static_cast<int64_t>(*ptr_ddpBucketMB);
+    }
+  }
+
+  {
+    const auto ptr_zeroSharding = GetValueHelpers::getScalarValue<bool>("zero_sharding", *jsonValue);
+    if (ptr_zeroSharding != nullptr) {
+      config.zeroSharding = *ptr_zeroSharding;
+    }
+  }
+
+  {
+    const auto ptr_pipelineParallel = GetValueHelpers::getScalarValue<bool>("pipeline_parallel", *jsonValue);
+    if (ptr_pipelineParallel != nullptr) {
+      config.pipelineParallel = *ptr_pipelineParallel;
+    }
+  }
+
+  {
+    const auto ptr_convAutotune = GetValueHelpers::getScalarValue<bool>("conv_autotune", *jsonValue);
+    if (ptr_convAutotune != nullptr) {
+      config.convAutotune = *ptr_convAutotune;
+    }
+  }
+
+  {
+    const auto ptr_convTuningCache = GetValueHelpers::getScalarValue<std::string>("conv_tuning_cache", *jsonValue);
+    if (ptr_convTuningCache != nullptr) {
+      config.convTuningCache = *ptr_convTuningCache;
+    } else {
+      config.convTuningCache = util::FileUtil::join(config.logDir, "conv_tuning_cache.json");
+    }
+  }
+
   LOG_INFO("Done.");
 
   return config;
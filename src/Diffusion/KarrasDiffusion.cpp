@@ -82,6 +82,14 @@ void KarrasDiffusionImpl::reset() {
   _innerModel->reset();
 }
 
+void KarrasDiffusionImpl::clearFeatureCache() {
+  _innerModel->clearFeatureCache();
+}
+
+model::ImageUNetModel KarrasDiffusionImpl::getInnerModel() const {
+  return _innerModel;
+}
+
 torch::Tensor KarrasDiffusionImpl::toD(const torch::Tensor& x,
                                        const torch::Tensor& sigma,
                                        const torch::Tensor& denoised) {
@@ -19,7 +19,8 @@ CosineInterpolatedSampler::~CosineInterpolatedSampler() = default;
 
 torch::Tensor CosineInterpolatedSampler::sample(const at::IntArrayRef &shape,
                                                 const torch::Device &device,
-                                                const torch::Dtype &dtype) {
+                                                const torch::Dtype &dtype,
+                                                torch::optional<torch::Generator> generator) {
   return randCosineInterpolated(
       shape,
       _imageD,
@@ -29,7 +30,8 @@ torch::Tensor CosineInterpolatedSampler::sample(const at::IntArrayRef &shape,
       _minValue,
       _maxValue,
       device,
-      dtype);
+      dtype,
+      generator);
 }
 
 }  // namespace dmcpp::diffusion
\ No newline at end of file
@@ -0,0 +1,808 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace dmcpp::distributed {
+
+namespace {
+
+// How long to keep retrying to reach the master
+constexpr double kConnectTimeout = 300.0;
+
+void throwSystemError(const std::string& what) {
+  throw std::runtime_error(what + " : " + std::strerror(errno));
+}
+
+// Integer environment variable within [minValue, maxValue], or exit
+int getEnvInt(const char* name, const char* text, long minValue, long maxValue) {
+  char* end = nullptr;
+  errno = 0;
+  const long value = std::strtol(text, &end, 10);
+
+  if (errno != 0 || end == text || *end != '\0' || value < minValue || value > maxValue) {
+    LOG_CRITICAL(std::string(name) + "='" + text + "' is not an integer in [" + std::to_string(minValue) + ", " + std::to_string(maxValue) + "]");
+    exit(EXIT_FAILURE);
+  }
+
+  return static_cast<int>(value);
+}
+
+void setNoDelay(int fd) {
+  const int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+int createListenSocket(int port, int& boundPort) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0) {
+    throwSystemError("socket");
+  }
+
+  const int flag = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    throwSystemError("bind port " + std::to_string(port));
+  }
+
+  if (listen(fd, SOMAXCONN) < 0) {
+    throwSystemError("listen");
+  }
+
+  socklen_t length = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length);
+  boundPort = ntohs(addr.sin_port);
+
+  return fd;
+}
+
+int connectWithRetry(uint32_t ip, int port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  while (true) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+      throwSystemError("socket");
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+      setNoDelay(fd);
+      return fd;
+    }
+
+    close(fd);
+
+    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() > kConnectTimeout) {
+      throwSystemError("connect port " + std::to_string(port));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+uint32_t resolveIPv4(const std::string& host) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* result = nullptr;
+
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr) {
+    throw std::runtime_error("Failed to resolve " + host);
+  }
+
+  const uint32_t ip = reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+
+  return ip;
+}
+
+void sendAll(int fd, const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+
+  while (size > 0) {
+    const ssize_t n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throwSystemError("send");
+    }
+
+    ptr += n;
+    size -= static_cast<size_t>(n);
+  }
+}
+
+void recvAll(int fd, void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+
+  while (size > 0) {
+    const ssize_t n = ::recv(fd, ptr, size, 0);
+
+    if (n == 0) {
+      throw std::runtime_error("Connection closed by peer");
+    }
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throwSystemError("recv");
+    }
+
+    ptr += n;
+    size -= static_cast<size_t>(n);
+  }
+}
+
+// Chunk boundaries of an even split of `numel` elements into `nChunks`
+std::vector<int64_t> splitEven(int64_t numel, int nChunks) {
+  std::vector<int64_t> offsets(nChunks + 1);
+
+  for (int i = 0; i <= nChunks; ++i) {
+    offsets[i] = numel * i / nChunks;
+  }
+
+  return offsets;
+}
+
+// Contiguous host tensor sharing memory with `tensor` when possible
+torch::Tensor toHost(const torch::Tensor& tensor) {
+  if (tensor.is_cpu() && tensor.is_contiguous()) {
+    return tensor;
+  }
+
+  return tensor.to(torch::kCPU).contiguous();
+}
+
+}  // namespace
+
+ProcessGroup::ProcessGroup(int rank,
+                           int worldSize,
+                           const std::string& masterAddr,
+                           int masterPort)
+    : _rank(rank),
+      _worldSize(worldSize),
+      _sockets(),
+      _commThread(),
+      _mutex(),
+      _condition(),
+      _tasks(),
+      _toStop(false),
+      _pendingSends() {
+  TORCH_CHECK(0 <= rank && rank < worldSize, "Invalid rank " + std::to_string(rank) + " for world size " + std::to_string(worldSize));
+
+  LOG_INFO("Rank " + std::to_string(rank) + " / " + std::to_string(worldSize) + " : connecting to " + masterAddr + ":" + std::to_string(masterPort) + " ...");
+
+  connectMesh(masterAddr, masterPort);
+
+  _pendingSends.resize(worldSize);
+
+  _commThread = std::thread(&ProcessGroup::runCommThread, this);
+
+  LOG_INFO("Rank " + std::to_string(rank) + " : connected.");
+}
+
+ProcessGroup::~ProcessGroup() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _toStop = true;
+  }
+
+  _condition.notify_all();
+
+  if (_commThread.joinable()) {
+    _commThread.join();
+  }
+
+  for (const int fd : _sockets) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+std::shared_ptr<ProcessGroup> ProcessGroup::fromEnv() {
+  const char* worldSizeText = std::getenv("WORLD_SIZE");
+
+  if (worldSizeText == nullptr) {
+    return nullptr;
+  }
+
+  const int worldSize = getEnvInt("WORLD_SIZE", worldSizeText, 1, 65536);
+
+  if (worldSize == 1) {
+    return nullptr;
+  }
+
+  const char* rankText = std::getenv("RANK");
+
+  if (rankText == nullptr) {
+    LOG_CRITICAL("WORLD_SIZE is set but RANK is not");
+    exit(EXIT_FAILURE);
+  }
+
+  const int rank = getEnvInt("RANK", rankText, 0, worldSize - 1);
+
+  const char* masterAddr = std::getenv("MASTER_ADDR");
+  const char* masterPort = std::getenv("MASTER_PORT");
+
+  return std::make_shared<ProcessGroup>(rank,
+                                        worldSize,
+                                        masterAddr != nullptr ? std::string(masterAddr) : std::string("127.0.0.1"),
+                                        masterPort != nullptr ? getEnvInt("MASTER_PORT", masterPort, 1, 65535) : 29500);
+}
+
+int ProcessGroup::getRank() const {
+  return _rank;
+}
+
+int ProcessGroup::getWorldSize() const {
+  return _worldSize;
+}
+
+void ProcessGroup::connectMesh(const std::string& masterAddr, int masterPort) {
+  _sockets.assign(_worldSize, -1);
+
+  // Listening IP and port of every rank, in network byte order
+  std::vector<uint32_t> ips(_worldSize, 0);
+  std::vector<int32_t> ports(_worldSize, 0);
+
+  if (_rank == 0) {
+    int port = 0;
+    const int listenFd = createListenSocket(masterPort, port);
+
+    for (int i = 1; i < _worldSize; ++i) {
+      sockaddr_in addr{};
+      socklen_t length = sizeof(addr);
+
+      const int fd = accept(listenFd, reinterpret_cast<sockaddr*>(&addr), &length);
+
+      if (fd < 0) {
+        throwSystemError("accept");
+      }
+
+      setNoDelay(fd);
+
+      int32_t hello[2];
+      recvAll(fd, hello, sizeof(hello));
+
+      TORCH_CHECK(0 < hello[0] && hello[0] < _worldSize && _sockets[hello[0]] < 0, "Unexpected rank " + std::to_string(hello[0]));
+
+      _sockets[hello[0]] = fd;
+      ips[hello[0]] = addr.sin_addr.s_addr;
+      ports[hello[0]] = hello[1];
+    }
+
+    close(listenFd);
+
+    for (int i = 1; i < _worldSize; ++i) {
+      sendAll(_sockets[i], ips.data(), ips.size() * sizeof(uint32_t));
+      sendAll(_sockets[i], ports.data(), ports.size() * sizeof(int32_t));
+    }
+  } else {
+    int port = 0;
+    const int listenFd = createListenSocket(0, port);
+
+    // Rendezvous, this connection is also the link to rank 0
+    _sockets[0] = connectWithRetry(resolveIPv4(masterAddr), masterPort);
+
+    const int32_t hello[2] = {_rank, port};
+    sendAll(_sockets[0], hello, sizeof(hello));
+
+    recvAll(_sockets[0], ips.data(), ips.size() * sizeof(uint32_t));
+    recvAll(_sockets[0], ports.data(), ports.size() * sizeof(int32_t));
+
+    // Connect to the lower ranks, accept the higher ones
+    for (int i = 1; i < _rank; ++i) {
+      _sockets[i] = connectWithRetry(ips[i], ports[i]);
+
+      const int32_t peerHello = _rank;
+      sendAll(_sockets[i], &peerHello, sizeof(peerHello));
+    }
+
+    for (int i = _rank + 1; i < _worldSize; ++i) {
+      const int fd = accept(listenFd, nullptr, nullptr);
+
+      if (fd < 0) {
+        throwSystemError("accept");
+      }
+
+      setNoDelay(fd);
+
+      int32_t peerRank;
+      recvAll(fd, &peerRank, sizeof(peerRank));
+
+      TORCH_CHECK(_rank < peerRank && peerRank < _worldSize && _sockets[peerRank] < 0, "Unexpected rank " + std::to_string(peerRank));
+
+      _sockets[peerRank] = fd;
+    }
+
+    close(listenFd);
+  }
+}
+
+// ====================================================================================================
+// Communication thread
+// ====================================================================================================
+
+std::future<void> ProcessGroup::enqueue(std::function<void()> task) {
+  std::packaged_task<void()> packagedTask(std::move(task));
+  std::future<void> future = packagedTask.get_future();
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(std::move(packagedTask));
+  }
+
+  _condition.notify_all();
+
+  return future;
+}
+
+void ProcessGroup::runCommThread() {
+  torch::NoGradGuard no_grad;
+
+  while (true) {
+    std::packaged_task<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _condition.wait(lock, [this]() { return _toStop || !_tasks.empty(); });
+
+      if (_tasks.empty()) {
+        break;
+      }
+
+      task = std::move(_tasks.front());
+      _tasks.pop_front();
+    }
+
+    task();
+  }
+}
+
+// ====================================================================================================
+// Collectives
+// ====================================================================================================
+
+void ProcessGroup::allReduce(torch::Tensor& tensor, double scale) {
+  allReduceAsync(tensor, scale).get();
+}
+
+std::future<void> ProcessGroup::allReduceAsync(torch::Tensor tensor, double scale) {
+  TORCH_CHECK(tensor.scalar_type() == torch::kFloat32 || tensor.scalar_type() == torch::kFloat64 || tensor.scalar_type() == torch::kInt64,
+              "allReduce supports float, double and int64 tensors");
+  TORCH_CHECK(scale == 1.0 || tensor.is_floating_point(), "allReduce can only scale floating point tensors");
+
+  return enqueue([this, tensor, scale]() mutable {
+    torch::Tensor host = toHost(tensor);
+    torch::Tensor flat = host.view({-1});
+
+    const std::vector<int64_t>& offsets = splitEven(flat.numel(), _worldSize);
+
+    ringReduceScatter(flat, offsets);
+    ringAllGather(flat, offsets);
+
+    if (scale != 1.0) {
+      flat.mul_(scale);
+    }
+
+    if (!host.is_same(tensor)) {
+      tensor.copy_(host);
+    }
+  });
+}
+
+void ProcessGroup::broadcast(torch::Tensor& tensor, int root) {
+  enqueue([this, &tensor, root]() {
+    torch::Tensor host = toHost(tensor);
+    const size_t nBytes = host.nbytes();
+
+    if (_rank == root) {
+      for (int i = 0; i < _worldSize; ++i) {
+        if (i != root) {
+          sendBytes(i, host.data_ptr(), nBytes);
+        }
+      }
+    } else {
+      recvBytes(root, host.data_ptr(), nBytes);
+
+      if (!host.is_same(tensor)) {
+        tensor.copy_(host);
+      }
+    }
+  }).get();
+}
+
+torch::Tensor ProcessGroup::allGather(const torch::Tensor& tensor) {
+  const torch::Tensor& host = toHost(tensor);
+
+  std::vector<int64_t> sizes = {_worldSize};
+  sizes.insert(sizes.end(), host.sizes().begin(), host.sizes().end());
+
+  torch::Tensor gathered = torch::empty(sizes, host.options());
+
+  enqueue([this, &host, &gathered]() {
+    torch::Tensor flat = gathered.view({-1});
+    const int64_t numel = host.numel();
+
+    flat.narrow(0, numel * _rank, numel).copy_(host.view({-1}));
+
+    std::vector<int64_t> offsets(_worldSize + 1);
+
+    for (int i = 0; i <= _worldSize; ++i) {
+      offsets[i] = numel * i;
+    }
+
+    ringAllGather(flat, offsets);
+  }).get();
+
+  return gathered.to(tensor.device());
+}
+
+void ProcessGroup::allGatherInPlace(torch::Tensor& tensor) {
+  TORCH_CHECK(tensor.numel() % _worldSize == 0, "allGatherInPlace needs a number of elements divisible by the world size");
+
+  enqueue([this, &tensor]() {
+    torch::Tensor host = toHost(tensor);
+    torch::Tensor flat = host.view({-1});
+
+    ringAllGather(flat, splitEven(flat.numel(), _worldSize));
+
+    if (!host.is_same(tensor)) {
+      tensor.copy_(host);
+    }
+  }).get();
+}
+
+torch::Tensor ProcessGroup::gather(const torch::Tensor& tensor, int root) {
+  const torch::Tensor& host = toHost(tensor);
+
+  torch::Tensor gathered;
+
+  if (_rank == root) {
+    std::vector<int64_t> sizes = {_worldSize};
+    sizes.insert(sizes.end(), host.sizes().begin(), host.sizes().end());
+
+    gathered = torch::empty(sizes, host.options());
+    gathered[root].copy_(host);
+  }
+
+  enqueue([this, &host, &gathered, root]() {
+    if (_rank == root) {
+      for (int i = 0; i < _worldSize; ++i) {
+        if (i != root) {
+          recvBytes(i, gathered[i].data_ptr(), host.nbytes());
+        }
+      }
+    } else {
+      sendBytes(root, host.data_ptr(), host.nbytes());
+    }
+  }).get();
+
+  return gathered.defined() ? gathered.to(tensor.device()) : gathered;
+}
+
+std::vector<std::string> ProcessGroup::gatherBytes(const std::string& bytes, int root) {
+  std::vector<std::string> gathered;
+
+  if (_rank == root) {
+    gathered.resize(_worldSize);
+    gathered[root] = bytes;
+  }
+
+  enqueue([this, &bytes, &gathered, root]() {
+    if (_rank == root) {
+      for (int i = 0; i < _worldSize; ++i) {
+        if (i != root) {
+          int64_t size = 0;
+          recvBytes(i, &size, sizeof(size));
+
+          gathered[i].resize(static_cast<size_t>(size));
+          recvBytes(i, gathered[i].data(), gathered[i].size());
+        }
+      }
+    } else {
+      const int64_t size = static_cast<int64_t>(bytes.size());
+      sendBytes(root, &size, sizeof(size));
+      sendBytes(root, bytes.data(), bytes.size());
+    }
+  }).get();
+
+  return gathered;
+}
+
+torch::Tensor ProcessGroup::reduceScatter(const torch::Tensor& tensor) {
+  TORCH_CHECK(tensor.numel() % _worldSize == 0, "reduceScatter needs a number of elements divisible by the world size");
+
+  torch::Tensor flat = tensor.to(torch::kCPU).contiguous().view({-1}).clone();
+  const int64_t chunkSize = flat.numel() / _worldSize;
+
+  enqueue([this, &flat, chunkSize]() {
+    std::vector<int64_t> offsets(_worldSize + 1);
+
+    for (int i = 0; i <= _worldSize; ++i) {
+      offsets[i] = chunkSize * i;
+    }
+
+    ringReduceScatter(flat, offsets);
+  }).get();
+
+  return flat.narrow(0, chunkSize * _rank, chunkSize).clone().to(tensor.device());
+}
+
+void ProcessGroup::send(const torch::Tensor& tensor, int dstRank) {
+  enqueue([this, &tensor, dstRank]() {
+    const torch::Tensor& host = toHost(tensor);
+    sendBytes(dstRank, host.data_ptr(), host.nbytes());
+  }).get();
+}
+
+std::future<void> ProcessGroup::isend(const torch::Tensor& tensor, int dstRank) {
+  // NOTE: A private host copy, so the caller may modify or release the tensor right away
+  torch::Tensor host = toHost(tensor);
+
+  if (host.is_same(tensor)) {
+    host = host.clone();
+  }
+
+  return enqueue([this, host, dstRank]() {
+    _pendingSends[dstRank].push_back({host, static_cast<const char*>(host.data_ptr()), host.nbytes(), 0});
+  });
+}
+
+void ProcessGroup::recv(torch::Tensor& tensor, int srcRank) {
+  enqueue([this, &tensor, srcRank]() {
+    torch::Tensor host = toHost(tensor);
+    recvBytes(srcRank, host.data_ptr(), host.nbytes());
+
+    if (!host.is_same(tensor)) {
+      tensor.copy_(host);
+    }
+  }).get();
+}
+
+void ProcessGroup::flush() {
+  enqueue([this]() {
+    for (int peer = 0; peer < _worldSize; ++peer) {
+      progress(-1, nullptr, 0, peer);
+    }
+  }).get();
+}
+
+void ProcessGroup::barrier() {
+  torch::Tensor token = torch::zeros({1}, torch::kInt64);
+  allReduce(token);
+}
+
+// Ring reduce-scatter: after `worldSize - 1` steps, chunk `rank` holds the sum over all ranks
+void ProcessGroup::ringReduceScatter(torch::Tensor& flat, const std::vector<int64_t>& offsets) {
+  if (_worldSize == 1) {
+    return;
+  }
+
+  const int right = (_rank + 1) % _worldSize;
+  const int left = (_rank + _worldSize - 1) % _worldSize;
+  const size_t elementSize = flat.element_size();
+
+  int64_t maxChunkSize = 0;
+
+  for (int i = 0; i < _worldSize; ++i) {
+    maxChunkSize = std::max(maxChunkSize, offsets[i + 1] - offsets[i]);
+  }
+
+  torch::Tensor received = torch::empty({maxChunkSize}, flat.options());
+  char* base = static_cast<char*>(flat.data_ptr());
+
+  for (int step = 0; step < _worldSize - 1; ++step) {
+    const int sendChunk = ((_rank - step - 1) % _worldSize + _worldSize) % _worldSize;
+    const int recvChunk = ((_rank - step - 2) % _worldSize + _worldSize) % _worldSize;
+
+    const int64_t sendLength = offsets[sendChunk + 1] - offsets[sendChunk];
+    const int64_t recvLength = offsets[recvChunk + 1] - offsets[recvChunk];
+
+    sendRecvBytes(right, base + offsets[sendChunk] * elementSize, sendLength * elementSize,
+                  left, received.data_ptr(), recvLength * elementSize);
+
+    flat.narrow(0, offsets[recvChunk], recvLength).add_(received.narrow(0, 0, recvLength));
+  }
+}
+
+// Ring all-gather: every rank starts with its own chunk `rank` and ends with all of them
+void ProcessGroup::ringAllGather(torch::Tensor& flat, const std::vector<int64_t>& offsets) {
+  if (_worldSize == 1) {
+    return;
+  }
+
+  const int right = (_rank + 1) % _worldSize;
+  const int left = (_rank + _worldSize - 1) % _worldSize;
+  const size_t elementSize = flat.element_size();
+
+  char* base = static_cast<char*>(flat.data_ptr());
+
+  for (int step = 0; step < _worldSize - 1; ++step) {
+    const int sendChunk = ((_rank - step) % _worldSize + _worldSize) % _worldSize;
+    const int recvChunk = ((_rank - step - 1) % _worldSize + _worldSize) % _worldSize;
+
+    sendRecvBytes(right, base + offsets[sendChunk] * elementSize, (offsets[sendChunk + 1] - offsets[sendChunk]) * elementSize,
+                  left, base + offsets[recvChunk] * elementSize, (offsets[recvChunk + 1] - offsets[recvChunk]) * elementSize);
+  }
+}
+
+// ====================================================================================================
+// Point-to-point
+// ====================================================================================================
+
+// NOTE: Every send goes through the per-peer queues and every wait drives all of them, so a rank blocked on one
+//       peer still drains its queued sends to the others. Sends queued by isend() thus never stall a schedule in
+//       which each receive is eventually posted.
+void ProcessGroup::sendBytes(int peer, const void* data, size_t size) {
+  _pendingSends[peer].push_back({torch::Tensor(), static_cast<const char*>(data), size, 0});
+  progress(-1, nullptr, 0, peer);
+}
+
+void ProcessGroup::recvBytes(int peer, void* data, size_t size) {
+  progress(peer, data, size, -1);
+}
+
+// Full-duplex exchange, so that two ranks sending large chunks to each other do not block on full socket buffers
+void ProcessGroup::sendRecvBytes(int dstPeer, const void* sendData, size_t sendSize, int srcPeer, void* recvData, size_t recvSize) {
+  _pendingSends[dstPeer].push_back({torch::Tensor(), static_cast<const char*>(sendData), sendSize, 0});
+  progress(srcPeer, recvData, recvSize, dstPeer);
+}
+
+void ProcessGroup::progress(int srcPeer, void* recvData, size_t recvSize, int flushPeer) {
+  char* recvPtr = static_cast<char*>(recvData);
+  size_t nReceived = 0;
+
+  std::vector<pollfd> fds;
+  std::vector<int> peers;
+
+  while (true) {
+    const bool isReceiving = srcPeer >= 0 && nReceived < recvSize;
+    const bool isFlushing = flushPeer >= 0 && !_pendingSends[flushPeer].empty();
+
+    if (!isReceiving && !isFlushing) {
+      break;
+    }
+
+    fds.clear();
+    peers.clear();
+
+    for (int peer = 0; peer < _worldSize; ++peer) {
+      short events = 0;
+
+      if (!_pendingSends[peer].empty()) {
+        events |= POLLOUT;
+      }
+
+      if (isReceiving && peer == srcPeer) {
+        events |= POLLIN;
+      }
+
+      if (events != 0) {
+        fds.push_back({_sockets[peer], events, 0});
+        peers.push_back(peer);
+      }
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throwSystemError("poll");
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+      const int peer = peers[i];
+
+      if ((fds[i].revents & (POLLOUT | POLLERR | POLLHUP)) != 0 && !_pendingSends[peer].empty()) {
+        PendingSend& pending = _pendingSends[peer].front();
+
+        const ssize_t n = ::send(_sockets[peer], pending.data + pending.nSent, pending.size - pending.nSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          throwSystemError("send");
+        }
+
+        pending.nSent += n > 0 ? static_cast<size_t>(n) : 0;
+
+        if (pending.nSent == pending.size) {
+          _pendingSends[peer].pop_front();
+        }
+      }
+
+      if ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0 && peer == srcPeer && nReceived < recvSize) {
+        const ssize_t n = ::recv(_sockets[peer], recvPtr + nReceived, recvSize - nReceived, MSG_DONTWAIT);
+
+        if (n == 0) {
+          throw std::runtime_error("Connection closed by peer");
+        }
+
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          throwSystemError("recv");
+        }
+
+        nReceived += n > 0 ? static_cast<size_t>(n) : 0;
+      }
+    }
+  }
+}
+
+// ====================================================================================================
+// Local launcher
+// ====================================================================================================
+
+bool spawnLocalProcesses(int nProcs, int& exitCode) {
+  setenv("MASTER_ADDR", "127.0.0.1", 0);
+  setenv("MASTER_PORT", "29500", 0);
+
+  std::vector<pid_t> pids;
+
+  for (int rank = 0; rank < nProcs; ++rank) {
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+      LOG_CRITICAL("Failed to fork rank " + std::to_string(rank));
+      exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+      setenv("RANK", std::to_string(rank).c_str(), 1);
+      setenv("WORLD_SIZE", std::to_string(nProcs).c_str(), 1);
+      setenv("LOCAL_RANK", std::to_string(rank).c_str(), 1);
+      setenv("LOCAL_WORLD_SIZE", std::to_string(nProcs).c_str(), 1);
+      return false;
+    }
+
+    pids.push_back(pid);
+  }
+
+  exitCode = EXIT_SUCCESS;
+
+  for (const pid_t pid : pids) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    const int code = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+
+    if (exitCode == EXIT_SUCCESS && code != EXIT_SUCCESS) {
+      exitCode = code;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace dmcpp::distributed
@@ -0,0 +1,296 @@
+#include <picojson.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Config/Config.hpp>
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <chrono>
+#include <fstream>
+#include <limits>
+
+namespace dmcpp::model {
+
+namespace {
+
+inline std::vector<int64_t> toVector(const torch::ExpandingArray<2>& array) {
+  return {array->at(0), array->at(1)};
+}
+
+inline bool hasExplicitPadding(const torch::nn::Conv2dImpl& conv) {
+  return std::holds_alternative<torch::ExpandingArray<2>>(conv.options.padding()) &&
+         std::holds_alternative<torch::enumtype::kZeros>(conv.options.padding_mode());
+}
+
+inline std::vector<int64_t> getPadding(const torch::nn::Conv2dImpl& conv) {
+  return toVector(std::get<torch::ExpandingArray<2>>(conv.options.padding()));
+}
+
+}  // namespace
+
+ConvAutotuner& ConvAutotuner::getInstance() {
+  static ConvAutotuner instance;
+  return instance;
+}
+
+ConvAutotuner::ConvAutotuner()
+    : _enabled(false),
+      _cachePath(),
+      _cpuModel(getCPUModel()),
+      _algorithms(),
+      _tuningKeys(),
+      _mutex() {}
+
+void ConvAutotuner::enable(const std::string& cachePath) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  _enabled = true;
+  _cachePath = cachePath;
+
+  LOG_INFO("Enable conv autotuner on '" + _cpuModel + "' with cache " + _cachePath);
+
+  loadCache();
+}
+
+bool ConvAutotuner::isEnabled() const {
+  return _enabled;
+}
+
+torch::Tensor ConvAutotuner::forward(torch::nn::Conv2dImpl& conv, const torch::Tensor& x) {
+  if (!_enabled || !x.device().is_cpu() || x.dim() != 4 || !isSupported(conv, ConvAlgorithm::NATIVE)) {
+    return conv.forward(x);
+  }
+
+  const auto kernelSize = toVector(conv.options.kernel_size());
+  const auto stride = toVector(conv.options.stride());
+  const auto padding = getPadding(conv);
+
+  const std::string key = _cpuModel + "|threads=" + std::to_string(at::get_num_threads()) +
+                          "|c=" + std::to_string(conv.options.in_channels()) + "x" + std::to_string(conv.options.out_channels()) +
+                          "|k=" + std::to_string(kernelSize[0]) + "x" + std::to_string(kernelSize[1]) +
+                          "|s=" + std::to_string(stride[0]) + "x" + std::to_string(stride[1]) +
+                          "|p=" + std::to_string(padding[0]) + "x" + std::to_string(padding[1]) +
+                          "|x=" + std::to_string(x.size(0)) + "x" + std::to_string(x.size(2)) + "x" + std::to_string(x.size(3));
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto iter = _algorithms.find(key);
+    if (iter != _algorithms.end()) {
+      return run(conv, x, iter->second);
+    }
+
+    // NOTE: Another thread is benchmarking this shape, so run the default until its decision is in
+    if (!_tuningKeys.insert(key).second) {
+      return run(conv, x, ConvAlgorithm::NATIVE);
+    }
+  }
+
+  // NOTE: Benchmarked without the lock, so convolutions of other shapes, or already tuned ones, are not blocked
+  const ConvAlgorithm algorithm = tune(conv, x, key);
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _tuningKeys.erase(key);
+    _algorithms[key] = algorithm;
+    saveCache();
+  }
+
+  return run(conv, x, algorithm);
+}
+
+ConvAlgorithm ConvAutotuner::tune(torch::nn::Conv2dImpl& conv, const torch::Tensor& x, const std::string& key) {
+  torch::NoGradGuard no_grad;
+
+  constexpr int nRepeats = 3;
+
+  const torch::Tensor input = x.detach();
+  const torch::Tensor reference = run(conv, input, ConvAlgorithm::NATIVE);
+  const double tolerance = 1e-3 * std::max(1.0, reference.abs().max().item<double>());
+
+  ConvAlgorithm bestAlgorithm = ConvAlgorithm::NATIVE;
+  double bestTime = std::numeric_limits<double>::infinity();
+  std::string report;
+
+  for (int iAlgorithm = 0; iAlgorithm < static_cast<int>(ConvAlgorithm::INVALID); ++iAlgorithm) {
+    const auto algorithm = static_cast<ConvAlgorithm>(iAlgorithm);
+
+    if (!isSupported(conv, algorithm)) {
+      continue;
+    }
+
+    try {
+      // Warmup and sanity check
+      const torch::Tensor& output = run(conv, input, algorithm);
+      if ((output - reference).abs().max().item<double>() > tolerance) {
+        LOG_WARN("Conv algorithm '" + str_ConvAlgorithm[iAlgorithm] + "' gives inaccurate results, skipped.");
+        continue;
+      }
+
+      double time = std::numeric_limits<double>::infinity();
+
+      for (int iRepeat = 0; iRepeat < nRepeats; ++iRepeat) {
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        run(conv, input, algorithm);
+        time = std::min(time, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+      }
+
+      report += " " + str_ConvAlgorithm[iAlgorithm] + "=" + std::to_string(time * 1e3) + "ms";
+
+      if (time < bestTime) {
+        bestTime = time;
+        bestAlgorithm = algorithm;
+      }
+    } catch (const std::exception& e) {
+      LOG_DEBUG("Conv algorithm '" + str_ConvAlgorithm[iAlgorithm] + "' is not available: " + std::string(e.what()));
+    }
+  }
+
+  LOG_INFO("Autotuned conv " + key + " :" + report + " -> " + str_ConvAlgorithm[static_cast<int>(bestAlgorithm)]);
+
+  return bestAlgorithm;
+}
+
+bool ConvAutotuner::isSupported(const torch::nn::Conv2dImpl& conv, ConvAlgorithm algorithm) {
+  const auto& options = conv.options;
+
+  const bool isPlain = hasExplicitPadding(conv) &&
+                       options.groups() == 1 &&
+                       options.dilation()->at(0) == 1 &&
+                       options.dilation()->at(1) == 1;
+
+  switch (algorithm) {
+    case ConvAlgorithm::NATIVE:
+    case ConvAlgorithm::CHANNELS_LAST:
+    case ConvAlgorithm::IM2COL_GEMM:
+      return isPlain;
+    case ConvAlgorithm::WINOGRAD:
+      return isPlain &&
+             at::_nnpack_available() &&
+             options.kernel_size()->at(0) == 3 &&
+             options.kernel_size()->at(1) == 3 &&
+             options.stride()->at(0) == 1 &&
+             options.stride()->at(1) == 1;
+    case ConvAlgorithm::MKLDNN:
+      return isPlain && at::hasMKLDNN();
+    default:
+      return false;
+  }
+}
+
+torch::Tensor ConvAutotuner::run(torch::nn::Conv2dImpl& conv, const torch::Tensor& x, ConvAlgorithm algorithm) {
+  const c10::optional<torch::Tensor> bias = conv.bias.defined() ? c10::optional<torch::Tensor>(conv.bias) : c10::nullopt;
+
+  switch (algorithm) {
+    case ConvAlgorithm::CHANNELS_LAST:
+      return conv.forward(x.contiguous(torch::MemoryFormat::ChannelsLast)).contiguous();
+    case ConvAlgorithm::IM2COL_GEMM:
+      return at::thnn_conv2d(x.contiguous(),
+                             conv.weight,
+                             toVector(conv.options.kernel_size()),
+                             bias,
+                             toVector(conv.options.stride()),
+                             getPadding(conv));
+    case ConvAlgorithm::WINOGRAD:
+      return at::_nnpack_spatial_convolution(x.contiguous(),
+                                             conv.weight,
+                                             bias,
+                                             getPadding(conv),
+                                             toVector(conv.options.stride()));
+    case ConvAlgorithm::MKLDNN:
+      return at::mkldnn_convolution(x.contiguous(),
+                                    conv.weight.contiguous(),
+                                    bias,
+                                    getPadding(conv),
+                                    toVector(conv.options.stride()),
+                                    toVector(conv.options.dilation()),
+                                    conv.options.groups());
+    default:
+      return conv.forward(x);
+  }
+}
+
+std::string ConvAutotuner::getCPUModel() {
+  std::ifstream fs("/proc/cpuinfo");
+  std::string line;
+
+  while (std::getline(fs, line)) {
+    if (line.rfind("model name", 0) == 0) {
+      const size_t pos = line.find(':');
+      if (pos != std::string::npos) {
+        return line.substr(line.find_first_not_of(' ', pos + 1));
+      }
+    }
+  }
+
+  return "unknown";
+}
+
+void ConvAutotuner::loadCache() {
+  if (_cachePath.empty() || !util::FileUtil::isFile(_cachePath)) {
+    return;
+  }
+
+  picojson::value json;
+
+  if (auto fs = std::ifstream(_cachePath, std::ios::binary)) {
+    fs >> json;
+  }
+
+  if (!json.is<picojson::object>()) {
+    LOG_WARN("Ignore broken conv tuning cache: " + _cachePath);
+    return;
+  }
+
+  for (const auto& entry : json.get<picojson::object>()) {
+    if (entry.second.is<std::string>()) {
+      const auto algorithm = config::GetValueHelpers::parseEnum<ConvAlgorithm>(entry.second.get<std::string>(), str_ConvAlgorithm);
+
+      if (algorithm != ConvAlgorithm::INVALID) {
+        _algorithms[entry.first] = algorithm;
+      }
+    }
+  }
+
+  LOG_INFO("Loaded " + std::to_string(_algorithms.size()) + " conv tuning entries from " + _cachePath);
+}
+
+void ConvAutotuner::saveCache() const {
+  if (_cachePath.empty()) {
+    return;
+  }
+
+  picojson::object json;
+
+  for (const auto& entry : _algorithms) {
+    json[entry.first] = picojson::value(str_ConvAlgorithm[static_cast<int>(entry.second)]);
+  }
+
+  util::FileUtil::mkdirs(util::FileUtil::dirPath(_cachePath));
+
+  // NOTE: Write to a temporary file first so that concurrent runs never read a partial cache. The name is unique
+  //       to the process, since the ranks of a data-parallel run share the cache file and save at the same step.
+  const std::string tmpPath = _cachePath + ".tmp" + std::to_string(getpid());
+
+  if (auto fs = std::ofstream(tmpPath, std::ios::binary)) {
+    fs << picojson::value(json).serialize(true);
+  } else {
+    LOG_WARN("Failed to write conv tuning cache: " + _cachePath);
+    return;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tmpPath, _cachePath, error);
+
+  if (error) {
+    LOG_WARN("Failed to write conv tuning cache: " + _cachePath + " : " + error.message());
+    std::filesystem::remove(tmpPath, error);
+  }
+}
+
+torch::Tensor tunedConv2d(torch::nn::Conv2dImpl& conv, const torch::Tensor& x) {
+  return ConvAutotuner::getInstance().forward(conv, x);
+}
+
+}  // namespace dmcpp::model
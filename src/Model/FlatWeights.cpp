@@ -0,0 +1,298 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Model/FlatWeights.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace dmcpp::model {
+
+namespace {
+
+struct FlatWeightsEntry {
+  std::string name;
+  int32_t dtype;
+  std::vector<int64_t> sizes;
+  uint64_t offset;
+  uint64_t nbytes;
+};
+
+// Keeps the file mapped while any tensor refers to it
+struct FileMapping {
+  FileMapping(void* data, size_t size)
+      : data(data),
+        size(size) {}
+
+  ~FileMapping() {
+    if (data != nullptr && data != MAP_FAILED) {
+      munmap(data, size);
+    }
+  }
+
+  void* data;
+  size_t size;
+};
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1ULL) / alignment * alignment;
+}
+
+std::vector<std::pair<std::string, torch::Tensor>> getNamedTensors(torch::nn::Module& module) {
+  std::vector<std::pair<std::string, torch::Tensor>> tensors;
+
+  for (const auto& item : module.named_parameters(true)) {
+    tensors.emplace_back(item.key(), item.value());
+  }
+
+  for (const auto& item : module.named_buffers(true)) {
+    tensors.emplace_back(item.key(), item.value());
+  }
+
+  return tensors;
+}
+
+template <class Type>
+inline void writeValue(std::ofstream& fs, const Type& value) {
+  fs.write(reinterpret_cast<const char*>(&value), sizeof(Type));
+}
+
+template <class Type>
+inline Type readValue(const char*& ptr) {
+  Type value;
+  std::memcpy(&value, ptr, sizeof(Type));
+  ptr += sizeof(Type);
+  return value;
+}
+
+}  // namespace
+
+void exportFlatWeights(torch::nn::Module& module, const std::string& filePath) {
+  torch::NoGradGuard no_grad;
+
+  LOG_INFO("Exporting flat weights ...");
+
+  const auto& namedTensors = getNamedTensors(module);
+
+  // Tensor table
+  std::vector<FlatWeightsEntry> entries;
+  std::vector<torch::Tensor> tensors;
+  uint64_t tableSize = 0;
+  uint64_t dataSize = 0;
+
+  for (const auto& namedTensor : namedTensors) {
+    const torch::Tensor& tensor = namedTensor.second.detach().to(torch::kCPU).contiguous();
+
+    FlatWeightsEntry entry;
+    entry.name = namedTensor.first;
+    entry.dtype = static_cast<int32_t>(tensor.scalar_type());
+    entry.sizes = tensor.sizes().vec();
+    entry.offset = alignUp(dataSize, FLAT_WEIGHTS_ALIGNMENT);
+    entry.nbytes = tensor.nbytes();
+
+    dataSize = entry.offset + entry.nbytes;
+    tableSize += sizeof(uint32_t) + entry.name.size() + sizeof(int32_t) + sizeof(uint32_t) +
+                 sizeof(int64_t) * entry.sizes.size() + 2ULL * sizeof(uint64_t);
+
+    entries.push_back(entry);
+    tensors.push_back(tensor);
+  }
+
+  FlatWeightsHeader header;
+  std::memcpy(header.magic, FLAT_WEIGHTS_MAGIC, sizeof(header.magic));
+  header.version = FLAT_WEIGHTS_VERSION;
+  header.nTensors = static_cast<uint32_t>(entries.size());
+  header.dataOffset = alignUp(sizeof(FlatWeightsHeader) + tableSize, FLAT_WEIGHTS_PAGE_SIZE);
+  header.dataSize = dataSize;
+
+  util::FileUtil::mkdirs(util::FileUtil::dirPath(filePath));
+
+  std::ofstream fs(filePath, std::ios::binary | std::ios::trunc);
+
+  if (!fs) {
+    LOG_CRITICAL("Failed to open " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  writeValue(fs, header);
+
+  for (const auto& entry : entries) {
+    writeValue(fs, static_cast<uint32_t>(entry.name.size()));
+    fs.write(entry.name.data(), static_cast<std::streamsize>(entry.name.size()));
+    writeValue(fs, entry.dtype);
+    writeValue(fs, static_cast<uint32_t>(entry.sizes.size()));
+    for (const auto& size : entry.sizes) {
+      writeValue(fs, size);
+    }
+    writeValue(fs, entry.offset);
+    writeValue(fs, entry.nbytes);
+  }
+
+  const std::vector<char> zeros(FLAT_WEIGHTS_PAGE_SIZE, 0);
+  uint64_t position = sizeof(FlatWeightsHeader) + tableSize;
+
+  const auto pad = [&](uint64_t target) {
+    while (position < target) {
+      const uint64_t n = std::min<uint64_t>(target - position, zeros.size());
+      fs.write(zeros.data(), static_cast<std::streamsize>(n));
+      position += n;
+    }
+  };
+
+  for (size_t iEntry = 0; iEntry < entries.size(); ++iEntry) {
+    pad(header.dataOffset + entries[iEntry].offset);
+    fs.write(static_cast<const char*>(tensors[iEntry].data_ptr()), static_cast<std::streamsize>(entries[iEntry].nbytes));
+    position += entries[iEntry].nbytes;
+  }
+
+  fs.close();
+
+  LOG_INFO("Exported " + std::to_string(entries.size()) + " tensors (" + std::to_string(dataSize) + " bytes) to " + filePath);
+}
+
+void loadFlatWeights(torch::nn::Module& module, const std::string& filePath) {
+  torch::NoGradGuard no_grad;
+
+  const int fd = open(filePath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG_CRITICAL("Failed to open " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat fileStat;
+
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(FlatWeightsHeader))) {
+    close(fd);
+    LOG_CRITICAL("Not a flat weights file: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  const auto fileSize = static_cast<size_t>(fileStat.st_size);
+
+  void* data = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    LOG_CRITICAL("Failed to mmap " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  const auto mapping = std::make_shared<FileMapping>(data, fileSize);
+
+  // Header
+  const char* ptr = static_cast<const char*>(data);
+  const auto header = readValue<FlatWeightsHeader>(ptr);
+
+  if (std::memcmp(header.magic, FLAT_WEIGHTS_MAGIC, sizeof(header.magic)) != 0 || header.version != FLAT_WEIGHTS_VERSION) {
+    LOG_CRITICAL("Not a flat weights file: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  if (header.dataOffset < sizeof(FlatWeightsHeader) || header.dataOffset > fileSize || header.dataSize > fileSize - header.dataOffset) {
+    LOG_CRITICAL("Truncated flat weights file: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  // Tensor table
+  // NOTE: Every read is bounded by the start of the data, so a corrupt table is rejected instead of read past
+  const char* tableEnd = static_cast<const char*>(data) + header.dataOffset;
+
+  const auto hasBytes = [&](uint64_t nBytes) {
+    return nBytes <= static_cast<uint64_t>(tableEnd - ptr);
+  };
+
+  const auto exitCorrupt = [&]() {
+    LOG_CRITICAL("Corrupt tensor table in flat weights: " + filePath);
+    exit(EXIT_FAILURE);
+  };
+
+  std::unordered_map<std::string, FlatWeightsEntry> entries;
+
+  for (uint32_t iTensor = 0; iTensor < header.nTensors; ++iTensor) {
+    FlatWeightsEntry entry;
+
+    if (!hasBytes(sizeof(uint32_t))) {
+      exitCorrupt();
+    }
+
+    const auto nameLength = readValue<uint32_t>(ptr);
+
+    if (!hasBytes(static_cast<uint64_t>(nameLength) + sizeof(int32_t) + sizeof(uint32_t))) {
+      exitCorrupt();
+    }
+
+    entry.name = std::string(ptr, nameLength);
+    ptr += nameLength;
+
+    entry.dtype = readValue<int32_t>(ptr);
+
+    const auto ndim = readValue<uint32_t>(ptr);
+
+    if (!hasBytes(sizeof(int64_t) * static_cast<uint64_t>(ndim) + 2ULL * sizeof(uint64_t))) {
+      exitCorrupt();
+    }
+
+    for (uint32_t iDim = 0; iDim < ndim; ++iDim) {
+      entry.sizes.push_back(readValue<int64_t>(ptr));
+    }
+
+    entry.offset = readValue<uint64_t>(ptr);
+    entry.nbytes = readValue<uint64_t>(ptr);
+
+    if (entry.offset > header.dataSize || entry.nbytes > header.dataSize - entry.offset) {
+      LOG_CRITICAL("Tensor out of the data section in flat weights: " + entry.name);
+      exit(EXIT_FAILURE);
+    }
+
+    entries[entry.name] = entry;
+  }
+
+  // Bind tensors
+  char* blob = static_cast<char*>(data) + header.dataOffset;
+
+  for (auto& namedTensor : getNamedTensors(module)) {
+    const auto iter = entries.find(namedTensor.first);
+
+    if (iter == entries.end()) {
+      LOG_CRITICAL("Missing tensor in flat weights: " + namedTensor.first);
+      exit(EXIT_FAILURE);
+    }
+
+    const FlatWeightsEntry& entry = iter->second;
+    torch::Tensor& tensor = namedTensor.second;
+
+    if (entry.sizes != tensor.sizes().vec() || entry.dtype != static_cast<int32_t>(tensor.scalar_type()) ||
+        entry.nbytes != static_cast<uint64_t>(tensor.numel()) * tensor.element_size()) {
+      LOG_CRITICAL("Shape or dtype mismatch in flat weights: " + namedTensor.first);
+      exit(EXIT_FAILURE);
+    }
+
+    const torch::Tensor& mapped = torch::from_blob(
+        blob + entry.offset,
+        entry.sizes,
+        [mapping](void*) {},
+        torch::TensorOptions().dtype(tensor.scalar_type()).device(torch::kCPU));
+
+    tensor.set_requires_grad(false);
+    tensor.set_data(mapped);
+  }
+
+  LOG_INFO("Mapped " + std::to_string(entries.size()) + " tensors from " + filePath);
+}
+
+bool isFlatWeightsFile(const std::string& filePath) {
+  std::ifstream fs(filePath, std::ios::binary);
+
+  char magic[sizeof(FLAT_WEIGHTS_MAGIC)] = {};
+  fs.read(magic, sizeof(magic));
+
+  return fs.good() && std::memcmp(magic, FLAT_WEIGHTS_MAGIC, sizeof(magic)) == 0;
+}
+
+}  // namespace dmcpp::model
@@ -1,3 +1,4 @@
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
 #include <DiffusionModelC++/Model/Model.hpp>
 #include <algorithm>
 
@@ -38,15 +39,19 @@ ResConvBlockImpl::ResConvBlockImpl(int64_t inFeatures,
   _conv1 = torch::nn::Conv2d(torch::nn::Conv2dOptions(midChannels, outChannels, 3).padding(1));
   _dropout1 = torch::nn::Dropout2d(torch::nn::Dropout2dOptions(dropoutRate).inplace(true));
 
-  torch::nn::init::zeros_(_conv1->weight);
-  torch::nn::init::zeros_(_conv1->bias);
+  if (!SkipInitGuard::isEnabled()) {
+    torch::nn::init::zeros_(_conv1->weight);
+    torch::nn::init::zeros_(_conv1->bias);
+  }
 
   // Skip module
   if (inChannels == outChannels) {
     _skipModules->push_back(torch::nn::Identity());
   } else {
     auto skipConv = torch::nn::Conv2d(torch::nn::Conv2dOptions(inChannels, outChannels, 1).bias(false));
-    torch::nn::init::orthogonal_(skipConv->weight);
+    if (!SkipInitGuard::isEnabled()) {
+      torch::nn::init::orthogonal_(skipConv->weight);
+    }
     _skipModules->push_back(skipConv);
   }
 
@@ -70,7 +75,7 @@ torch::Tensor ResConvBlockImpl::forward(torch::Tensor& x, ConditionContext& cond
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
   y = _act0->forward(y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
-  y = _conv0->forward(y);
+  y = tunedConv2d(*_conv0, y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
   y = _dropout0->forward(y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
@@ -78,11 +83,16 @@ torch::Tensor ResConvBlockImpl::forward(torch::Tensor& x, ConditionContext& cond
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
   y = _act1->forward(y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
-  y = _conv1->forward(y);
+  y = tunedConv2d(*_conv1, y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
   y = _dropout1->forward(y);
   // std::cout << "    y.size() = " << y.sizes() << std::endl;
 
+  auto* skipConv = _skipModules->ptr(0)->as<torch::nn::Conv2d>();
+  if (skipConv != nullptr) {
+    return y + tunedConv2d(*skipConv, x);
+  }
+
   return y + _skipModules->forward(x);
 }
 
@@ -111,10 +121,11 @@ DownBlockImpl::DownBlockImpl(int64_t nLayers,
                              bool downSample,
                              bool selfAttention,
                              bool crossAttention,
-                             int64_t encChannels)
+                             int64_t encChannels,
+                             config::ResampleType resampleType)
     : ConditionedSequentialImpl() {
   if (downSample) {
-    push_buck("downSample", std::make_shared<Downsample2DImpl>());
+    push_buck("downSample", std::make_shared<Downsample2DImpl>(resampleType));
   }
 
   for (int64_t iLayer = 0; iLayer < nLayers; ++iLayer) {
@@ -169,7 +180,8 @@ UpBlockImpl::UpBlockImpl(int64_t nLayers,
                          bool upSample,
                          bool selfAttention,
                          bool crossAttention,
-                         int64_t encChannels)
+                         int64_t encChannels,
+                         config::ResampleType resampleType)
     : ConditionedSequentialImpl() {
   for (int64_t iLayer = 0; iLayer < nLayers; ++iLayer) {
     const int64_t tmpInChannels = iLayer == 0LL ? inChannels : midChannels;
@@ -209,7 +221,7 @@ UpBlockImpl::UpBlockImpl(int64_t nLayers,
   }
 
   if (upSample) {
-    push_buck("upSample", std::make_shared<Upsample2DImpl>());
+    push_buck("upSample", std::make_shared<Upsample2DImpl>(resampleType));
   }
 }
 
@@ -229,7 +241,9 @@ MappingNetImpl::MappingNetImpl(int64_t inFeatures, int64_t outFeatures, int64_t
     : _modules() {
   for (int64_t iLayer = 0; iLayer < nLayers; ++iLayer) {
     auto linear = torch::nn::Linear(iLayer == 0LL ? inFeatures : outFeatures, outFeatures);
-    torch::nn::init::orthogonal_(linear->weight);
+    if (!SkipInitGuard::isEnabled()) {
+      torch::nn::init::orthogonal_(linear->weight);
+    }
 
     _modules->push_back(linear);
     _modules->push_back(torch::nn::GELU());
@@ -264,9 +278,31 @@ UNetImpl::UNetImpl(const std::vector<DownBlock>& downBlocks, const std::vector<U
   register_module("upBlocks", _upBlocks);
 }
 
-torch::Tensor UNetImpl::forward(torch::Tensor& x, ConditionContext& conditionCtx) {
+torch::Tensor UNetImpl::forward(torch::Tensor& x, ConditionContext& conditionCtx, FeatureCacheMode cacheMode) {
   // std::cout << "UNetImpl::forward" << std::endl;
 
+  const size_t nUpBlocks = _upBlocks->size();
+
+  // NOTE: The deep part of the network can only be skipped when there is a cached feature of the same batch size.
+  // Otherwise, fall back to a full forward pass which refreshes the cache.
+  if (cacheMode == FeatureCacheMode::REUSE) {
+    if (nUpBlocks < 2 || !_cachedFeature.defined() ||
+        _cachedFeature.size(0) != x.size(0) ||
+        _cachedFeature.size(2) != x.size(2) ||
+        _cachedFeature.size(3) != x.size(3)) {
+      cacheMode = FeatureCacheMode::UPDATE;
+    }
+  }
+
+  if (cacheMode == FeatureCacheMode::REUSE) {
+    // Shallowest down block -> shallowest up block
+    x = _downBlocks[0]->as<DownBlock>()->forward(x, conditionCtx);
+
+    torch::Tensor skip = x;
+    x = _cachedFeature;
+    return _upBlocks[nUpBlocks - 1]->as<UpBlock>()->forward(x, conditionCtx, skip);
+  }
+
   std::vector<torch::Tensor> hidden;
 
   for (auto& module : *_downBlocks) {
@@ -278,10 +314,13 @@ torch::Tensor UNetImpl::forward(torch::Tensor& x, ConditionContext& conditionCtx
 
   std::reverse(hidden.begin(), hidden.end());
 
-  const size_t nUpBlocks = _upBlocks->size();
   for (size_t iBlock = 0; iBlock < nUpBlocks; ++iBlock) {
     // std::cout << "[UNetImpl]    iBlock   = " << iBlock << std::endl;
     // std::cout << "[UNetImpl]    x.size() = " << x.sizes() << std::endl;
+    if (cacheMode == FeatureCacheMode::UPDATE && iBlock == nUpBlocks - 1) {
+      _cachedFeature = x;
+    }
+
     if (iBlock == 0) {
       x = _upBlocks[iBlock]->as<UpBlock>()->forward(x, conditionCtx);
     } else {
@@ -298,6 +337,10 @@ void UNetImpl::reset() {
   _upBlocks->reset();
 }
 
+void UNetImpl::clearFeatureCache() {
+  _cachedFeature = torch::Tensor();
+}
+
 // ====================================================================================================
 // ImageUNetModel
 // ====================================================================================================
@@ -311,7 +354,8 @@ ImageUNetModelImpl::ImageUNetModelImpl(int64_t inChannels,
                                        int64_t unetCondDim,
                                        int64_t crossCondDim,
                                        double dropoutRate,
-                                       bool hasVariance)
+                                       bool hasVariance,
+                                       config::ResampleType resampleType)
     : _hasVariance(hasVariance) {
   {
     // Mapping network
@@ -331,8 +375,10 @@ ImageUNetModelImpl::ImageUNetModelImpl(int64_t inChannels,
     _inProj = torch::nn::Conv2d(torch::nn::Conv2dOptions(inChannels + unetCondDim, channels[0], 1));
     _outProj = torch::nn::Conv2d(torch::nn::Conv2dOptions(channels[0], outChannels, 1));
 
-    torch::nn::init::zeros_(_outProj->weight);
-    torch::nn::init::zeros_(_outProj->bias);
+    if (!SkipInitGuard::isEnabled()) {
+      torch::nn::init::zeros_(_outProj->weight);
+      torch::nn::init::zeros_(_outProj->bias);
+    }
   }
 
   {
@@ -362,7 +408,8 @@ ImageUNetModelImpl::ImageUNetModelImpl(int64_t inChannels,
                               iBlock > 0,
                               selfAttenDepth[iBlock],
                               crossAttenDepth[iBlock],
-                              crossCondDim);
+                              crossCondDim,
+                              resampleType);
     }
 
     // Up blocks
@@ -389,7 +436,8 @@ ImageUNetModelImpl::ImageUNetModelImpl(int64_t inChannels,
                             iBlock > 0,
                             selfAttenDepth[iBlock],
                             crossAttenDepth[iBlock],
-                            crossCondDim);
+                            crossCondDim,
+                            resampleType);
     }
 
     // UNet
@@ -421,6 +469,7 @@ ImageUNetModelForwardReturn ImageUNetModelImpl::forward(const torch::Tensor& inp
 
   ConditionContext condCtx;
   condCtx.condition = mappedCond;
+  condCtx.sigma = sigma;
 
   if (args.unetCond.defined()) {
     modelInput = torch::cat({modelInput, args.unetCond}, 1);
@@ -436,17 +485,17 @@ ImageUNetModelForwardReturn ImageUNetModelImpl::forward(const torch::Tensor& inp
   std::cout << modelInput.sizes() << std::endl;
   util::DEBUG_saveImages(modelInput, "/home/araka/Projects/diffusion-model-cpp/debug/model/0");
 #endif
-  modelInput = _inProj->forward(modelInput);
+  modelInput = tunedConv2d(*_inProj, modelInput);
 #ifdef DEBUG_DMCPP_MODEL
   std::cout << modelInput.sizes() << std::endl;
   util::DEBUG_saveImages(modelInput, "/home/araka/Projects/diffusion-model-cpp/debug/model/1");
 #endif
-  modelInput = _uNet->forward(modelInput, condCtx);
+  modelInput = _uNet->forward(modelInput, condCtx, args.featureCacheMode);
 #ifdef DEBUG_DMCPP_MODEL
   std::cout << modelInput.sizes() << std::endl;
   util::DEBUG_saveImages(modelInput, "/home/araka/Projects/diffusion-model-cpp/debug/model/2");
 #endif
-  modelInput = _outProj->forward(modelInput);
+  modelInput = tunedConv2d(*_outProj, modelInput);
 #ifdef DEBUG_DMCPP_MODEL
   std::cout << modelInput.sizes() << std::endl;
   util::DEBUG_saveImages(modelInput, "/home/araka/Projects/diffusion-model-cpp/debug/model/3");
@@ -478,6 +527,29 @@ ImageUNetModelForwardReturn ImageUNetModelImpl::forward(const torch::Tensor& inp
   return returnVars;
 }
 
+void ImageUNetModelImpl::clearFeatureCache() {
+  _uNet->clearFeatureCache();
+}
+
+void ImageUNetModelImpl::setTokenMerging(const std::vector<std::vector<TokenMergeRange>>& rangesPerDepth) {
+  const auto setRanges = [](ConditionedSequentialImpl& block, const std::vector<TokenMergeRange>& ranges) {
+    for (auto& module : block._modules) {
+      auto selfAttention = std::dynamic_pointer_cast<SelfAttention2DImpl>(module);
+      if (selfAttention != nullptr) {
+        selfAttention->setTokenMerging(ranges);
+      }
+    }
+  };
+
+  const size_t nDepth = _uNet->_downBlocks->size();
+
+  for (size_t iDepth = 0; iDepth < nDepth && iDepth < rangesPerDepth.size(); ++iDepth) {
+    // NOTE: Up blocks are stored from the deepest level
+    setRanges(*_uNet->_downBlocks[iDepth]->as<DownBlock>(), rangesPerDepth[iDepth]);
+    setRanges(*_uNet->_upBlocks[nDepth - 1 - iDepth]->as<UpBlock>(), rangesPerDepth[iDepth]);
+  }
+}
+
 void ImageUNetModelImpl::reset() {
   // _timestepEmbed->reset();
   // _mapping->reset();
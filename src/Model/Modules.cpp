@@ -1,4 +1,8 @@
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
 #include <DiffusionModelC++/Model/Modules.hpp>
+#include <DiffusionModelC++/Model/Resample.hpp>
+#include <algorithm>
+#include <cmath>
 #include <utility>
 
 namespace dmcpp::model {
@@ -15,6 +19,76 @@ void ResidualBlockImpl::reset() {
   _mainModule->reset();
 }
 
+// ====================================================================================================
+// TokenMerge
+// ====================================================================================================
+TokenMerge TokenMerge::compute(const torch::Tensor& metric, int64_t nMerged) {
+  using torch::indexing::None;
+  using torch::indexing::Slice;
+
+  torch::NoGradGuard no_grad;
+
+  TokenMerge tokenMerge;
+  tokenMerge._nTokens = metric.size(1);
+  tokenMerge._nSrc = (tokenMerge._nTokens + 1LL) / 2LL;
+  tokenMerge._nDst = tokenMerge._nTokens / 2LL;
+  tokenMerge._nMerged = std::max<int64_t>(0, std::min<int64_t>(nMerged, tokenMerge._nDst));
+
+  // Cosine similarity between the two token sets
+  const torch::Tensor& normalized = metric / metric.norm(2, -1, true).clamp_min(1e-6);
+  const torch::Tensor& src = normalized.index({Slice(), Slice(0, None, 2), Slice()});
+  const torch::Tensor& dst = normalized.index({Slice(), Slice(1, None, 2), Slice()});
+  const torch::Tensor& scores = src.matmul(dst.transpose(-1, -2));
+
+  // Merge the most similar edges first
+  const auto nodeMax = scores.max(-1);
+  const torch::Tensor& nodeIdx = std::get<1>(nodeMax);
+  const torch::Tensor& edgeIdx = std::get<0>(nodeMax).argsort(-1, true).unsqueeze(-1);
+
+  tokenMerge._unmergedIdx = edgeIdx.narrow(1, tokenMerge._nMerged, tokenMerge._nSrc - tokenMerge._nMerged);
+  tokenMerge._srcIdx = edgeIdx.narrow(1, 0, tokenMerge._nMerged);
+  tokenMerge._dstIdx = nodeIdx.unsqueeze(-1).gather(1, tokenMerge._srcIdx);
+
+  return tokenMerge;
+}
+
+torch::Tensor TokenMerge::merge(const torch::Tensor& x) const {
+  using torch::indexing::None;
+  using torch::indexing::Slice;
+
+  const int64_t b = x.size(0);
+  const int64_t c = x.size(2);
+
+  const torch::Tensor& src = x.index({Slice(), Slice(0, None, 2), Slice()});
+  torch::Tensor dst = x.index({Slice(), Slice(1, None, 2), Slice()});
+
+  const torch::Tensor& unmerged = src.gather(1, _unmergedIdx.expand({b, _nSrc - _nMerged, c}));
+  const torch::Tensor& merged = src.gather(1, _srcIdx.expand({b, _nMerged, c}));
+  dst = dst.scatter_reduce(1, _dstIdx.expand({b, _nMerged, c}), merged, "mean", true);
+
+  return torch::cat({unmerged, dst}, 1);
+}
+
+torch::Tensor TokenMerge::unmerge(const torch::Tensor& x) const {
+  using torch::indexing::None;
+  using torch::indexing::Slice;
+
+  const int64_t b = x.size(0);
+  const int64_t c = x.size(2);
+  const int64_t nUnmerged = _nSrc - _nMerged;
+
+  const torch::Tensor& unmerged = x.narrow(1, 0, nUnmerged);
+  const torch::Tensor& dst = x.narrow(1, nUnmerged, _nDst);
+  const torch::Tensor& src = dst.gather(1, _dstIdx.expand({b, _nMerged, c}));
+
+  torch::Tensor out = torch::empty({b, _nTokens, c}, x.options());
+  out.index_put_({Slice(), Slice(1, None, 2), Slice()}, dst);
+  out.scatter_(1, (2LL * _unmergedIdx).expand({b, nUnmerged, c}), unmerged);
+  out.scatter_(1, (2LL * _srcIdx).expand({b, _nMerged, c}), src);
+
+  return out;
+}
+
 // ====================================================================================================
 // ConditionedSequential
 // ====================================================================================================
@@ -60,8 +134,10 @@ AdaGNImpl::AdaGNImpl(int64_t inFeatures,
     : _nGroups(nGroups),
       _epsilon(epsilon),
       _mapper(torch::nn::Linear(inFeatures, 2 * outFeatures)) {
-  torch::nn::init::zeros_(_mapper->weight);
-  torch::nn::init::zeros_(_mapper->bias);
+  if (!SkipInitGuard::isEnabled()) {
+    torch::nn::init::zeros_(_mapper->weight);
+    torch::nn::init::zeros_(_mapper->bias);
+  }
 
   register_module("mapper", _mapper);
 }
@@ -100,8 +176,10 @@ SelfAttention2DImpl::SelfAttention2DImpl(int64_t inChannels,
   _qkvProj = torch::nn::Conv2d(inChannels, inChannels * 3LL, 1);
   _outProj = torch::nn::Conv2d(inChannels, inChannels, 1);
 
-  torch::nn::init::zeros_(_outProj->weight);
-  torch::nn::init::zeros_(_outProj->bias);
+  if (!SkipInitGuard::isEnabled()) {
+    torch::nn::init::zeros_(_outProj->weight);
+    torch::nn::init::zeros_(_outProj->bias);
+  }
 
   register_module("qkvProj", _qkvProj);
   register_module("outProj", _outProj);
@@ -118,7 +196,33 @@ torch::Tensor SelfAttention2DImpl::forward(torch::Tensor& x, dmcpp::model::Condi
 
   // std::cout << "    x.size()     = " << x.sizes() << std::endl;
 
-  torch::Tensor qkv = _qkvProj->forward(_norm->forward(x, conditionCtx.condition));
+  const int64_t nMerged = getNumMergedTokens(h * w, conditionCtx);
+
+  if (nMerged > 0) {
+    // NOTE: The projections are 1x1 convolutions, so they are applied as linear layers on the merged tokens.
+    torch::Tensor tokens = _norm->forward(x, conditionCtx.condition).flatten(2).transpose(1, 2);
+
+    const TokenMerge tokenMerge = TokenMerge::compute(tokens, nMerged);
+    tokens = tokenMerge.merge(tokens);
+
+    const int64_t n = tokens.size(1);
+
+    torch::Tensor qkv = torch::nn::functional::linear(tokens, _qkvProj->weight.flatten(1), _qkvProj->bias);
+    qkv = qkv.view({b, n, _nHeads * 3LL, c / _nHeads}).transpose(1, 2);
+
+    const torch::Tensor& query = qkv.narrow(1, 0, _nHeads);
+    const torch::Tensor& key = qkv.narrow(1, _nHeads, _nHeads);
+    const torch::Tensor& value = qkv.narrow(1, 2LL * _nHeads, _nHeads);
+
+    torch::Tensor y = torch::scaled_dot_product_attention(query, key, value, {}, _dropoutRate);
+    y = y.transpose(1, 2).reshape({b, n, c});
+    y = torch::nn::functional::linear(y, _outProj->weight.flatten(1), _outProj->bias);
+    y = tokenMerge.unmerge(y);
+
+    return x + y.transpose(1, 2).reshape({b, c, h, w});
+  }
+
+  torch::Tensor qkv = tunedConv2d(*_qkvProj, _norm->forward(x, conditionCtx.condition));
   qkv = qkv.view({b, _nHeads * 3LL, c / _nHeads, h * w}).transpose(2, 3);
   // std::cout << "    qkv.size()   = " << qkv.sizes() << std::endl;
 
@@ -144,7 +248,7 @@ torch::Tensor SelfAttention2DImpl::forward(torch::Tensor& x, dmcpp::model::Condi
   y = y.transpose(2, 3).contiguous().view({b, c, h, w});
   // std::cout << "    y.size()     = " << y.sizes() << std::endl;
 
-  return x + _outProj(y);
+  return x + tunedConv2d(*_outProj, y);
 }
 
 void SelfAttention2DImpl::reset() {
@@ -153,6 +257,27 @@ void SelfAttention2DImpl::reset() {
   _outProj->reset();
 }
 
+void SelfAttention2DImpl::setTokenMerging(const std::vector<TokenMergeRange>& ranges) {
+  _tokenMergeRanges = ranges;
+}
+
+int64_t SelfAttention2DImpl::getNumMergedTokens(int64_t nTokens, const ConditionContext& conditionCtx) const {
+  // NOTE: Token merging is an inference-time approximation only
+  if (is_training() || _tokenMergeRanges.empty() || !conditionCtx.sigma.defined()) {
+    return 0;
+  }
+
+  const double sigma = conditionCtx.sigma.max().item<double>();
+
+  for (const auto& range : _tokenMergeRanges) {
+    if (range.sigmaMin <= sigma && sigma <= range.sigmaMax) {
+      return static_cast<int64_t>(std::floor(range.ratio * static_cast<double>(nTokens)));
+    }
+  }
+
+  return 0;
+}
+
 // ====================================================================================================
 // CrossAttention2D
 // ====================================================================================================
@@ -169,8 +294,10 @@ CrossAttention2DImpl::CrossAttention2DImpl(int64_t c_dec,
   _kvProj = torch::nn::Linear(c_enc, c_dec * 2LL);
   _outProj = torch::nn::Conv2d(c_dec, c_dec, 1);
 
-  torch::nn::init::zeros_(_outProj->weight);
-  torch::nn::init::zeros_(_outProj->bias);
+  if (!SkipInitGuard::isEnabled()) {
+    torch::nn::init::zeros_(_outProj->weight);
+    torch::nn::init::zeros_(_outProj->bias);
+  }
 
   register_module("qProj", _qProj);
   register_module("kvProj", _kvProj);
@@ -185,7 +312,7 @@ torch::Tensor CrossAttention2DImpl::forward(torch::Tensor& x, ConditionContext&
   const int64_t h = x.size(2);
   const int64_t w = x.size(3);
 
-  torch::Tensor query = _qProj->forward(_normDec->forward(x, conditionCtx.condition));
+  torch::Tensor query = tunedConv2d(*_qProj, _normDec->forward(x, conditionCtx.condition));
   query = query.view({b, _nHeads, c / _nHeads, h * w}).transpose(2, 3);
 
   torch::Tensor kv = _kvProj->forward(_normEnc->forward(conditionCtx.cross));
@@ -205,7 +332,7 @@ torch::Tensor CrossAttention2DImpl::forward(torch::Tensor& x, ConditionContext&
   torch::Tensor y = torch::scaled_dot_product_attention(query, key, value, attentionMask, _dropoutRate);
   y = y.transpose(2, 3).contiguous().view({b, c, h, w});
 
-  return x + _outProj(y);
+  return x + tunedConv2d(*_outProj, y);
 }
 
 void CrossAttention2DImpl::reset() {
@@ -219,15 +346,34 @@ void CrossAttention2DImpl::reset() {
 // ====================================================================================================
 // Downsample2D
 // ====================================================================================================
-Downsample2DImpl::Downsample2DImpl(torch::nn::functional::InterpolateFuncOptions::mode_t interp)
-    : _interp(interp) {}
+Downsample2DImpl::Downsample2DImpl(config::ResampleType resampleType,
+                                   torch::nn::functional::InterpolateFuncOptions::mode_t interp)
+    : _resampleType(resampleType),
+      _interp(interp) {
+  if (_resampleType == config::ResampleType::INVALID) {
+    LOG_CRITICAL("Invalid ResampleType");
+    exit(EXIT_FAILURE);
+  }
+}
 
 torch::Tensor Downsample2DImpl::forward(torch::Tensor& x, ConditionContext& conditionCtx) {
-  return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
-                                                   .mode(_interp)
-                                                   .scale_factor(SCALE_FACTOR)
-                                                   .align_corners(true)
-                                                   .recompute_scale_factor(false));
+  switch (_resampleType) {
+    case config::ResampleType::AVG_POOL:
+      return avgPoolDownsample2x(x);
+    case config::ResampleType::NEAREST:
+      return nearestDownsample2x(x);
+    case config::ResampleType::BILINEAR:
+      if (_interp == torch::kBilinear) {
+        return bilinearDownsample2x(x);
+      }
+      [[fallthrough]];
+    default:
+      return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
+                                                       .mode(_interp)
+                                                       .scale_factor(SCALE_FACTOR)
+                                                       .align_corners(true)
+                                                       .recompute_scale_factor(false));
+  }
 }
 
 void Downsample2DImpl::reset() {
@@ -237,15 +383,33 @@ void Downsample2DImpl::reset() {
 // ====================================================================================================
 // Upsample2D
 // ====================================================================================================
-Upsample2DImpl::Upsample2DImpl(torch::nn::functional::InterpolateFuncOptions::mode_t interp)
-    : _interp(interp) {}
+Upsample2DImpl::Upsample2DImpl(config::ResampleType resampleType,
+                               torch::nn::functional::InterpolateFuncOptions::mode_t interp)
+    : _resampleType(resampleType),
+      _interp(interp) {
+  if (_resampleType == config::ResampleType::INVALID) {
+    LOG_CRITICAL("Invalid ResampleType");
+    exit(EXIT_FAILURE);
+  }
+}
 
 torch::Tensor Upsample2DImpl::forward(torch::Tensor& x, ConditionContext& conditionCtx) {
-  return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
-                                                   .mode(_interp)
-                                                   .scale_factor(SCALE_FACTOR)
-                                                   .align_corners(true)
-                                                   .recompute_scale_factor(false));
+  switch (_resampleType) {
+    case config::ResampleType::AVG_POOL:
+    case config::ResampleType::NEAREST:
+      return nearestUpsample2x(x);
+    case config::ResampleType::BILINEAR:
+      if (_interp == torch::kBilinear) {
+        return bilinearUpsample2x(x);
+      }
+      [[fallthrough]];
+    default:
+      return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
+                                                       .mode(_interp)
+                                                       .scale_factor(SCALE_FACTOR)
+                                                       .align_corners(true)
+                                                       .recompute_scale_factor(false));
+  }
 }
 
 void Upsample2DImpl::reset() {
@@ -260,7 +424,11 @@ FourierFeaturesImpl::FourierFeaturesImpl(int64_t inFeatures,
                                          float std) {
   TORCH_CHECK(outFeatures % 2 == 0, "outFeatures must be even");
 
-  _weights = torch::randn({outFeatures / 2LL, inFeatures}) * std;
+  if (SkipInitGuard::isEnabled()) {
+    _weights = torch::empty({outFeatures / 2LL, inFeatures});
+  } else {
+    _weights = torch::randn({outFeatures / 2LL, inFeatures}) * std;
+  }
 
   register_parameter("weight", _weights);
 }
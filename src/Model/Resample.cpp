@@ -0,0 +1,394 @@
+#include <DiffusionModelC++/Model/Resample.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace dmcpp::model {
+
+namespace {
+
+inline bool isChannelsLast(const torch::Tensor& x) {
+  return !x.is_contiguous() && x.is_contiguous(torch::MemoryFormat::ChannelsLast);
+}
+
+inline bool hasFastPath(const torch::Tensor& x) {
+  return x.dim() == 4 &&
+         x.device().is_cpu() &&
+         x.scalar_type() == torch::kFloat32 &&
+         (x.is_contiguous() || x.is_contiguous(torch::MemoryFormat::ChannelsLast));
+}
+
+// out[y][x] = (in[2y][2x] + in[2y][2x + 1] + in[2y + 1][2x] + in[2y + 1][2x + 1]) * scale
+torch::Tensor boxDownsample2xKernel(const torch::Tensor& x, const float scale) {
+  const int64_t n = x.size(0);
+  const int64_t c = x.size(1);
+  const int64_t h = x.size(2);
+  const int64_t w = x.size(3);
+  const int64_t ho = h / 2LL;
+  const int64_t wo = w / 2LL;
+
+  const float* in = x.data_ptr<float>();
+
+  if (isChannelsLast(x)) {
+    torch::Tensor y = torch::empty({n, c, ho, wo}, x.options().memory_format(torch::MemoryFormat::ChannelsLast));
+    float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+    for (int64_t iN = 0; iN < n; ++iN) {
+      for (int64_t oy = 0; oy < ho; ++oy) {
+        for (int64_t ox = 0; ox < wo; ++ox) {
+          const float* p00 = in + ((iN * h + 2LL * oy) * w + 2LL * ox) * c;
+          const float* p01 = p00 + c;
+          const float* p10 = p00 + w * c;
+          const float* p11 = p10 + c;
+          float* o = out + ((iN * ho + oy) * wo + ox) * c;
+
+#pragma omp simd
+          for (int64_t iC = 0; iC < c; ++iC) {
+            o[iC] = (p00[iC] + p01[iC] + p10[iC] + p11[iC]) * scale;
+          }
+        }
+      }
+    }
+
+    return y;
+  }
+
+  torch::Tensor y = torch::empty({n, c, ho, wo}, x.options());
+  float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+  for (int64_t iNC = 0; iNC < n * c; ++iNC) {
+    for (int64_t oy = 0; oy < ho; ++oy) {
+      const float* r0 = in + (iNC * h + 2LL * oy) * w;
+      const float* r1 = r0 + w;
+      float* o = out + (iNC * ho + oy) * wo;
+
+#pragma omp simd
+      for (int64_t ox = 0; ox < wo; ++ox) {
+        o[ox] = (r0[2LL * ox] + r0[2LL * ox + 1LL] + r1[2LL * ox] + r1[2LL * ox + 1LL]) * scale;
+      }
+    }
+  }
+
+  return y;
+}
+
+// out[2y + i][2x + j] = in[y][x] * scale
+torch::Tensor nearestUpsample2xKernel(const torch::Tensor& x, const float scale) {
+  const int64_t n = x.size(0);
+  const int64_t c = x.size(1);
+  const int64_t h = x.size(2);
+  const int64_t w = x.size(3);
+  const int64_t ho = 2LL * h;
+  const int64_t wo = 2LL * w;
+
+  const float* in = x.data_ptr<float>();
+
+  if (isChannelsLast(x)) {
+    torch::Tensor y = torch::empty({n, c, ho, wo}, x.options().memory_format(torch::MemoryFormat::ChannelsLast));
+    float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+    for (int64_t iN = 0; iN < n; ++iN) {
+      for (int64_t iy = 0; iy < h; ++iy) {
+        for (int64_t ix = 0; ix < w; ++ix) {
+          const float* p = in + ((iN * h + iy) * w + ix) * c;
+          float* o00 = out + ((iN * ho + 2LL * iy) * wo + 2LL * ix) * c;
+          float* o01 = o00 + c;
+          float* o10 = o00 + wo * c;
+          float* o11 = o10 + c;
+
+#pragma omp simd
+          for (int64_t iC = 0; iC < c; ++iC) {
+            const float value = p[iC] * scale;
+            o00[iC] = value;
+            o01[iC] = value;
+            o10[iC] = value;
+            o11[iC] = value;
+          }
+        }
+      }
+    }
+
+    return y;
+  }
+
+  torch::Tensor y = torch::empty({n, c, ho, wo}, x.options());
+  float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+  for (int64_t iNC = 0; iNC < n * c; ++iNC) {
+    for (int64_t iy = 0; iy < h; ++iy) {
+      const float* r = in + (iNC * h + iy) * w;
+      float* o0 = out + (iNC * ho + 2LL * iy) * wo;
+      float* o1 = o0 + wo;
+
+#pragma omp simd
+      for (int64_t ix = 0; ix < w; ++ix) {
+        const float value = r[ix] * scale;
+        o0[2LL * ix] = value;
+        o0[2LL * ix + 1LL] = value;
+        o1[2LL * ix] = value;
+        o1[2LL * ix + 1LL] = value;
+      }
+    }
+  }
+
+  return y;
+}
+
+// Source taps of 1D linear interpolation with align_corners=true: out[o] = in[i0[o]] * (1 - w1[o]) + in[i1[o]] * w1[o]
+// NOTE: Computed in float as ATen does for float inputs, so the fast path matches the reference closely
+struct LinearTaps {
+  std::vector<int64_t> i0;
+  std::vector<int64_t> i1;
+  std::vector<float> w1;
+};
+
+LinearTaps getAlignCornersTaps(const int64_t inSize, const int64_t outSize) {
+  const float scale = outSize > 1 ? static_cast<float>(inSize - 1) / static_cast<float>(outSize - 1) : 0.0f;
+
+  LinearTaps taps;
+  taps.i0.resize(outSize);
+  taps.i1.resize(outSize);
+  taps.w1.resize(outSize);
+
+  for (int64_t o = 0; o < outSize; ++o) {
+    const float src = scale * static_cast<float>(o);
+    const int64_t i0 = std::min(static_cast<int64_t>(src), inSize - 1LL);
+
+    taps.i0[o] = i0;
+    taps.i1[o] = i0 + (i0 < inSize - 1LL ? 1LL : 0LL);
+    taps.w1[o] = std::min(std::max(src - static_cast<float>(i0), 0.0f), 1.0f);
+  }
+
+  return taps;
+}
+
+// Separable bilinear resampling with align_corners=true to (ho, wo)
+torch::Tensor bilinearKernel(const torch::Tensor& x, const int64_t ho, const int64_t wo) {
+  const int64_t n = x.size(0);
+  const int64_t c = x.size(1);
+  const int64_t h = x.size(2);
+  const int64_t w = x.size(3);
+
+  const LinearTaps ty = getAlignCornersTaps(h, ho);
+  const LinearTaps tx = getAlignCornersTaps(w, wo);
+
+  const float* in = x.data_ptr<float>();
+
+  if (isChannelsLast(x)) {
+    torch::Tensor y = torch::empty({n, c, ho, wo}, x.options().memory_format(torch::MemoryFormat::ChannelsLast));
+    float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+    for (int64_t iN = 0; iN < n; ++iN) {
+      for (int64_t oy = 0; oy < ho; ++oy) {
+        const float wy1 = ty.w1[oy];
+        const float wy0 = 1.0f - wy1;
+        const float* r0 = in + (iN * h + ty.i0[oy]) * w * c;
+        const float* r1 = in + (iN * h + ty.i1[oy]) * w * c;
+
+        for (int64_t ox = 0; ox < wo; ++ox) {
+          const float wx1 = tx.w1[ox];
+          const float wx0 = 1.0f - wx1;
+          const float* p00 = r0 + tx.i0[ox] * c;
+          const float* p01 = r0 + tx.i1[ox] * c;
+          const float* p10 = r1 + tx.i0[ox] * c;
+          const float* p11 = r1 + tx.i1[ox] * c;
+          float* o = out + ((iN * ho + oy) * wo + ox) * c;
+
+#pragma omp simd
+          for (int64_t iC = 0; iC < c; ++iC) {
+            o[iC] = (p00[iC] * wx0 + p01[iC] * wx1) * wy0 + (p10[iC] * wx0 + p11[iC] * wx1) * wy1;
+          }
+        }
+      }
+    }
+
+    return y;
+  }
+
+  torch::Tensor y = torch::empty({n, c, ho, wo}, x.options());
+  float* out = y.data_ptr<float>();
+
+#pragma omp parallel for collapse(2)
+  for (int64_t iNC = 0; iNC < n * c; ++iNC) {
+    for (int64_t oy = 0; oy < ho; ++oy) {
+      const float wy1 = ty.w1[oy];
+      const float wy0 = 1.0f - wy1;
+      const float* r0 = in + (iNC * h + ty.i0[oy]) * w;
+      const float* r1 = in + (iNC * h + ty.i1[oy]) * w;
+      float* o = out + (iNC * ho + oy) * wo;
+
+      for (int64_t ox = 0; ox < wo; ++ox) {
+        const float wx1 = tx.w1[ox];
+        const float wx0 = 1.0f - wx1;
+        o[ox] = (r0[tx.i0[ox]] * wx0 + r0[tx.i1[ox]] * wx1) * wy0 + (r1[tx.i0[ox]] * wx0 + r1[tx.i1[ox]] * wx1) * wy1;
+      }
+    }
+  }
+
+  return y;
+}
+
+// Adjoint of bilinearKernel: scatters the output gradient back to the (h, w) input taps
+torch::Tensor bilinearBackwardKernel(const torch::Tensor& gradOutput, const int64_t h, const int64_t w) {
+  const int64_t n = gradOutput.size(0);
+  const int64_t c = gradOutput.size(1);
+  const int64_t ho = gradOutput.size(2);
+  const int64_t wo = gradOutput.size(3);
+
+  const LinearTaps ty = getAlignCornersTaps(h, ho);
+  const LinearTaps tx = getAlignCornersTaps(w, wo);
+
+  const float* gOut = gradOutput.data_ptr<float>();
+
+  if (isChannelsLast(gradOutput)) {
+    torch::Tensor gradInput = torch::zeros({n, c, h, w}, gradOutput.options().memory_format(torch::MemoryFormat::ChannelsLast));
+    float* gIn = gradInput.data_ptr<float>();
+
+    // NOTE: Output rows scatter into shared input rows, so only the batch is split over threads
+#pragma omp parallel for
+    for (int64_t iN = 0; iN < n; ++iN) {
+      for (int64_t oy = 0; oy < ho; ++oy) {
+        const float wy1 = ty.w1[oy];
+        const float wy0 = 1.0f - wy1;
+        float* r0 = gIn + (iN * h + ty.i0[oy]) * w * c;
+        float* r1 = gIn + (iN * h + ty.i1[oy]) * w * c;
+
+        for (int64_t ox = 0; ox < wo; ++ox) {
+          const float wx1 = tx.w1[ox];
+          const float wx0 = 1.0f - wx1;
+          float* p00 = r0 + tx.i0[ox] * c;
+          float* p01 = r0 + tx.i1[ox] * c;
+          float* p10 = r1 + tx.i0[ox] * c;
+          float* p11 = r1 + tx.i1[ox] * c;
+          const float* g = gOut + ((iN * ho + oy) * wo + ox) * c;
+
+          for (int64_t iC = 0; iC < c; ++iC) {
+            p00[iC] += g[iC] * wy0 * wx0;
+            p01[iC] += g[iC] * wy0 * wx1;
+            p10[iC] += g[iC] * wy1 * wx0;
+            p11[iC] += g[iC] * wy1 * wx1;
+          }
+        }
+      }
+    }
+
+    return gradInput;
+  }
+
+  torch::Tensor gradInput = torch::zeros({n, c, h, w}, gradOutput.options());
+  float* gIn = gradInput.data_ptr<float>();
+
+#pragma omp parallel for
+  for (int64_t iNC = 0; iNC < n * c; ++iNC) {
+    for (int64_t oy = 0; oy < ho; ++oy) {
+      const float wy1 = ty.w1[oy];
+      const float wy0 = 1.0f - wy1;
+      float* r0 = gIn + (iNC * h + ty.i0[oy]) * w;
+      float* r1 = gIn + (iNC * h + ty.i1[oy]) * w;
+      const float* g = gOut + (iNC * ho + oy) * wo;
+
+      for (int64_t ox = 0; ox < wo; ++ox) {
+        const float wx1 = tx.w1[ox];
+        const float wx0 = 1.0f - wx1;
+        r0[tx.i0[ox]] += g[ox] * wy0 * wx0;
+        r0[tx.i1[ox]] += g[ox] * wy0 * wx1;
+        r1[tx.i0[ox]] += g[ox] * wy1 * wx0;
+        r1[tx.i1[ox]] += g[ox] * wy1 * wx1;
+      }
+    }
+  }
+
+  return gradInput;
+}
+
+torch::Tensor toKernelLayout(const torch::Tensor& x) {
+  if (x.is_contiguous() || x.is_contiguous(torch::MemoryFormat::ChannelsLast)) {
+    return x;
+  }
+  return x.contiguous();
+}
+
+struct AvgPoolDownsample2xFunction : public torch::autograd::Function<AvgPoolDownsample2xFunction> {
+  static torch::Tensor forward(torch::autograd::AutogradContext* ctx, const torch::Tensor& x) {
+    return boxDownsample2xKernel(x, 0.25f);
+  }
+
+  static torch::autograd::variable_list backward(torch::autograd::AutogradContext* ctx, torch::autograd::variable_list gradOutputs) {
+    return {nearestUpsample2xKernel(toKernelLayout(gradOutputs[0]), 0.25f)};
+  }
+};
+
+struct NearestUpsample2xFunction : public torch::autograd::Function<NearestUpsample2xFunction> {
+  static torch::Tensor forward(torch::autograd::AutogradContext* ctx, const torch::Tensor& x) {
+    return nearestUpsample2xKernel(x, 1.0f);
+  }
+
+  static torch::autograd::variable_list backward(torch::autograd::AutogradContext* ctx, torch::autograd::variable_list gradOutputs) {
+    return {boxDownsample2xKernel(toKernelLayout(gradOutputs[0]), 1.0f)};
+  }
+};
+
+struct BilinearResampleFunction : public torch::autograd::Function<BilinearResampleFunction> {
+  static torch::Tensor forward(torch::autograd::AutogradContext* ctx, const torch::Tensor& x, int64_t ho, int64_t wo) {
+    ctx->saved_data["h"] = x.size(2);
+    ctx->saved_data["w"] = x.size(3);
+    return bilinearKernel(x, ho, wo);
+  }
+
+  static torch::autograd::variable_list backward(torch::autograd::AutogradContext* ctx, torch::autograd::variable_list gradOutputs) {
+    const int64_t h = ctx->saved_data["h"].toInt();
+    const int64_t w = ctx->saved_data["w"].toInt();
+    return {bilinearBackwardKernel(toKernelLayout(gradOutputs[0]), h, w), torch::Tensor(), torch::Tensor()};
+  }
+};
+
+torch::Tensor bilinearResample(const torch::Tensor& x, const std::vector<double>& scaleFactor, const int64_t ho, const int64_t wo) {
+  if (!hasFastPath(x)) {
+    return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
+                                                     .mode(torch::kBilinear)
+                                                     .scale_factor(scaleFactor)
+                                                     .align_corners(true)
+                                                     .recompute_scale_factor(false));
+  }
+
+  return BilinearResampleFunction::apply(x, ho, wo);
+}
+
+}  // namespace
+
+torch::Tensor avgPoolDownsample2x(const torch::Tensor& x) {
+  if (!hasFastPath(x) || x.size(2) % 2 != 0 || x.size(3) % 2 != 0) {
+    return torch::nn::functional::avg_pool2d(x, torch::nn::functional::AvgPool2dFuncOptions(2));
+  }
+
+  return AvgPoolDownsample2xFunction::apply(x);
+}
+
+torch::Tensor nearestUpsample2x(const torch::Tensor& x) {
+  if (!hasFastPath(x)) {
+    return torch::nn::functional::interpolate(x, torch::nn::functional::InterpolateFuncOptions()
+                                                     .mode(torch::kNearest)
+                                                     .scale_factor(std::vector<double>({2.0, 2.0})));
+  }
+
+  return NearestUpsample2xFunction::apply(x);
+}
+
+torch::Tensor nearestDownsample2x(const torch::Tensor& x) {
+  // NOTE: A strided view, the following convolution reads it directly
+  return x.slice(2, 0, c10::nullopt, 2).slice(3, 0, c10::nullopt, 2);
+}
+
+torch::Tensor bilinearDownsample2x(const torch::Tensor& x) {
+  return bilinearResample(x, {0.5, 0.5}, x.size(2) / 2LL, x.size(3) / 2LL);
+}
+
+torch::Tensor bilinearUpsample2x(const torch::Tensor& x) {
+  return bilinearResample(x, {2.0, 2.0}, 2LL * x.size(2), 2LL * x.size(3));
+}
+
+}  // namespace dmcpp::model
@@ -0,0 +1,169 @@
+#include <ATen/CPUGeneratorImpl.h>
+
+#include <DiffusionModelC++/Trainer/BatchPrefetcher.hpp>
+
+namespace dmcpp::trainer {
+
+namespace {
+
+// splitmix64, to derive well-spread seeds from consecutive indices
+uint64_t mixSeed(uint64_t value) {
+  value += 0x9E3779B97F4A7C15ULL;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+}  // namespace
+
+BatchPrefetcher::BatchPrefetcher(ImageBatchLoader& loader,
+                                 std::shared_ptr<diffusion::DiffusionSampler> sampler,
+                                 const torch::Device& device,
+                                 size_t depth,
+                                 uint64_t seed)
+    : _loader(loader),
+      _sampler(std::move(sampler)),
+      _device(device),
+      _depth(depth),
+      _seed(seed),
+      _epoch(0),
+      _batchIndex(0),
+      _batches(),
+      _mutex(),
+      _notEmpty(),
+      _notFull(),
+      _toStop(false),
+      _error(),
+      _thread() {
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+  stop();
+}
+
+void BatchPrefetcher::start(int64_t epoch, int64_t batchInEpoch) {
+  stop();
+
+  _epoch = epoch;
+  _batchIndex = batchInEpoch;
+  _batches.clear();
+  _error = nullptr;
+  _toStop = false;
+
+  _loader.reset();
+
+  if (_depth > 0) {
+    _thread = std::thread(&BatchPrefetcher::run, this);
+  }
+}
+
+torch::optional<TrainingBatch> BatchPrefetcher::next() {
+  if (_depth == 0) {
+    const auto image = _loader.next();
+
+    if (!image.has_value()) {
+      return torch::nullopt;
+    }
+
+    return prepare(*image, _batchIndex++);
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _notEmpty.wait(lock, [this]() { return !_batches.empty() || _error != nullptr; });
+
+  // The batches finished before the failure are still handed out
+  if (_batches.empty()) {
+    std::rethrow_exception(_error);
+  }
+
+  torch::optional<TrainingBatch> batch = std::move(_batches.front());
+
+  // Keep the end marker for further calls
+  if (batch.has_value()) {
+    _batches.pop_front();
+  }
+
+  lock.unlock();
+  _notFull.notify_one();
+
+  return batch;
+}
+
+void BatchPrefetcher::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _toStop = true;
+  }
+
+  _notFull.notify_all();
+
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+TrainingBatch BatchPrefetcher::prepare(const torch::Tensor& image, int64_t batchIndex) {
+  auto generator = at::detail::createCPUGenerator(mixSeed(_seed ^ mixSeed((static_cast<uint64_t>(_epoch) << 32) ^ static_cast<uint64_t>(batchIndex))));
+
+  const int64_t batchSize = image.size(0);
+
+  TrainingBatch batch;
+
+  // Random horizontal flip
+  const torch::Tensor& toFlip = (torch::rand({batchSize}, generator) < 0.5).view({-1, 1, 1, 1});
+  batch.image = torch::where(toFlip, image.flip({3}), image);
+
+  batch.noise = torch::randn(batch.image.sizes(), generator, batch.image.options());
+  batch.sigma = _sampler->sample({batchSize}, torch::kCPU, torch::kFloat32, generator);
+
+  if (!_device.is_cpu()) {
+    // NOTE: Copies from pinned memory do not block the prefetch thread on the device
+    batch.image = batch.image.pin_memory().to(_device, true);
+    batch.noise = batch.noise.pin_memory().to(_device, true);
+    batch.sigma = batch.sigma.to(_device);
+  }
+
+  return batch;
+}
+
+void BatchPrefetcher::run() {
+  while (!_toStop) {
+    torch::optional<torch::Tensor> image;
+    torch::optional<TrainingBatch> batch;
+
+    // NOTE: An exception must not escape the thread, it is handed to the training thread, which rethrows it
+    try {
+      image = _loader.next();
+
+      if (image.has_value()) {
+        batch = prepare(*image, _batchIndex++);
+      }
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _error = std::current_exception();
+      }
+
+      _notEmpty.notify_one();
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _notFull.wait(lock, [this]() { return _toStop || _batches.size() < _depth; });
+
+    if (_toStop) {
+      return;
+    }
+
+    _batches.push_back(std::move(batch));
+
+    lock.unlock();
+    _notEmpty.notify_one();
+
+    if (!image.has_value()) {
+      return;
+    }
+  }
+}
+
+}  // namespace dmcpp::trainer
@@ -0,0 +1,105 @@
+#include <DiffusionModelC++/Trainer/CheckpointWriter.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <chrono>
+#include <utility>
+
+namespace dmcpp::trainer {
+
+CheckpointWriter::CheckpointWriter()
+    : _thread(),
+      _lastWriteTime(0.0) {
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  wait();
+}
+
+void CheckpointWriter::submit(const std::string& dirPath, std::vector<CheckpointShard> shards) {
+  wait();
+
+  _thread = std::thread([this, dirPath, shards = std::move(shards)]() {
+    write(dirPath, shards);
+  });
+}
+
+void CheckpointWriter::wait() {
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+double CheckpointWriter::getLastWriteTime() const {
+  return _lastWriteTime.load();
+}
+
+void CheckpointWriter::write(const std::string& dirPath, const std::vector<CheckpointShard>& shards) {
+  const auto startTime = std::chrono::high_resolution_clock::now();
+
+  const std::string absDirPath = util::FileUtil::absPath(dirPath);
+  const std::string tmpDirPath = absDirPath + ".tmp";
+  const std::string oldDirPath = absDirPath + ".old";
+
+  try {
+    util::generic_fs::remove_all(tmpDirPath);
+    util::FileUtil::mkdirs(tmpDirPath);
+
+    // Write shards in parallel
+    std::vector<std::thread> workers;
+    std::atomic<bool> hasFailed(false);
+
+    for (const auto& shard : shards) {
+      workers.emplace_back([&tmpDirPath, &shard, &hasFailed]() {
+        const std::string filePath = util::FileUtil::join(tmpDirPath, shard.fileName);
+
+        try {
+          if (!shard.tensors.empty()) {
+            util::saveNamedTensors(shard.tensors, filePath);
+          } else {
+            util::writeFile(filePath, shard.bytes);
+          }
+
+          util::syncFile(filePath);
+        } catch (const std::exception& e) {
+          LOG_ERROR("Failed to write " + filePath + " : " + e.what());
+          hasFailed = true;
+        }
+      });
+    }
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    if (hasFailed) {
+      LOG_ERROR("Checkpoint " + absDirPath + " is not written.");
+      return;
+    }
+
+    util::syncDirectory(tmpDirPath);
+
+    // Publish
+    // NOTE: The previous checkpoint is only moved aside, and deleted once the new one is in place, so a crash at
+    //       any point leaves either `<dir>` or `<dir>.old` complete
+    util::generic_fs::remove_all(oldDirPath);
+
+    if (util::generic_fs::exists(absDirPath)) {
+      util::generic_fs::rename(absDirPath, oldDirPath);
+    }
+
+    util::generic_fs::rename(tmpDirPath, absDirPath);
+    util::syncDirectory(util::FileUtil::dirPath(absDirPath));
+
+    util::generic_fs::remove_all(oldDirPath);
+  } catch (const std::exception& e) {
+    LOG_ERROR("Failed to write checkpoint " + absDirPath + " : " + e.what());
+    return;
+  }
+
+  const double writeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+  _lastWriteTime = writeTime;
+
+  LOG_INFO("Checkpoint written to " + absDirPath + " in " + std::to_string(writeTime) + " [ms]");
+}
+
+}  // namespace dmcpp::trainer
@@ -0,0 +1,109 @@
+#include <DiffusionModelC++/Trainer/DataParallel.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+namespace dmcpp::trainer {
+
+GradReducer::GradReducer(std::shared_ptr<distributed::ProcessGroup> processGroup,
+                         ParameterArena& arena,
+                         int64_t bucketBytes)
+    : _processGroup(std::move(processGroup)),
+      _flatGrads(arena.getFlatGrads()),
+      _buckets(),
+      _bucketOfParam(),
+      _completedBuckets(),
+      _isSyncEnabled(true),
+      _canOverlap(arena.getFlatGrads().is_cpu()) {
+  TORCH_CHECK(_flatGrads.defined(), "GradReducer needs a parameter arena with gradients");
+
+  const auto& segments = arena.getSegments();
+  const int64_t nParams = static_cast<int64_t>(segments.size());
+  const int64_t elementSize = _flatGrads.element_size();
+
+  _bucketOfParam.resize(nParams);
+
+  // Buckets over contiguous ranges of segments, starting from the last parameter
+  int64_t bucketEnd = _flatGrads.numel();
+  int64_t nParamsInBucket = 0;
+
+  for (int64_t iParam = nParams - 1; iParam >= 0; --iParam) {
+    _bucketOfParam[iParam] = _buckets.size();
+    ++nParamsInBucket;
+
+    const int64_t bucketOffset = segments[iParam].offset;
+
+    if ((bucketEnd - bucketOffset) * elementSize >= bucketBytes || iParam == 0) {
+      _buckets.push_back({bucketOffset, bucketEnd - bucketOffset, nParamsInBucket, nParamsInBucket, false, {}});
+      bucketEnd = bucketOffset;
+      nParamsInBucket = 0;
+    }
+  }
+
+  // Hooks
+  const auto& params = arena.getParams();
+
+  for (size_t iParam = 0; iParam < params.size(); ++iParam) {
+    torch::Tensor param = params[iParam];
+    param.register_hook([this, iParam](const torch::Tensor&) { onGradReady(iParam); });
+  }
+
+  LOG_INFO("Gradient all-reduce in " + std::to_string(_buckets.size()) + " buckets" + (_canOverlap ? ", overlapped with backward" : ""));
+}
+
+void GradReducer::setSyncEnabled(bool isEnabled) {
+  _isSyncEnabled = isEnabled;
+}
+
+bool GradReducer::isSyncEnabled() const {
+  return _isSyncEnabled;
+}
+
+void GradReducer::onGradReady(size_t iParam) {
+  if (!_isSyncEnabled || !_canOverlap) {
+    return;
+  }
+
+  // The gradients of the previous hooks have been accumulated by now
+  for (const size_t iBucket : _completedBuckets) {
+    launch(iBucket);
+  }
+
+  _completedBuckets.clear();
+
+  Bucket& bucket = _buckets[_bucketOfParam[iParam]];
+
+  if (--bucket.nPending == 0) {
+    _completedBuckets.push_back(_bucketOfParam[iParam]);
+  }
+}
+
+void GradReducer::launch(size_t iBucket) {
+  Bucket& bucket = _buckets[iBucket];
+
+  if (bucket.isLaunched) {
+    return;
+  }
+
+  bucket.work = _processGroup->allReduceAsync(_flatGrads.narrow(0, bucket.offset, bucket.numel),
+                                              1.0 / static_cast<double>(_processGroup->getWorldSize()));
+  bucket.isLaunched = true;
+}
+
+void GradReducer::finish() {
+  if (!_isSyncEnabled) {
+    return;
+  }
+
+  for (size_t iBucket = 0; iBucket < _buckets.size(); ++iBucket) {
+    launch(iBucket);
+  }
+
+  for (auto& bucket : _buckets) {
+    bucket.work.get();
+    bucket.nPending = bucket.nParams;
+    bucket.isLaunched = false;
+  }
+
+  _completedBuckets.clear();
+}
+
+}  // namespace dmcpp::trainer
@@ -1,28 +1,30 @@
+#include <ATen/CPUGeneratorImpl.h>
 #include <omp.h>
 
 #include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <DiffusionModelC++/Trainer/DatasetManifest.hpp>
 #include <DiffusionModelC++/Util/FileUtil.hpp>
 #include <DiffusionModelC++/Util/Logging.hpp>
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 
 namespace dmcpp::trainer {
 
 namespace fs = std::filesystem;
 
-ImageFolderDataset::ImageFolderDataset(const std::string& root,
-                                       const int& imageWidth,
-                                       const int& imageHeight,
-                                       const std::string& extension)
-    : _imagePaths(),
-      _images(),
-      _imageWidth(imageWidth),
-      _imageHeight(imageHeight) {
-  // Get image paths
+std::vector<std::string> listImageFiles(const std::string& root, const std::string& extension, const std::string& manifestPath) {
+  if (!manifestPath.empty()) {
+    return DatasetManifest::loadOrBuild(root, extension, manifestPath).getImagePaths();
+  }
+
+  std::vector<std::string> imagePaths;
+
   try {
     for (const auto& entry : fs::recursive_directory_iterator(root)) {
-      if (entry.is_regular_file() && entry.path().extension() == extension) {
-        _imagePaths.push_back(entry.path().string());
+      if (entry.is_regular_file() && entry.path().extension() == extension && !isManifestFileName(entry.path().filename().string())) {
+        imagePaths.push_back(entry.path().string());
       }
     }
   } catch (const fs::filesystem_error& e) {
@@ -31,10 +33,125 @@ ImageFolderDataset::ImageFolderDataset(const std::string& root,
     LOG_ERROR("General error: " + std::string(e.what()));
   }
 
+  // NOTE: The directory order is unspecified, sorting makes the indices the same on every rank and every run
+  std::sort(imagePaths.begin(), imagePaths.end());
+
+  return imagePaths;
+}
+
+// ====================================================================================================
+// Image cache
+// ====================================================================================================
+
+ImageCache::ImageCache(size_t capacityBytes)
+    : _entries(),
+      _lookup(),
+      _capacityBytes(capacityBytes),
+      _sizeBytes(0),
+      _nHits(0),
+      _nMisses(0),
+      _mutex() {
+}
+
+bool ImageCache::get(size_t index, cv::Mat& image) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  const auto iter = _lookup.find(index);
+
+  if (iter == _lookup.end()) {
+    ++_nMisses;
+    return false;
+  }
+
+  // Move to the front
+  _entries.splice(_entries.begin(), _entries, iter->second);
+  image = iter->second->second;
+  ++_nHits;
+
+  return true;
+}
+
+void ImageCache::put(size_t index, const cv::Mat& image) {
+  const size_t nBytes = image.total() * image.elemSize();
+
+  if (nBytes > _capacityBytes) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  // Another worker may have decoded the same image meanwhile
+  if (_lookup.count(index) > 0) {
+    return;
+  }
+
+  while (!_entries.empty() && _sizeBytes + nBytes > _capacityBytes) {
+    const Entry& last = _entries.back();
+    _sizeBytes -= last.second.total() * last.second.elemSize();
+    _lookup.erase(last.first);
+    _entries.pop_back();
+  }
+
+  _entries.emplace_front(index, image);
+  _lookup[index] = _entries.begin();
+  _sizeBytes += nBytes;
+}
+
+size_t ImageCache::getSizeBytes() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _sizeBytes;
+}
+
+int64_t ImageCache::getNumHits() const {
+  return _nHits.load();
+}
+
+int64_t ImageCache::getNumMisses() const {
+  return _nMisses.load();
+}
+
+// ====================================================================================================
+// Image folder dataset
+// ====================================================================================================
+
+ImageFolderDataset::ImageFolderDataset(const std::string& root,
+                                       const int& imageWidth,
+                                       const int& imageHeight,
+                                       const std::string& extension,
+                                       bool randomFlip,
+                                       config::DatasetMode mode,
+                                       size_t cacheBytes,
+                                       int encodedQuality,
+                                       const std::string& manifestPath)
+    : _imagePaths(),
+      _images(),
+      _cache(),
+      _encoded(),
+      _imageWidth(imageWidth),
+      _imageHeight(imageHeight),
+      _randomFlip(randomFlip) {
+  // Get image paths
+  _imagePaths = listImageFiles(root, extension, manifestPath);
+
   const int64_t nImages = static_cast<int64_t>(_imagePaths.size());
 
   LOG_INFO("Found " + std::to_string(nImages) + " images in " + root);
 
+  switch (mode) {
+    case config::DatasetMode::MEMORY:
+      break;
+    case config::DatasetMode::STREAMING:
+      _cache = std::make_shared<ImageCache>(cacheBytes);
+      LOG_INFO("Streaming images with a decode cache of " + std::to_string(cacheBytes / (1024 * 1024)) + " [MiB]");
+      return;
+    case config::DatasetMode::ENCODED:
+      loadEncodedImages(encodedQuality);
+      return;
+    default:
+      LOG_CRITICAL("Invalid dataset mode");
+      exit(EXIT_FAILURE);
+  }
+
   // Load all images on memory
   LOG_INFO("Loading images ... ");
 
@@ -43,28 +160,194 @@ ImageFolderDataset::ImageFolderDataset(const std::string& root,
 // Parallelize the image loading process using OpenMP
 #pragma omp parallel for
   for (int64_t iImage = 0; iImage < nImages; ++iImage) {
-    cv::Mat image = util::loadImage(_imagePaths[iImage]);
-    image = util::resize(image, _imageWidth, _imageHeight);
-    _images[iImage] = image;
+    _images[iImage] = loadResizedImage(iImage);
   }
 
   LOG_INFO("Done.");
 }
 
-torch::data::Example<torch::Tensor> ImageFolderDataset::get(size_t index) {
-  cv::Mat image = _images[index];
+cv::Mat ImageFolderDataset::loadResizedImage(size_t index) const {
+  const cv::Mat& image = util::loadImage(_imagePaths[index]);
+  return util::resize(image, _imageWidth, _imageHeight);
+}
+
+void ImageFolderDataset::loadEncodedImages(int encodedQuality) {
+  const int64_t nImages = static_cast<int64_t>(_imagePaths.size());
+
+  auto arena = std::make_shared<EncodedImageArena>();
+  arena->offsets.resize(nImages + 1, 0);
+
+  if (encodedQuality > 0) {
+    LOG_INFO("Re-encoding images at " + std::to_string(_imageWidth) + "x" + std::to_string(_imageHeight) + " with JPEG quality " + std::to_string(encodedQuality) + " ... ");
+
+    std::vector<std::vector<uchar>> encodedImages(nImages);
+    const std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, encodedQuality};
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+      cv::imencode(".jpg", loadResizedImage(iImage), encodedImages[iImage], params);
+    }
+
+    for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+      arena->offsets[iImage + 1] = arena->offsets[iImage] + encodedImages[iImage].size();
+    }
+
+    arena->bytes.resize(arena->offsets[nImages]);
+
+#pragma omp parallel for
+    for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+      std::copy(encodedImages[iImage].begin(), encodedImages[iImage].end(), arena->bytes.begin() + arena->offsets[iImage]);
+    }
+  } else {
+    LOG_INFO("Reading encoded images ... ");
+
+    for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+      arena->offsets[iImage + 1] = arena->offsets[iImage] + static_cast<size_t>(fs::file_size(_imagePaths[iImage]));
+    }
+
+    arena->bytes.resize(arena->offsets[nImages]);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+      const size_t nBytes = arena->offsets[iImage + 1] - arena->offsets[iImage];
+
+      std::ifstream file(_imagePaths[iImage], std::ios::binary);
+      file.read(reinterpret_cast<char*>(arena->bytes.data() + arena->offsets[iImage]), static_cast<std::streamsize>(nBytes));
+
+      if (!file) {
+        LOG_CRITICAL("Could not read " + _imagePaths[iImage]);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  LOG_INFO("Done. " + std::to_string(static_cast<double>(arena->bytes.size()) / (1024.0 * 1024.0)) + " [MiB] of encoded images");
+
+  _encoded = std::move(arena);
+}
+
+cv::Mat ImageFolderDataset::getImage(size_t index) {
+  cv::Mat image;
+
+  if (_encoded != nullptr) {
+    const size_t offset = _encoded->offsets[index];
+    const cv::Mat encodedImage(1, static_cast<int>(_encoded->offsets[index + 1] - offset), CV_8UC1, const_cast<uchar*>(_encoded->bytes.data() + offset));
 
-  if (torch::rand({1}).item<float>() < 0.5f) {
-    image = util::horizontalFlip(image);
+    image = cv::imdecode(encodedImage, cv::IMREAD_COLOR);
+
+    if (image.empty()) {
+      LOG_CRITICAL("Could not decode the image: " + _imagePaths[index]);
+      exit(EXIT_FAILURE);
+    }
+
+    if (image.cols != _imageWidth || image.rows != _imageHeight) {
+      image = util::resize(image, _imageWidth, _imageHeight);
+    }
+  } else if (_cache == nullptr) {
+    image = _images[index];
+  } else if (!_cache->get(index, image)) {
+    image = loadResizedImage(index);
+    _cache->put(index, image);
   }
 
-  const torch::Tensor& imageTensor = util::cv2MatToTensor(image);
+  return image;
+}
+
+torch::Tensor ImageFolderDataset::get_batch(torch::ArrayRef<size_t> indices) {
+  const int64_t batchSize = static_cast<int64_t>(indices.size());
 
-  return {imageTensor, imageTensor};
+  // NOTE: Each data loader worker owns a copy of the dataset but runs on its own thread, so the staging buffer is
+  //       per thread. It is only reallocated when the batch size changes.
+  thread_local torch::Tensor staging;
+
+  if (!staging.defined() || staging.size(0) != batchSize || staging.size(1) != _imageHeight || staging.size(2) != _imageWidth) {
+    staging = torch::empty({batchSize, _imageHeight, _imageWidth, 3}, torch::kUInt8);
+  }
+
+  for (int64_t iImage = 0; iImage < batchSize; ++iImage) {
+    const cv::Mat& image = getImage(indices[iImage]);
+    cv::Mat dst(_imageHeight, _imageWidth, CV_8UC3, staging[iImage].data_ptr<uint8_t>());
+
+    if (_randomFlip && torch::rand({1}).item<float>() < 0.5f) {
+      cv::flip(image, dst, 1);
+    } else {
+      image.copyTo(dst);
+    }
+  }
+
+  // NOTE: BGR HWC -> RGB CHW, the cast and the normalization as vectorized passes over the batch
+  torch::Tensor batch = torch::empty({batchSize, 3, _imageHeight, _imageWidth}, torch::kFloat32);
+
+  for (int64_t iChannel = 0; iChannel < 3; ++iChannel) {
+    batch.select(1, iChannel).copy_(staging.select(3, 2 - iChannel));
+  }
+
+  return batch.mul_(2.0 / 255.0).sub_(1.0);
 }
 
 torch::optional<size_t> ImageFolderDataset::size() const {
   return _imagePaths.size();
 }
 
+ResumableRandomSampler::ResumableRandomSampler(int64_t size, uint64_t seed, int rank, int worldSize)
+    : _position(std::make_shared<SamplerPosition>()),
+      _indices(),
+      _size(size),
+      _index(0),
+      _seed(seed),
+      _rank(rank),
+      _worldSize(worldSize) {
+}
+
+void ResumableRandomSampler::reset(torch::optional<size_t> new_size) {
+  if (new_size.has_value()) {
+    _size = static_cast<int64_t>(*new_size);
+  }
+
+  auto generator = at::detail::createCPUGenerator(_seed + static_cast<uint64_t>(_position->epoch));
+  _indices = torch::randperm(_size, generator, torch::TensorOptions().dtype(torch::kInt64));
+
+  if (_worldSize > 1) {
+    const int64_t nPerRank = _size / _worldSize;
+    _indices = _indices.narrow(0, 0, nPerRank * _worldSize).view({nPerRank, _worldSize}).select(1, _rank).contiguous();
+  }
+
+  _index = std::min(_position->index, _indices.size(0));
+}
+
+torch::optional<std::vector<size_t>> ResumableRandomSampler::next(size_t batch_size) {
+  const int64_t size = _indices.size(0);
+
+  if (_index >= size) {
+    return torch::nullopt;
+  }
+
+  const int64_t end = std::min(size, _index + static_cast<int64_t>(batch_size));
+  const int64_t* indices = _indices.data_ptr<int64_t>();
+
+  std::vector<size_t> batch(indices + _index, indices + end);
+  _index = end;
+
+  return batch;
+}
+
+void ResumableRandomSampler::save(torch::serialize::OutputArchive& archive) const {
+  archive.write("epoch", _position->epoch);
+  archive.write("index", _position->index);
+}
+
+void ResumableRandomSampler::load(torch::serialize::InputArchive& archive) {
+  c10::IValue value;
+
+  archive.read("epoch", value);
+  _position->epoch = value.toInt();
+
+  archive.read("index", value);
+  _position->index = value.toInt();
+}
+
+std::shared_ptr<SamplerPosition> ResumableRandomSampler::getPosition() const {
+  return _position;
+}
+
 }  // namespace dmcpp::trainer
\ No newline at end of file
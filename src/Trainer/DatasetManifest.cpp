@@ -0,0 +1,547 @@
+#include <omp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Trainer/DatasetManifest.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dmcpp::trainer {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kManifestMagic[8] = {'D', 'M', 'C', 'M', 'A', 'N', 'I', '\0'};
+constexpr uint32_t kManifestVersion = 2;
+
+// Smallest serialized directory and entry: an empty path and the fixed-size fields
+constexpr uint64_t kMinDirectoryBytes = sizeof(uint32_t) + sizeof(int64_t);
+constexpr uint64_t kMinEntryBytes = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) + 2 * sizeof(int32_t);
+
+// Modification time [ns] and size, false if the path does not exist or is not of the expected kind
+bool statPath(const std::string& path, bool isDirectory, int64_t& mtime, uint64_t& size) {
+  struct stat pathStat {};
+
+  if (stat(path.c_str(), &pathStat) != 0 || S_ISDIR(pathStat.st_mode) != isDirectory) {
+    return false;
+  }
+
+  mtime = static_cast<int64_t>(pathStat.st_mtim.tv_sec) * 1000000000LL + static_cast<int64_t>(pathStat.st_mtim.tv_nsec);
+  size = static_cast<uint64_t>(pathStat.st_size);
+
+  return true;
+}
+
+uint32_t readBigEndian(const unsigned char* bytes, int nBytes) {
+  uint32_t value = 0;
+
+  for (int i = 0; i < nBytes; ++i) {
+    value = (value << 8) | bytes[i];
+  }
+
+  return value;
+}
+
+// Pixel size from the PNG IHDR chunk or the JPEG SOF segment, without decoding
+void probeImageSize(const std::string& filePath, int32_t& width, int32_t& height) {
+  std::ifstream file(filePath, std::ios::binary);
+  unsigned char header[24];
+
+  if (!file.read(reinterpret_cast<char*>(header), 2)) {
+    return;
+  }
+
+  if (header[0] == 0x89 && header[1] == 'P') {
+    if (file.read(reinterpret_cast<char*>(header + 2), 22) && std::memcmp(header + 12, "IHDR", 4) == 0) {
+      width = static_cast<int32_t>(readBigEndian(header + 16, 4));
+      height = static_cast<int32_t>(readBigEndian(header + 20, 4));
+    }
+
+    return;
+  }
+
+  if (header[0] != 0xFF || header[1] != 0xD8) {
+    return;
+  }
+
+  unsigned char segment[7];
+
+  while (file.read(reinterpret_cast<char*>(segment), 2)) {
+    if (segment[0] != 0xFF) {
+      return;
+    }
+
+    const unsigned char marker = segment[1];
+
+    // Fill bytes and markers without a segment
+    if (marker == 0xFF) {
+      file.seekg(-1, std::ios::cur);
+      continue;
+    }
+
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9)) {
+      continue;
+    }
+
+    if (!file.read(reinterpret_cast<char*>(segment), 2)) {
+      return;
+    }
+
+    const uint32_t length = readBigEndian(segment, 2);
+
+    // SOF0 to SOF15, except DHT, JPG and DAC
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if (file.read(reinterpret_cast<char*>(segment), 5)) {
+        height = static_cast<int32_t>(readBigEndian(segment + 1, 2));
+        width = static_cast<int32_t>(readBigEndian(segment + 3, 2));
+      }
+
+      return;
+    }
+
+    file.seekg(static_cast<std::streamoff>(length) - 2, std::ios::cur);
+  }
+}
+
+template <typename T>
+void writeValue(std::ostream& stream, const T& value) {
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream& stream, T& value) {
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+void writeString(std::ostream& stream, const std::string& value) {
+  writeValue(stream, static_cast<uint32_t>(value.size()));
+  stream.write(value.data(), static_cast<std::streamsize>(value.size()));
+}
+
+// Bytes left in the stream, 0 once it has failed
+uint64_t getRemainingBytes(std::istream& stream, uint64_t fileSize) {
+  const std::streamoff position = stream.tellg();
+  return stream && position >= 0 && static_cast<uint64_t>(position) <= fileSize ? fileSize - static_cast<uint64_t>(position) : 0;
+}
+
+bool readString(std::istream& stream, std::string& value, uint64_t fileSize) {
+  uint32_t size = 0;
+
+  if (!readValue(stream, size) || size > getRemainingBytes(stream, fileSize)) {
+    stream.setstate(std::ios::failbit);
+    return false;
+  }
+
+  value.resize(size);
+
+  return static_cast<bool>(stream.read(value.data(), static_cast<std::streamsize>(size)));
+}
+
+std::string getParentPath(const std::string& path) {
+  const size_t pos = path.rfind('/');
+  return pos == std::string::npos ? std::string() : path.substr(0, pos);
+}
+
+std::string joinRelative(const std::string& dirPath, const std::string& name) {
+  return dirPath.empty() ? name : dirPath + "/" + name;
+}
+
+struct DirectoryListing {
+  std::vector<DatasetManifest::Entry> entries;
+  std::vector<DatasetManifest::Directory> subdirectories;
+};
+
+// One directory, without recursion. Entries of `knownEntries` with the same name, size and modification time are
+// reused without probing the file again.
+DirectoryListing listDirectory(const std::string& root,
+                               const std::string& dirPath,
+                               const std::string& extension,
+                               const std::vector<DatasetManifest::Entry>* knownEntries) {
+  DirectoryListing listing;
+
+  std::unordered_map<std::string, const DatasetManifest::Entry*> knownByPath;
+
+  if (knownEntries != nullptr) {
+    for (const auto& entry : *knownEntries) {
+      knownByPath[entry.path] = &entry;
+    }
+  }
+
+  try {
+    for (const auto& dirEntry : fs::directory_iterator(fs::path(root) / dirPath)) {
+      const std::string name = dirEntry.path().filename().string();
+      const std::string relPath = joinRelative(dirPath, name);
+
+      int64_t mtime = 0;
+      uint64_t size = 0;
+
+      if (dirEntry.is_directory() && !dirEntry.is_symlink()) {
+        if (statPath(dirEntry.path().string(), true, mtime, size)) {
+          listing.subdirectories.push_back({relPath, mtime});
+        }
+      } else if (dirEntry.is_regular_file() && dirEntry.path().extension() == extension && !isManifestFileName(name)) {
+        if (!statPath(dirEntry.path().string(), false, mtime, size)) {
+          continue;
+        }
+
+        const auto iter = knownByPath.find(relPath);
+
+        if (iter != knownByPath.end() && iter->second->size == size && iter->second->mtime == mtime) {
+          listing.entries.push_back(*iter->second);
+          continue;
+        }
+
+        DatasetManifest::Entry entry;
+        entry.path = relPath;
+        entry.size = size;
+        entry.mtime = mtime;
+        probeImageSize(dirEntry.path().string(), entry.width, entry.height);
+
+        listing.entries.push_back(std::move(entry));
+      }
+    }
+  } catch (const fs::filesystem_error& e) {
+    LOG_ERROR("Filesystem error: " + std::string(e.what()));
+  }
+
+  return listing;
+}
+
+}  // namespace
+
+bool isManifestFileName(const std::string& fileName) {
+  return (fileName.rfind(kManifestFilePrefix, 0) == 0 || fileName.rfind(kFallbackManifestFilePrefix, 0) == 0) &&
+         fileName.find(kManifestFileSuffix) != std::string::npos;
+}
+
+DatasetManifest::DatasetManifest(std::string root, std::string extension)
+    : _root(std::move(root)),
+      _extension(std::move(extension)),
+      _directories(),
+      _entries() {
+}
+
+DatasetManifest DatasetManifest::loadOrBuild(const std::string& root, const std::string& extension, const std::string& filePath) {
+  const auto startTime = std::chrono::high_resolution_clock::now();
+
+  DatasetManifest manifest(root, extension);
+
+  const bool isLoaded = manifest.load(filePath);
+  const bool hasChanged = manifest.refresh();
+
+  const double elapsedTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+  LOG_INFO(std::string(isLoaded ? "Loaded" : "Built") + " the dataset manifest " + filePath + " (" + std::to_string(manifest._entries.size()) + " images, " +
+           std::to_string(manifest._directories.size()) + " directories" + (isLoaded && hasChanged ? ", updated" : "") + ") in " + std::to_string(elapsedTime) + " [sec]");
+
+  if (hasChanged) {
+    if (!manifest.save(filePath)) {
+      LOG_WARN("Could not write the dataset manifest " + filePath);
+    } else {
+      manifest.patchOwnDirectoryTime(filePath);
+    }
+  }
+
+  return manifest;
+}
+
+std::vector<std::string> DatasetManifest::getImagePaths() const {
+  std::vector<std::string> imagePaths;
+  imagePaths.reserve(_entries.size());
+
+  for (const auto& entry : _entries) {
+    imagePaths.push_back((fs::path(_root) / entry.path).string());
+  }
+
+  return imagePaths;
+}
+
+const std::vector<DatasetManifest::Entry>& DatasetManifest::getEntries() const {
+  return _entries;
+}
+
+bool DatasetManifest::load(const std::string& filePath) {
+  std::error_code error;
+  const uint64_t fileSize = fs::file_size(filePath, error);
+
+  if (error) {
+    return false;
+  }
+
+  std::ifstream file(filePath, std::ios::binary);
+
+  if (!file) {
+    return false;
+  }
+
+  char magic[8];
+  uint32_t version = 0;
+  std::string root;
+  std::string extension;
+
+  if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, kManifestMagic, sizeof(magic)) != 0 ||
+      !readValue(file, version) || version != kManifestVersion ||
+      !readString(file, root, fileSize) || root != getAbsoluteRoot() ||
+      !readString(file, extension, fileSize) || extension != _extension) {
+    LOG_WARN("Ignoring the dataset manifest " + filePath + " of another format, root or extension");
+    return false;
+  }
+
+  // NOTE: The counts are bounded by the bytes left, so a corrupt count cannot allocate more than the file holds
+  uint64_t nDirectories = 0;
+
+  if (!readValue(file, nDirectories) || nDirectories > getRemainingBytes(file, fileSize) / kMinDirectoryBytes) {
+    LOG_WARN("Ignoring the corrupt dataset manifest " + filePath);
+    return false;
+  }
+
+  std::vector<Directory> directories(nDirectories);
+
+  for (auto& directory : directories) {
+    readString(file, directory.path, fileSize);
+    readValue(file, directory.mtime);
+  }
+
+  uint64_t nEntries = 0;
+
+  if (!readValue(file, nEntries) || nEntries > getRemainingBytes(file, fileSize) / kMinEntryBytes) {
+    LOG_WARN("Ignoring the corrupt dataset manifest " + filePath);
+    return false;
+  }
+
+  std::vector<Entry> entries(nEntries);
+
+  for (auto& entry : entries) {
+    readString(file, entry.path, fileSize);
+    readValue(file, entry.size);
+    readValue(file, entry.mtime);
+    readValue(file, entry.width);
+    readValue(file, entry.height);
+  }
+
+  if (!file) {
+    LOG_WARN("Ignoring the truncated dataset manifest " + filePath);
+    return false;
+  }
+
+  _directories = std::move(directories);
+  _entries = std::move(entries);
+
+  return true;
+}
+
+bool DatasetManifest::save(const std::string& filePath) const {
+  // NOTE: Written next to the target and renamed, so a concurrent reader never sees half a manifest
+  const std::string tmpFilePath = filePath + ".tmp" + std::to_string(getpid());
+
+  {
+    std::ofstream file(tmpFilePath, std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+      return false;
+    }
+
+    file.write(kManifestMagic, sizeof(kManifestMagic));
+    writeValue(file, kManifestVersion);
+    writeString(file, getAbsoluteRoot());
+    writeString(file, _extension);
+
+    writeValue(file, static_cast<uint64_t>(_directories.size()));
+
+    for (const auto& directory : _directories) {
+      writeString(file, directory.path);
+      writeValue(file, directory.mtime);
+    }
+
+    writeValue(file, static_cast<uint64_t>(_entries.size()));
+
+    for (const auto& entry : _entries) {
+      writeString(file, entry.path);
+      writeValue(file, entry.size);
+      writeValue(file, entry.mtime);
+      writeValue(file, entry.width);
+      writeValue(file, entry.height);
+    }
+
+    if (!file.flush()) {
+      return false;
+    }
+  }
+
+  std::error_code error;
+  fs::rename(tmpFilePath, filePath, error);
+
+  return !error;
+}
+
+void DatasetManifest::patchOwnDirectoryTime(const std::string& filePath) {
+  // NOTE: Renaming the manifest into a dataset directory changes that directory's modification time, which would
+  //       make the next run list it again. Its new time is written over the old one in place, which does not touch
+  //       the directory again.
+  const fs::path dirPath = fs::absolute(filePath).lexically_normal().parent_path();
+  const fs::path relPath = dirPath.lexically_relative(getAbsoluteRoot());
+
+  if (relPath.empty() || *relPath.begin() == "..") {
+    return;
+  }
+
+  const std::string directoryPath = relPath == "." ? std::string() : relPath.generic_string();
+
+  // Offset of the modification time of the directory in the file
+  uint64_t offset = sizeof(kManifestMagic) + sizeof(kManifestVersion) + sizeof(uint32_t) + getAbsoluteRoot().size() +
+                    sizeof(uint32_t) + _extension.size() + sizeof(uint64_t);
+
+  for (auto& directory : _directories) {
+    offset += sizeof(uint32_t) + directory.path.size();
+
+    if (directory.path == directoryPath) {
+      uint64_t size = 0;
+
+      if (!statPath(dirPath.string(), true, directory.mtime, size)) {
+        return;
+      }
+
+      std::fstream file(filePath, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(static_cast<std::streamoff>(offset));
+      writeValue(file, directory.mtime);
+
+      return;
+    }
+
+    offset += sizeof(int64_t);
+  }
+}
+
+std::string DatasetManifest::getAbsoluteRoot() const {
+  return fs::absolute(_root).lexically_normal().string();
+}
+
+bool DatasetManifest::refresh() {
+  // Stat the known directories in parallel
+  const int64_t nDirectories = static_cast<int64_t>(_directories.size());
+  std::vector<int64_t> mtimes(nDirectories, -1);
+
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int64_t iDirectory = 0; iDirectory < nDirectories; ++iDirectory) {
+    uint64_t size = 0;
+
+    if (!statPath((fs::path(_root) / _directories[iDirectory].path).string(), true, mtimes[iDirectory], size)) {
+      mtimes[iDirectory] = -1;
+    }
+  }
+
+  std::vector<Directory> directories;
+  std::unordered_set<std::string> knownDirectories;
+  std::unordered_set<std::string> removedDirectories;
+  std::vector<std::string> toList;
+
+  for (int64_t iDirectory = 0; iDirectory < nDirectories; ++iDirectory) {
+    const Directory& directory = _directories[iDirectory];
+
+    if (mtimes[iDirectory] < 0) {
+      removedDirectories.insert(directory.path);
+      continue;
+    }
+
+    if (mtimes[iDirectory] != directory.mtime) {
+      toList.push_back(directory.path);
+    }
+
+    directories.push_back({directory.path, mtimes[iDirectory]});
+    knownDirectories.insert(directory.path);
+  }
+
+  // Nothing known yet: start from the root
+  if (directories.empty()) {
+    int64_t mtime = 0;
+    uint64_t size = 0;
+
+    if (!statPath(_root, true, mtime, size)) {
+      LOG_ERROR("Not a directory: " + _root);
+      _entries.clear();
+      return false;
+    }
+
+    directories.push_back({"", mtime});
+    knownDirectories.insert("");
+    toList.push_back("");
+  }
+
+  if (toList.empty() && removedDirectories.empty()) {
+    return false;
+  }
+
+  std::unordered_map<std::string, std::vector<Entry>> entriesByDirectory;
+
+  for (auto& entry : _entries) {
+    const std::string dirPath = getParentPath(entry.path);
+
+    if (removedDirectories.count(dirPath) == 0) {
+      entriesByDirectory[dirPath].push_back(std::move(entry));
+    }
+  }
+
+  // List the changed directories in parallel, then the new subdirectories they contain, and so on
+  while (!toList.empty()) {
+    const int64_t nToList = static_cast<int64_t>(toList.size());
+
+    std::vector<const std::vector<Entry>*> knownEntries(nToList, nullptr);
+
+    for (int64_t iDirectory = 0; iDirectory < nToList; ++iDirectory) {
+      const auto iter = entriesByDirectory.find(toList[iDirectory]);
+      knownEntries[iDirectory] = iter != entriesByDirectory.end() ? &iter->second : nullptr;
+    }
+
+    std::vector<DirectoryListing> listings(nToList);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t iDirectory = 0; iDirectory < nToList; ++iDirectory) {
+      listings[iDirectory] = listDirectory(_root, toList[iDirectory], _extension, knownEntries[iDirectory]);
+    }
+
+    std::vector<std::string> nextToList;
+
+    for (int64_t iDirectory = 0; iDirectory < nToList; ++iDirectory) {
+      entriesByDirectory[toList[iDirectory]] = std::move(listings[iDirectory].entries);
+
+      for (const auto& subdirectory : listings[iDirectory].subdirectories) {
+        if (knownDirectories.insert(subdirectory.path).second) {
+          directories.push_back(subdirectory);
+          nextToList.push_back(subdirectory.path);
+        }
+      }
+    }
+
+    toList = std::move(nextToList);
+  }
+
+  _entries.clear();
+
+  for (auto& [dirPath, entries] : entriesByDirectory) {
+    std::move(entries.begin(), entries.end(), std::back_inserter(_entries));
+  }
+
+  std::sort(_entries.begin(), _entries.end(), [](const Entry& a, const Entry& b) { return a.path < b.path; });
+  std::sort(directories.begin(), directories.end(), [](const Directory& a, const Directory& b) { return a.path < b.path; });
+
+  _directories = std::move(directories);
+
+  return true;
+}
+
+std::string getDefaultManifestPath(const std::string& root, const std::string& extension, const std::string& fallbackDir) {
+  if (access(root.c_str(), W_OK) == 0) {
+    return (fs::path(root) / (kManifestFilePrefix + extension + kManifestFileSuffix)).string();
+  }
+
+  return (fs::path(fallbackDir) / (kFallbackManifestFilePrefix + extension + kManifestFileSuffix)).string();
+}
+
+}  // namespace dmcpp::trainer
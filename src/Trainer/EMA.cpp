@@ -30,6 +30,51 @@ void updateEMAModel(diffusion::KarrasDiffusion& model,
   }
 }
 
+void updateEMAModel(const ParameterArena& arena,
+                    ParameterArena& avgArena,
+                    double decay) {
+  TORCH_CHECK(arena.getFlatParams().numel() == avgArena.getFlatParams().numel(), "Model parameters size mismatch!");
+  TORCH_CHECK(arena.getBuffers().size() == avgArena.getBuffers().size(), "Model buffers size mismatch!");
+
+  avgArena.getFlatParams().lerp_(arena.getFlatParams(), 1.0 - decay);
+
+  for (size_t i = 0; i < arena.getBuffers().size(); ++i) {
+    avgArena.getBuffers()[i].copy_(arena.getBuffers()[i]);
+  }
+}
+
+void updateEMAModel(const std::vector<torch::Tensor>& params,
+                    const std::vector<torch::Tensor>& avgParams,
+                    double decay) {
+  TORCH_CHECK(params.size() == avgParams.size(), "Model parameters size mismatch!");
+
+  for (size_t i = 0; i < params.size(); ++i) {
+    torch::Tensor avgParam = avgParams[i];
+    avgParam.lerp_(params[i], 1.0 - decay);
+  }
+}
+
+void copyEMAModel(diffusion::KarrasDiffusion& model,
+                  diffusion::KarrasDiffusion& avgModel) {
+  torch::NoGradGuard no_grad;
+
+  auto model_params = model->named_parameters();
+  auto averaged_params = avgModel->named_parameters();
+  TORCH_CHECK(model_params.size() == averaged_params.size(), "Model parameters size mismatch!");
+
+  for (const auto& param_pair : model_params) {
+    averaged_params[param_pair.key()].copy_(param_pair.value());
+  }
+
+  auto model_buffers = model->named_buffers();
+  auto averaged_buffers = avgModel->named_buffers();
+  TORCH_CHECK(model_buffers.size() == averaged_buffers.size(), "Model buffers size mismatch!");
+
+  for (const auto& buffer_pair : model_buffers) {
+    averaged_buffers[buffer_pair.key()].copy_(buffer_pair.value());
+  }
+}
+
 EMAWarmup::EMAWarmup(double invGamma,
                      double power,
                      double minValue,
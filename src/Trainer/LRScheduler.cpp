@@ -8,6 +8,14 @@ ConstantLRWithWarmup::ConstantLRWithWarmup(torch::optim::Optimizer& optimizer,
       _warmup(warmup) {
 }
 
+int64_t ConstantLRWithWarmup::getStepCount() const {
+  return static_cast<int64_t>(step_count_);
+}
+
+void ConstantLRWithWarmup::setStepCount(int64_t stepCount) {
+  step_count_ = static_cast<unsigned>(stepCount);
+}
+
 std::vector<double> ConstantLRWithWarmup::get_lrs() {
   const double warmup = 1.0 - std::pow(_warmup, step_count_ + 1);
 
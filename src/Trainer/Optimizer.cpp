@@ -0,0 +1,454 @@
+#include <DiffusionModelC++/Trainer/Optimizer.hpp>
+#include <cmath>
+
+namespace dmcpp::trainer {
+
+namespace {
+
+// Elements per work item of the fused loop
+constexpr int64_t kChunkSize = 1 << 15;
+
+struct AdamWChunk {
+  float* param;
+  const float* grad;
+  float* expAvg;
+  float* expAvgSq;
+  int64_t numel;
+  float decay;         // 1 - lr * weight_decay
+  float stepSize;      // lr / bias_correction1
+  float invBiasCorr2;  // 1 / sqrt(bias_correction2)
+  float beta1;
+  float beta2;
+  float eps;
+};
+
+}  // namespace
+
+FusedAdamW::FusedAdamW(std::vector<torch::Tensor> params,
+                       torch::optim::AdamWOptions defaults)
+    : torch::optim::AdamW(std::move(params), std::move(defaults)) {
+}
+
+bool FusedAdamW::isFusable() const {
+  for (const auto& group : param_groups_) {
+    const auto& options = static_cast<const torch::optim::AdamWOptions&>(group.options());
+
+    if (options.amsgrad()) {
+      return false;
+    }
+
+    for (const auto& p : group.params()) {
+      if (!p.grad().defined()) {
+        continue;
+      }
+
+      if (!p.device().is_cpu() || p.scalar_type() != torch::kFloat32 || !p.is_contiguous() ||
+          p.grad().is_sparse() || p.grad().scalar_type() != torch::kFloat32 || !p.grad().is_contiguous()) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+torch::Tensor FusedAdamW::step(LossClosure closure) {
+  if (!isFusable()) {
+    return torch::optim::AdamW::step(closure);
+  }
+
+  torch::NoGradGuard no_grad;
+
+  torch::Tensor loss = {};
+
+  if (closure != nullptr) {
+    at::AutoGradMode enable_grad(true);
+    loss = closure();
+  }
+
+  // Collect work items, and initialize the state exactly like torch::optim::AdamW
+  std::vector<AdamWChunk> chunks;
+
+  for (auto& group : param_groups_) {
+    const auto& options = static_cast<torch::optim::AdamWOptions&>(group.options());
+
+    for (auto& p : group.params()) {
+      if (!p.grad().defined()) {
+        continue;
+      }
+
+      auto paramState = state_.find(p.unsafeGetTensorImpl());
+
+      if (paramState == state_.end()) {
+        auto state = std::make_unique<torch::optim::AdamWParamState>();
+        state->step(0);
+        state->exp_avg(torch::zeros_like(p, torch::MemoryFormat::Preserve));
+        state->exp_avg_sq(torch::zeros_like(p, torch::MemoryFormat::Preserve));
+        state_[p.unsafeGetTensorImpl()] = std::move(state);
+      }
+
+      auto& state = static_cast<torch::optim::AdamWParamState&>(*state_[p.unsafeGetTensorImpl()]);
+      state.step(state.step() + 1);
+
+      const double beta1 = std::get<0>(options.betas());
+      const double beta2 = std::get<1>(options.betas());
+      const double biasCorrection1 = 1.0 - std::pow(beta1, state.step());
+      const double biasCorrection2 = 1.0 - std::pow(beta2, state.step());
+
+      AdamWChunk chunk;
+      chunk.decay = static_cast<float>(1.0 - options.lr() * options.weight_decay());
+      chunk.stepSize = static_cast<float>(options.lr() / biasCorrection1);
+      chunk.invBiasCorr2 = static_cast<float>(1.0 / std::sqrt(biasCorrection2));
+      chunk.beta1 = static_cast<float>(beta1);
+      chunk.beta2 = static_cast<float>(beta2);
+      chunk.eps = static_cast<float>(options.eps());
+
+      float* param = p.data_ptr<float>();
+      const float* grad = p.grad().data_ptr<float>();
+      float* expAvg = state.exp_avg().data_ptr<float>();
+      float* expAvgSq = state.exp_avg_sq().data_ptr<float>();
+
+      const int64_t numel = p.numel();
+
+      for (int64_t offset = 0; offset < numel; offset += kChunkSize) {
+        chunk.param = param + offset;
+        chunk.grad = grad + offset;
+        chunk.expAvg = expAvg + offset;
+        chunk.expAvgSq = expAvgSq + offset;
+        chunk.numel = std::min(kChunkSize, numel - offset);
+        chunks.push_back(chunk);
+      }
+    }
+  }
+
+  const int64_t nChunks = static_cast<int64_t>(chunks.size());
+
+#pragma omp parallel for schedule(static)
+  for (int64_t iChunk = 0; iChunk < nChunks; ++iChunk) {
+    const AdamWChunk& chunk = chunks[iChunk];
+
+    float* __restrict__ param = chunk.param;
+    const float* __restrict__ grad = chunk.grad;
+    float* __restrict__ expAvg = chunk.expAvg;
+    float* __restrict__ expAvgSq = chunk.expAvgSq;
+
+    const float oneMinusBeta1 = 1.0f - chunk.beta1;
+    const float oneMinusBeta2 = 1.0f - chunk.beta2;
+
+#pragma omp simd
+    for (int64_t i = 0; i < chunk.numel; ++i) {
+      const float g = grad[i];
+      const float m = chunk.beta1 * expAvg[i] + oneMinusBeta1 * g;
+      const float v = chunk.beta2 * expAvgSq[i] + oneMinusBeta2 * g * g;
+      const float denom = std::sqrt(v) * chunk.invBiasCorr2 + chunk.eps;
+
+      expAvg[i] = m;
+      expAvgSq[i] = v;
+      param[i] = param[i] * chunk.decay - chunk.stepSize * m / denom;
+    }
+  }
+
+  return loss;
+}
+
+// ====================================================================================================
+// Adafactor
+// ====================================================================================================
+
+AdafactorOptions::AdafactorOptions(double lr)
+    : lr_(lr) {
+}
+
+void AdafactorOptions::serialize(torch::serialize::OutputArchive& archive) const {
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(lr);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(eps);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(clip_threshold);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(decay_rate);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(beta1);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(weight_decay);
+}
+
+void AdafactorOptions::serialize(torch::serialize::InputArchive& archive) {
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, lr);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, eps);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, clip_threshold);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, decay_rate);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, beta1);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(double, weight_decay);
+}
+
+double AdafactorOptions::get_lr() const {
+  return lr();
+}
+
+void AdafactorOptions::set_lr(const double lr) {
+  this->lr(lr);
+}
+
+void AdafactorParamState::serialize(torch::serialize::OutputArchive& archive) const {
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(step);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_sq_row);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_sq_col);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_sq);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg);
+}
+
+void AdafactorParamState::serialize(torch::serialize::InputArchive& archive) {
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(int64_t, step);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_sq_row);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_sq_col);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_sq);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg);
+}
+
+Adafactor::Adafactor(std::vector<torch::Tensor> params,
+                     AdafactorOptions defaults)
+    : torch::optim::Optimizer({torch::optim::OptimizerParamGroup(std::move(params))},
+                              std::make_unique<AdafactorOptions>(defaults)) {
+}
+
+torch::Tensor Adafactor::step(LossClosure closure) {
+  torch::NoGradGuard no_grad;
+
+  torch::Tensor loss = {};
+
+  if (closure != nullptr) {
+    at::AutoGradMode enable_grad(true);
+    loss = closure();
+  }
+
+  for (auto& group : param_groups_) {
+    const auto& options = static_cast<AdafactorOptions&>(group.options());
+
+    for (auto& p : group.params()) {
+      if (!p.grad().defined()) {
+        continue;
+      }
+
+      const torch::Tensor& grad = p.grad();
+      const bool isFactored = p.dim() >= 2;
+
+      // NOTE: Conv weights are factored as [out, in * kh * kw]
+      const int64_t nRows = isFactored ? p.size(0) : 0;
+      const int64_t nCols = isFactored ? p.numel() / p.size(0) : 0;
+
+      auto paramState = state_.find(p.unsafeGetTensorImpl());
+
+      if (paramState == state_.end()) {
+        auto state = std::make_unique<AdafactorParamState>();
+        state->step(0);
+
+        if (isFactored) {
+          state->exp_avg_sq_row(torch::zeros({nRows}, p.options()));
+          state->exp_avg_sq_col(torch::zeros({nCols}, p.options()));
+        } else {
+          state->exp_avg_sq(torch::zeros_like(p, torch::MemoryFormat::Preserve));
+        }
+
+        if (options.beta1() > 0.0) {
+          state->exp_avg(torch::zeros_like(p, torch::MemoryFormat::Preserve));
+        }
+
+        state_[p.unsafeGetTensorImpl()] = std::move(state);
+      }
+
+      auto& state = static_cast<AdafactorParamState&>(*state_[p.unsafeGetTensorImpl()]);
+      state.step(state.step() + 1);
+
+      const double beta2 = 1.0 - std::pow(static_cast<double>(state.step()), options.decay_rate());
+      const torch::Tensor& gradSq = grad * grad + options.eps();
+
+      torch::Tensor update;
+
+      if (isFactored) {
+        const torch::Tensor& gradSq2d = gradSq.reshape({nRows, nCols});
+
+        state.exp_avg_sq_row().mul_(beta2).add_(gradSq2d.mean(1), 1.0 - beta2);
+        state.exp_avg_sq_col().mul_(beta2).add_(gradSq2d.mean(0), 1.0 - beta2);
+
+        // v ~ row * col / mean(row)
+        const torch::Tensor& rowFactor = (state.exp_avg_sq_row() / state.exp_avg_sq_row().mean()).rsqrt().unsqueeze(1);
+        const torch::Tensor& colFactor = state.exp_avg_sq_col().rsqrt().unsqueeze(0);
+
+        update = (grad.reshape({nRows, nCols}) * rowFactor * colFactor).view_as(p);
+      } else {
+        state.exp_avg_sq().mul_(beta2).add_(gradSq, 1.0 - beta2);
+        update = grad * state.exp_avg_sq().rsqrt();
+      }
+
+      // Update clipping
+      const double rms = update.pow(2).mean().sqrt().item<double>();
+      update.div_(std::max(1.0, rms / options.clip_threshold()));
+
+      if (options.beta1() > 0.0) {
+        state.exp_avg().mul_(options.beta1()).add_(update, 1.0 - options.beta1());
+        update = state.exp_avg();
+      }
+
+      if (options.weight_decay() != 0.0) {
+        p.mul_(1.0 - options.lr() * options.weight_decay());
+      }
+
+      p.add_(update, -options.lr());
+    }
+  }
+
+  return loss;
+}
+
+void Adafactor::save(torch::serialize::OutputArchive& archive) const {
+  serialize(*this, archive);
+}
+
+void Adafactor::load(torch::serialize::InputArchive& archive) {
+  serialize(*this, archive);
+}
+
+// ====================================================================================================
+// 8-bit AdamW
+// ====================================================================================================
+
+void AdamW8bitParamState::serialize(torch::serialize::OutputArchive& archive) const {
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(step);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_scale);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_sq);
+  _TORCH_OPTIM_SERIALIZE_TORCH_ARG(exp_avg_sq_scale);
+}
+
+void AdamW8bitParamState::serialize(torch::serialize::InputArchive& archive) {
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(int64_t, step);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_scale);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_sq);
+  _TORCH_OPTIM_DESERIALIZE_TORCH_ARG(torch::Tensor, exp_avg_sq_scale);
+}
+
+AdamW8bit::AdamW8bit(std::vector<torch::Tensor> params,
+                     AdamW8bitOptions defaults)
+    : torch::optim::Optimizer({torch::optim::OptimizerParamGroup(std::move(params))},
+                              std::make_unique<AdamW8bitOptions>(defaults)) {
+}
+
+torch::Tensor AdamW8bit::step(LossClosure closure) {
+  torch::NoGradGuard no_grad;
+
+  torch::Tensor loss = {};
+
+  if (closure != nullptr) {
+    at::AutoGradMode enable_grad(true);
+    loss = closure();
+  }
+
+  for (auto& group : param_groups_) {
+    const auto& options = static_cast<AdamW8bitOptions&>(group.options());
+
+    for (auto& p : group.params()) {
+      if (!p.grad().defined()) {
+        continue;
+      }
+
+      const int64_t numel = p.numel();
+      const int64_t nBlocks = (numel + kBlockSize - 1) / kBlockSize;
+      const int64_t nPadded = nBlocks * kBlockSize;
+
+      auto paramState = state_.find(p.unsafeGetTensorImpl());
+
+      if (paramState == state_.end()) {
+        auto state = std::make_unique<AdamW8bitParamState>();
+        state->step(0);
+        state->exp_avg(torch::zeros({nBlocks, kBlockSize}, p.options().dtype(torch::kInt8)));
+        state->exp_avg_scale(torch::zeros({nBlocks, 1}, p.options().dtype(torch::kFloat32)));
+        state->exp_avg_sq(torch::zeros({nBlocks, kBlockSize}, p.options().dtype(torch::kUInt8)));
+        state->exp_avg_sq_scale(torch::zeros({nBlocks, 1}, p.options().dtype(torch::kFloat32)));
+        state_[p.unsafeGetTensorImpl()] = std::move(state);
+      }
+
+      auto& state = static_cast<AdamW8bitParamState&>(*state_[p.unsafeGetTensorImpl()]);
+      state.step(state.step() + 1);
+
+      const double beta1 = std::get<0>(options.betas());
+      const double beta2 = std::get<1>(options.betas());
+      const double biasCorrection1 = 1.0 - std::pow(beta1, state.step());
+      const double biasCorrection2 = 1.0 - std::pow(beta2, state.step());
+
+      torch::Tensor grad = p.grad().to(torch::kFloat32).flatten();
+
+      if (nPadded != numel) {
+        grad = torch::constant_pad_nd(grad, {0, nPadded - numel});
+      }
+
+      grad = grad.view({nBlocks, kBlockSize});
+
+      // Dequantize
+      torch::Tensor expAvg = state.exp_avg().to(torch::kFloat32) * (state.exp_avg_scale() / 127.0);
+      const torch::Tensor& expAvgSqCode = state.exp_avg_sq().to(torch::kFloat32);
+      torch::Tensor expAvgSqrt = torch::where(expAvgSqCode > 0.0,
+                                              torch::exp2((expAvgSqCode - 255.0) / kSqrtCodesPerOctave) * state.exp_avg_sq_scale(),
+                                              torch::zeros_like(expAvgSqCode));
+      torch::Tensor expAvgSq = expAvgSqrt * expAvgSqrt;
+
+      expAvg.mul_(beta1).add_(grad, 1.0 - beta1);
+      expAvgSq.mul_(beta2).addcmul_(grad, grad, 1.0 - beta2);
+      expAvgSqrt = expAvgSq.sqrt();
+
+      const torch::Tensor& denom = (expAvgSqrt / std::sqrt(biasCorrection2)).add_(options.eps());
+      const torch::Tensor& update = (expAvg / denom).flatten().narrow(0, 0, numel).view_as(p).to(p.scalar_type());
+
+      if (options.weight_decay() != 0.0) {
+        p.mul_(1.0 - options.lr() * options.weight_decay());
+      }
+
+      p.add_(update, -options.lr() / biasCorrection1);
+
+      // Quantize
+      state.exp_avg_scale(expAvg.abs().amax(1, true).clamp_min(1e-30));
+      state.exp_avg((expAvg / state.exp_avg_scale() * 127.0).round_().clamp_(-127.0, 127.0).to(torch::kInt8));
+
+      state.exp_avg_sq_scale(expAvgSqrt.amax(1, true).clamp_min(1e-30));
+      // NOTE: Log-spaced codes, so small entries of a block keep their relative precision instead of rounding to 0
+      //       against the block max. Code 0 is reserved for exact zeros, any other value is floored to code 1.
+      const torch::Tensor& ratio = expAvgSqrt / state.exp_avg_sq_scale();
+      const torch::Tensor& code = (torch::log2(ratio) * kSqrtCodesPerOctave + 255.0).round_().clamp_(1.0, 255.0);
+      state.exp_avg_sq(torch::where(ratio > 0.0, code, torch::zeros_like(code)).to(torch::kUInt8));
+    }
+  }
+
+  return loss;
+}
+
+void AdamW8bit::save(torch::serialize::OutputArchive& archive) const {
+  serialize(*this, archive);
+}
+
+void AdamW8bit::load(torch::serialize::InputArchive& archive) {
+  serialize(*this, archive);
+}
+
+// ====================================================================================================
+// Utilities
+// ====================================================================================================
+
+int64_t getOptimizerStateBytes(const torch::optim::Optimizer& optimizer) {
+  const auto nBytes = [](const torch::Tensor& tensor) -> int64_t {
+    return tensor.defined() ? static_cast<int64_t>(tensor.nbytes()) : 0;
+  };
+
+  int64_t totalBytes = 0;
+
+  for (const auto& item : optimizer.state()) {
+    const torch::optim::OptimizerParamState* paramState = item.second.get();
+
+    if (const auto* state = dynamic_cast<const torch::optim::AdamWParamState*>(paramState)) {
+      totalBytes += nBytes(state->exp_avg()) + nBytes(state->exp_avg_sq()) + nBytes(state->max_exp_avg_sq());
+    } else if (const auto* state = dynamic_cast<const AdafactorParamState*>(paramState)) {
+      totalBytes += nBytes(state->exp_avg_sq_row()) + nBytes(state->exp_avg_sq_col()) + nBytes(state->exp_avg_sq()) + nBytes(state->exp_avg());
+    } else if (const auto* state = dynamic_cast<const AdamW8bitParamState*>(paramState)) {
+      totalBytes += nBytes(state->exp_avg()) + nBytes(state->exp_avg_scale()) + nBytes(state->exp_avg_sq()) + nBytes(state->exp_avg_sq_scale());
+    }
+  }
+
+  return totalBytes;
+}
+
+}  // namespace dmcpp::trainer
@@ -0,0 +1,317 @@
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <DiffusionModelC++/Trainer/PackedDataset.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace dmcpp::trainer {
+
+namespace {
+
+constexpr uint64_t kPageSize = 4096;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// FNV-1a
+uint64_t hashBytes(const std::string& bytes, uint64_t hash = 0xCBF29CE484222325ULL) {
+  for (const char c : bytes) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+}  // namespace
+
+// ====================================================================================================
+// Packed dataset format
+// ====================================================================================================
+
+void imageToRecord(const cv::Mat& image, uint8_t* record) {
+  TORCH_CHECK(image.type() == CV_8UC3, "Packed records need 8-bit 3-channel images");
+
+  // NOTE: BGR -> RGB, then HWC -> CHW by splitting straight into the record
+  cv::Mat rgbImage;
+  cv::cvtColor(image, rgbImage, cv::COLOR_BGR2RGB);
+
+  const size_t planeBytes = static_cast<size_t>(image.rows) * static_cast<size_t>(image.cols);
+
+  std::vector<cv::Mat> planes;
+
+  for (int iChannel = 0; iChannel < 3; ++iChannel) {
+    planes.emplace_back(image.rows, image.cols, CV_8UC1, record + iChannel * planeBytes);
+  }
+
+  cv::split(rgbImage, planes);
+}
+
+void writePackedDataset(const std::vector<std::string>& imagePaths,
+                        int imageSize,
+                        const std::string& filePath,
+                        int64_t chunkSize) {
+  const int64_t nImages = static_cast<int64_t>(imagePaths.size());
+
+  PackedDatasetHeader header{};
+  std::memcpy(header.magic, kPackedDatasetMagic, sizeof(header.magic));
+  header.version = kPackedDatasetVersion;
+  header.channels = 3;
+  header.height = static_cast<uint32_t>(imageSize);
+  header.width = static_cast<uint32_t>(imageSize);
+  header.nRecords = static_cast<uint64_t>(nImages);
+  header.recordBytes = static_cast<uint64_t>(header.channels) * header.height * header.width;
+  header.dataOffset = alignUp(sizeof(PackedDatasetHeader), kPageSize);
+  header.namesOffset = header.dataOffset + header.nRecords * header.recordBytes;
+  header.namesBytes = 0;
+
+  for (const std::string& imagePath : imagePaths) {
+    header.namesBytes += imagePath.size() + 1;
+  }
+
+  // NOTE: Written next to the target and renamed at the end, so a packed file is always complete
+  const std::string tmpFilePath = filePath + ".tmp";
+
+  std::ofstream file(tmpFilePath, std::ios::binary | std::ios::trunc);
+
+  if (!file) {
+    LOG_CRITICAL("Failed to open " + tmpFilePath);
+    exit(EXIT_FAILURE);
+  }
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  const std::vector<char> padding(header.dataOffset - sizeof(header), 0);
+  file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+
+  std::vector<uint8_t> buffer(static_cast<size_t>(chunkSize) * header.recordBytes);
+
+  for (int64_t chunkStart = 0; chunkStart < nImages; chunkStart += chunkSize) {
+    const int64_t chunkEnd = std::min(nImages, chunkStart + chunkSize);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t iImage = chunkStart; iImage < chunkEnd; ++iImage) {
+      const cv::Mat& image = util::resize(util::loadImage(imagePaths[iImage]), imageSize, imageSize);
+      imageToRecord(image, buffer.data() + (iImage - chunkStart) * header.recordBytes);
+    }
+
+    file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>((chunkEnd - chunkStart) * header.recordBytes));
+
+    LOG_INFO("Packed " + std::to_string(chunkEnd) + " / " + std::to_string(nImages) + " images");
+  }
+
+  for (const std::string& imagePath : imagePaths) {
+    file.write(imagePath.c_str(), static_cast<std::streamsize>(imagePath.size() + 1));
+  }
+
+  file.close();
+
+  if (!file) {
+    LOG_CRITICAL("Failed to write " + tmpFilePath);
+    exit(EXIT_FAILURE);
+  }
+
+  std::filesystem::rename(tmpFilePath, filePath);
+}
+
+std::string acquireSharedPackedDataset(const std::string& root, const std::string& extension, int imageSize, const std::string& manifestPath) {
+  const std::vector<std::string>& imagePaths = listImageFiles(root, extension, manifestPath);
+
+  // Size and modification time of every file
+  // NOTE: Always stat'ed, even with a manifest, which does not notice files rewritten in place
+  std::vector<uint64_t> fileSizes(imagePaths.size(), 0);
+  std::vector<int64_t> fileTimes(imagePaths.size(), 0);
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int64_t iImage = 0; iImage < static_cast<int64_t>(imagePaths.size()); ++iImage) {
+    struct stat fileStat {};
+
+    if (stat(imagePaths[iImage].c_str(), &fileStat) == 0) {
+      fileSizes[iImage] = static_cast<uint64_t>(fileStat.st_size);
+      fileTimes[iImage] = static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000LL + fileStat.st_mtim.tv_nsec;
+    }
+  }
+
+  // NOTE: Sizes and times are part of the key, so images rewritten under the same names get a new file
+  uint64_t hash = hashBytes(std::filesystem::absolute(root).string());
+  hash = hashBytes(extension, hash);
+  hash = hashBytes(std::to_string(imageSize), hash);
+
+  for (size_t iImage = 0; iImage < imagePaths.size(); ++iImage) {
+    hash = hashBytes(imagePaths[iImage], hash);
+    hash = hashBytes(std::to_string(fileSizes[iImage]) + ":" + std::to_string(fileTimes[iImage]), hash);
+  }
+
+  char key[17];
+  std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+
+  const std::string filePath = "/dev/shm/dmcpp_" + std::string(key) + "_" + std::to_string(imageSize) + ".pack";
+  const std::string lockPath = filePath + ".lock";
+
+  const int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0666);
+
+  if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+    LOG_CRITICAL("Failed to lock " + lockPath + " : " + std::strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // NOTE: The packed file only appears by a rename after it is complete, so it is either valid or absent
+  if (std::filesystem::exists(filePath)) {
+    LOG_INFO("Attaching to the shared dataset cache " + filePath);
+  } else {
+    // NOTE: A leftover from a writer that died, which nobody else can be writing while the lock is held
+    std::error_code errorCode;
+    std::filesystem::remove(filePath + ".tmp", errorCode);
+
+    LOG_INFO("Populating the shared dataset cache " + filePath + " with " + std::to_string(imagePaths.size()) + " images ...");
+    writePackedDataset(imagePaths, imageSize, filePath);
+  }
+
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+
+  return filePath;
+}
+
+// ====================================================================================================
+// Mapped file
+// ====================================================================================================
+
+MappedFile::MappedFile(const std::string& filePath)
+    : _data(nullptr),
+      _size(0) {
+  const int fd = open(filePath.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    LOG_CRITICAL("Failed to open " + filePath + " : " + std::strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat fileStat {};
+
+  if (fstat(fd, &fileStat) != 0) {
+    LOG_CRITICAL("Failed to stat " + filePath + " : " + std::strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  _size = static_cast<size_t>(fileStat.st_size);
+
+  if (_size > 0) {
+    _data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+
+  close(fd);
+
+  if (_data == MAP_FAILED || _data == nullptr) {
+    LOG_CRITICAL("Failed to map " + filePath + " : " + std::strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // NOTE: Samples are read in random order, so read-ahead would mostly fetch pages of other samples
+  madvise(_data, _size, MADV_RANDOM);
+}
+
+MappedFile::~MappedFile() {
+  if (_data != nullptr && _data != MAP_FAILED) {
+    munmap(_data, _size);
+  }
+}
+
+const uint8_t* MappedFile::getData() const {
+  return static_cast<const uint8_t*>(_data);
+}
+
+size_t MappedFile::getSize() const {
+  return _size;
+}
+
+// ====================================================================================================
+// Packed image dataset
+// ====================================================================================================
+
+PackedImageDataset::PackedImageDataset(const std::string& filePath)
+    : _file(std::make_shared<MappedFile>(filePath)),
+      _header(),
+      _records() {
+  if (_file->getSize() < sizeof(PackedDatasetHeader)) {
+    LOG_CRITICAL("Not a packed dataset: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  std::memcpy(&_header, _file->getData(), sizeof(PackedDatasetHeader));
+
+  if (std::memcmp(_header.magic, kPackedDatasetMagic, sizeof(_header.magic)) != 0 || _header.version != kPackedDatasetVersion) {
+    LOG_CRITICAL("Not a packed dataset (or an unsupported version): " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  if (_header.channels != 3 || _header.height == 0 || _header.width == 0 ||
+      _header.recordBytes != static_cast<uint64_t>(_header.channels) * _header.height * _header.width) {
+    LOG_CRITICAL("Corrupt packed dataset header: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  // NOTE: Each bound is checked before it is used in the next one, so corrupt sizes cannot overflow the sums
+  const uint64_t fileSize = _file->getSize();
+
+  if (_header.dataOffset < sizeof(PackedDatasetHeader) || _header.dataOffset > fileSize ||
+      _header.nRecords > (fileSize - _header.dataOffset) / _header.recordBytes ||
+      _header.namesOffset != _header.dataOffset + _header.nRecords * _header.recordBytes ||
+      _header.namesBytes > fileSize - _header.namesOffset) {
+    LOG_CRITICAL("Truncated packed dataset: " + filePath);
+    exit(EXIT_FAILURE);
+  }
+
+  // NOTE: The mapping is read-only, the records are only ever read through index_select
+  _records = torch::from_blob(const_cast<uint8_t*>(_file->getData()) + _header.dataOffset,
+                              {static_cast<int64_t>(_header.nRecords), _header.channels, _header.height, _header.width},
+                              torch::kUInt8);
+
+  LOG_INFO("Mapped " + std::to_string(_header.nRecords) + " packed images (" + std::to_string(_header.width) + "x" + std::to_string(_header.height) + ") from " + filePath);
+}
+
+torch::Tensor PackedImageDataset::get_batch(torch::ArrayRef<size_t> indices) {
+  std::vector<int64_t> indicesVec(indices.begin(), indices.end());
+
+  const torch::Tensor& batch = _records.index_select(0, torch::tensor(indicesVec, torch::kInt64));
+
+  return batch.to(torch::kFloat32).mul_(2.0 / 255.0).sub_(1.0);
+}
+
+torch::optional<size_t> PackedImageDataset::size() const {
+  return static_cast<size_t>(_header.nRecords);
+}
+
+int64_t PackedImageDataset::getImageWidth() const {
+  return _header.width;
+}
+
+int64_t PackedImageDataset::getImageHeight() const {
+  return _header.height;
+}
+
+torch::Tensor PackedImageDataset::getRecord(size_t index) const {
+  return _records[static_cast<int64_t>(index)];
+}
+
+std::string PackedImageDataset::getSourcePath(size_t index) const {
+  const char* names = reinterpret_cast<const char*>(_file->getData() + _header.namesOffset);
+  const char* end = names + _header.namesBytes;
+
+  for (size_t i = 0; i < index && names < end; ++i) {
+    names += std::strlen(names) + 1;
+  }
+
+  return names < end ? std::string(names) : std::string();
+}
+
+}  // namespace dmcpp::trainer
@@ -0,0 +1,134 @@
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+namespace dmcpp::trainer {
+
+ParameterArena::ParameterArena(torch::nn::Module& module, bool withGrads, int64_t nShards)
+    : _flatParams(),
+      _flatGrads(),
+      _segments(),
+      _params(),
+      _buffers(),
+      _bufferNames() {
+  torch::NoGradGuard no_grad;
+
+  const auto& namedParams = module.named_parameters(true);
+  TORCH_CHECK(namedParams.size() > 0, "The module has no parameters");
+
+  const torch::TensorOptions options = namedParams[0].value().options();
+
+  // Layout
+  int64_t nElements = 0;
+
+  for (const auto& item : namedParams) {
+    const torch::Tensor& param = item.value();
+
+    TORCH_CHECK(param.dtype() == options.dtype() && param.device() == options.device(),
+                "All parameters must share the same dtype and device: " + item.key());
+
+    _segments.push_back({item.key(), nElements, param.numel()});
+    _params.push_back(param);
+
+    nElements += (param.numel() + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  const int64_t shardAlignment = kAlignment * std::max<int64_t>(1, nShards);
+  nElements = (nElements + shardAlignment - 1) / shardAlignment * shardAlignment;
+
+  // Relocate parameters
+  _flatParams = torch::zeros({nElements}, options);
+
+  for (size_t i = 0; i < _params.size(); ++i) {
+    const Segment& segment = _segments[i];
+    torch::Tensor view = _flatParams.narrow(0, segment.offset, segment.numel).view(_params[i].sizes());
+
+    view.copy_(_params[i]);
+    _params[i].set_data(view);
+  }
+
+  // Gradients
+  if (withGrads) {
+    _flatGrads = torch::zeros({nElements}, options);
+
+    for (size_t i = 0; i < _params.size(); ++i) {
+      const Segment& segment = _segments[i];
+      _params[i].mutable_grad() = _flatGrads.narrow(0, segment.offset, segment.numel).view(_params[i].sizes());
+    }
+  }
+
+  for (const auto& item : module.named_buffers(true)) {
+    _bufferNames.push_back(item.key());
+    _buffers.push_back(item.value());
+  }
+
+  LOG_INFO("Parameter arena : " + std::to_string(_params.size()) + " tensors, " + std::to_string(nElements) + " elements" + (withGrads ? " (with gradients)" : ""));
+}
+
+const torch::Tensor& ParameterArena::getFlatParams() const {
+  return _flatParams;
+}
+
+const torch::Tensor& ParameterArena::getFlatGrads() const {
+  return _flatGrads;
+}
+
+const std::vector<ParameterArena::Segment>& ParameterArena::getSegments() const {
+  return _segments;
+}
+
+const std::vector<torch::Tensor>& ParameterArena::getParams() const {
+  return _params;
+}
+
+const std::vector<torch::Tensor>& ParameterArena::getBuffers() const {
+  return _buffers;
+}
+
+void ParameterArena::zeroGrad() {
+  if (_flatGrads.defined()) {
+    _flatGrads.zero_();
+  }
+}
+
+double ParameterArena::gradNorm() const {
+  if (!_flatGrads.defined()) {
+    return 0.0;
+  }
+
+  return _flatGrads.norm().item<double>();
+}
+
+util::NamedTensors ParameterArena::snapshot() const {
+  torch::NoGradGuard no_grad;
+
+  const torch::Tensor& flatParams = _flatParams.to(torch::kCPU, _flatParams.scalar_type(), false, true);
+
+  util::NamedTensors tensors;
+
+  for (size_t i = 0; i < _segments.size(); ++i) {
+    tensors.emplace_back(_segments[i].name, flatParams.narrow(0, _segments[i].offset, _segments[i].numel).view(_params[i].sizes()));
+  }
+
+  for (size_t i = 0; i < _buffers.size(); ++i) {
+    tensors.emplace_back(_bufferNames[i], _buffers[i].to(torch::kCPU, _buffers[i].scalar_type(), false, true));
+  }
+
+  return tensors;
+}
+
+torch::Tensor ParameterArena::flatten(const std::unordered_map<std::string, torch::Tensor>& tensors) const {
+  torch::NoGradGuard no_grad;
+
+  torch::Tensor flat = torch::zeros_like(_flatParams);
+
+  for (size_t i = 0; i < _segments.size(); ++i) {
+    const auto iter = tensors.find(_segments[i].name);
+    TORCH_CHECK(iter != tensors.end(), "Missing tensor '" + _segments[i].name + "'");
+
+    flat.narrow(0, _segments[i].offset, _segments[i].numel).copy_(iter->second.flatten());
+  }
+
+  return flat;
+}
+
+}  // namespace dmcpp::trainer
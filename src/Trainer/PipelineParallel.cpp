@@ -0,0 +1,372 @@
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
+#include <DiffusionModelC++/Trainer/PipelineParallel.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace dmcpp::trainer {
+
+namespace {
+
+// Tensors are sent as a header [nDims, sizes...] followed by the data
+constexpr int64_t kHeaderSize = 8;
+
+torch::Tensor gradOrZeros(const torch::Tensor& tensor) {
+  return tensor.grad().defined() ? tensor.grad() : torch::zeros_like(tensor);
+}
+
+}  // namespace
+
+PipelineParallel::PipelineParallel(std::shared_ptr<distributed::ProcessGroup> processGroup,
+                                   diffusion::KarrasDiffusion& model,
+                                   int64_t microBatchSize)
+    : _processGroup(std::move(processGroup)),
+      _model(model),
+      _innerModel(model->getInnerModel()),
+      _microBatchSize(microBatchSize),
+      _nDepth(static_cast<int>(_innerModel->_uNet->_downBlocks->size())),
+      _stageBoundaries(),
+      _stagePrefixes(),
+      _options(model->parameters().front().options()),
+      _inFlight(),
+      _lossSum() {
+  const int nStages = getNumStages();
+  const int nBlocks = 2 * _nDepth;
+
+  if (nBlocks < nStages) {
+    LOG_CRITICAL("Pipeline parallelism needs at least one UNet block per stage, got " + std::to_string(nBlocks) + " blocks for " + std::to_string(nStages) + " stages");
+    exit(EXIT_FAILURE);
+  }
+
+  // Cost of each block: the parameter count weighted by the number of pixels at its level, a proxy for conv FLOPs
+  std::vector<double> prefixCost(nBlocks + 1, 0.0);
+
+  for (int block = 0; block < nBlocks; ++block) {
+    const bool isDown = block < _nDepth;
+    const int level = isDown ? block : nBlocks - 1 - block;
+    const auto& module = isDown ? _innerModel->_uNet->_downBlocks[block] : _innerModel->_uNet->_upBlocks[block - _nDepth];
+
+    int64_t numel = 0;
+
+    for (const auto& param : module->parameters()) {
+      numel += param.numel();
+    }
+
+    prefixCost[block + 1] = prefixCost[block] + static_cast<double>(numel) / std::pow(4.0, level);
+  }
+
+  // Cut closest to an even share of the cost, leaving at least one block for every stage
+  _stageBoundaries.assign(nStages + 1, nBlocks);
+  _stageBoundaries[0] = 0;
+
+  for (int stage = 1; stage < nStages; ++stage) {
+    const double target = prefixCost[nBlocks] * stage / nStages;
+
+    int boundary = _stageBoundaries[stage - 1] + 1;
+
+    while (boundary < nBlocks - (nStages - stage) &&
+           std::abs(prefixCost[boundary + 1] - target) < std::abs(prefixCost[boundary] - target)) {
+      ++boundary;
+    }
+
+    _stageBoundaries[stage] = boundary;
+  }
+
+  // Parameter ownership
+  _stagePrefixes.resize(nStages);
+  _stagePrefixes.front() = {"innerModel.timestepEmbed", "innerModel.mappingCond", "innerModel.mapping", "innerModel.inProj"};
+  _stagePrefixes.back().push_back("innerModel.outProj");
+
+  for (int block = 0; block < nBlocks; ++block) {
+    _stagePrefixes[getBlockStage(block)].push_back(block < _nDepth
+                                                       ? "innerModel.uNet.downBlocks." + std::to_string(block)
+                                                       : "innerModel.uNet.upBlocks." + std::to_string(block - _nDepth));
+  }
+
+  size_t nOwned = 0;
+
+  for (int stage = 0; stage < nStages; ++stage) {
+    nOwned += getStageParameters(*_model, stage).size();
+  }
+
+  TORCH_CHECK(nOwned == _model->parameters().size(), "Every parameter must belong to exactly one pipeline stage");
+
+  const int stage = getStage();
+  const double share = (prefixCost[_stageBoundaries[stage + 1]] - prefixCost[_stageBoundaries[stage]]) / prefixCost[nBlocks];
+
+  LOG_INFO("Pipeline stage " + std::to_string(stage) + " / " + std::to_string(nStages) + " : blocks [" + std::to_string(_stageBoundaries[stage]) + ", " +
+           std::to_string(_stageBoundaries[stage + 1]) + ") of " + std::to_string(nBlocks) + ", " + std::to_string(share * 100.0) + " [%] of the estimated cost");
+}
+
+int PipelineParallel::getStage() const {
+  return _processGroup->getRank();
+}
+
+int PipelineParallel::getNumStages() const {
+  return _processGroup->getWorldSize();
+}
+
+bool PipelineParallel::isLastStage() const {
+  return getStage() == getNumStages() - 1;
+}
+
+std::vector<torch::Tensor> PipelineParallel::getStageParameters(torch::nn::Module& module, int stage) const {
+  const std::vector<std::string>& prefixes = _stagePrefixes[stage < 0 ? getStage() : stage];
+
+  std::vector<torch::Tensor> params;
+
+  for (const auto& item : module.named_parameters()) {
+    for (const std::string& prefix : prefixes) {
+      if (item.key().rfind(prefix + ".", 0) == 0) {
+        params.push_back(item.value());
+        break;
+      }
+    }
+  }
+
+  return params;
+}
+
+torch::Tensor PipelineParallel::forwardBackward(const torch::Tensor& image,
+                                                const torch::Tensor& noise,
+                                                const torch::Tensor& sigma,
+                                                double lossScale) {
+  const int64_t nStages = getNumStages();
+  const int64_t batchSize = image.size(0);
+  const int64_t microBatchSize = _microBatchSize > 0 ? std::min(_microBatchSize, batchSize)
+                                                     : std::max<int64_t>(1, (batchSize + 2 * nStages - 1) / (2 * nStages));
+  const int64_t nMicroBatches = (batchSize + microBatchSize - 1) / microBatchSize;
+  const int64_t nWarmup = std::min<int64_t>(nStages - getStage() - 1, nMicroBatches);
+
+  _lossSum = torch::zeros({}, _options);
+
+  const auto forward = [&](int64_t iMicroBatch) {
+    const int64_t offset = iMicroBatch * microBatchSize;
+    const int64_t length = std::min(microBatchSize, batchSize - offset);
+
+    forwardMicroBatch(image.narrow(0, offset, length), noise.narrow(0, offset, length), sigma.narrow(0, offset, length), lossScale);
+  };
+
+  // 1F1B: warm-up forwards, then one forward and one backward each, then the remaining backwards
+  for (int64_t iMicroBatch = 0; iMicroBatch < nWarmup; ++iMicroBatch) {
+    forward(iMicroBatch);
+  }
+
+  for (int64_t iMicroBatch = nWarmup; iMicroBatch < nMicroBatches; ++iMicroBatch) {
+    forward(iMicroBatch);
+    backwardMicroBatch();
+  }
+
+  while (!_inFlight.empty()) {
+    backwardMicroBatch();
+  }
+
+  _processGroup->flush();
+
+  return _lossSum;
+}
+
+void PipelineParallel::forwardMicroBatch(const torch::Tensor& image,
+                                         const torch::Tensor& noise,
+                                         const torch::Tensor& sigma,
+                                         double lossScale) {
+  const int stage = getStage();
+  const int firstBlock = _stageBoundaries[stage];
+  const int lastBlock = _stageBoundaries[stage + 1];
+  const int64_t b = image.size(0);
+
+  MicroBatch microBatch;
+
+  // NOTE: Mirrors KarrasDiffusionImpl::loss and ImageUNetModelImpl::forward without extra conditions
+  const torch::Tensor& noisedInput = image + noise * sigma.view({b, 1, 1, 1});
+
+  torch::Tensor cSkip, cOut, cIn;
+  _model->getScaling(sigma, cSkip, cOut, cIn);
+
+  model::ConditionContext conditionCtx;
+  conditionCtx.sigma = sigma;
+
+  // Skip features from earlier stages, in production order (the last consumer block first)
+  std::unordered_map<int, torch::Tensor> skips;
+
+  for (int block = lastBlock - 1; block >= firstBlock; --block) {
+    const int producer = getSkipProducer(block);
+
+    if (producer >= 0 && getBlockStage(producer) != stage) {
+      torch::Tensor skip = recvTensor(getBlockStage(producer)).requires_grad_(true);
+      microBatch.skipInputs.emplace_back(producer, skip);
+      skips[block] = skip;
+    }
+  }
+
+  torch::Tensor x;
+
+  if (stage == 0) {
+    torch::Tensor noiseCond = _innerModel->_timestepEmbed->forward((sigma.log() / 4.0).view({b, 1}));
+    microBatch.condition = _innerModel->_mapping->forward(noiseCond);
+
+    x = model::tunedConv2d(*_innerModel->_inProj, (noisedInput * cIn.view({b, 1, 1, 1})).contiguous());
+  } else {
+    microBatch.xInput = recvTensor(stage - 1).requires_grad_(true);
+    microBatch.condition = recvTensor(stage - 1).requires_grad_(true);
+
+    x = microBatch.xInput;
+  }
+
+  conditionCtx.condition = microBatch.condition;
+
+  for (int block = firstBlock; block < lastBlock; ++block) {
+    if (block < _nDepth) {
+      x = _innerModel->_uNet->_downBlocks[block]->as<model::DownBlock>()->forward(x, conditionCtx);
+
+      const int consumer = getSkipConsumer(block);
+
+      if (consumer >= 0) {
+        if (getBlockStage(consumer) == stage) {
+          skips[consumer] = x;
+        } else {
+          sendTensor(x, getBlockStage(consumer));
+          microBatch.skipOutputs.emplace_back(consumer, x);
+        }
+      }
+    } else {
+      const int iUpBlock = block - _nDepth;
+      auto* upBlock = _innerModel->_uNet->_upBlocks[iUpBlock]->as<model::UpBlock>();
+
+      x = iUpBlock == 0 ? upBlock->forward(x, conditionCtx) : upBlock->forward(x, conditionCtx, skips.at(block));
+    }
+  }
+
+  if (isLastStage()) {
+    torch::Tensor output = model::tunedConv2d(*_innerModel->_outProj, x);
+
+    if (_innerModel->_hasVariance) {
+      output = output.narrow(1, 0, output.size(1) - 1);
+    }
+
+    const torch::Tensor& denoised = output * cOut.view({b, 1, 1, 1}) + noisedInput * cSkip.view({b, 1, 1, 1});
+    const torch::Tensor& eps = diffusion::KarrasDiffusionImpl::toD(noisedInput, sigma, denoised);
+
+    microBatch.loss = (eps - noise).pow(2).flatten(1).mean(1).sum() * lossScale;
+    _lossSum += microBatch.loss.detach();
+  } else {
+    microBatch.xOutput = x;
+
+    sendTensor(x, stage + 1);
+    sendTensor(microBatch.condition, stage + 1);
+  }
+
+  _inFlight.push_back(std::move(microBatch));
+}
+
+void PipelineParallel::backwardMicroBatch() {
+  const int stage = getStage();
+
+  MicroBatch microBatch = std::move(_inFlight.front());
+  _inFlight.pop_front();
+
+  if (isLastStage()) {
+    microBatch.loss.backward();
+  } else {
+    // Gradients in the order the features were sent. A feature sent twice (the last down block of a stage)
+    // is a single root with the sum of its gradients.
+    std::vector<torch::Tensor> roots;
+    std::vector<torch::Tensor> grads;
+
+    const auto addRoot = [&roots, &grads](const torch::Tensor& root, const torch::Tensor& grad) {
+      for (size_t i = 0; i < roots.size(); ++i) {
+        if (roots[i].is_same(root)) {
+          grads[i] = grads[i] + grad;
+          return;
+        }
+      }
+
+      roots.push_back(root);
+      grads.push_back(grad);
+    };
+
+    for (const auto& skipOutput : microBatch.skipOutputs) {
+      addRoot(skipOutput.second, recvTensor(getBlockStage(skipOutput.first)));
+    }
+
+    addRoot(microBatch.xOutput, recvTensor(stage + 1));
+    addRoot(microBatch.condition, recvTensor(stage + 1));
+
+    torch::autograd::backward(roots, grads);
+  }
+
+  if (stage > 0) {
+    for (const auto& skipInput : microBatch.skipInputs) {
+      sendTensor(gradOrZeros(skipInput.second), getBlockStage(skipInput.first));
+    }
+
+    sendTensor(gradOrZeros(microBatch.xInput), stage - 1);
+    sendTensor(gradOrZeros(microBatch.condition), stage - 1);
+  }
+}
+
+void PipelineParallel::sendTensor(const torch::Tensor& tensor, int dstRank) {
+  TORCH_CHECK(tensor.dim() < kHeaderSize, "Too many dimensions to send");
+  TORCH_CHECK(tensor.dtype() == _options.dtype(), "Pipeline activations must have the dtype of the model");
+
+  torch::Tensor header = torch::zeros({kHeaderSize}, torch::kInt64);
+  int64_t* headerPtr = header.data_ptr<int64_t>();
+
+  headerPtr[0] = tensor.dim();
+
+  for (int64_t i = 0; i < tensor.dim(); ++i) {
+    headerPtr[i + 1] = tensor.size(i);
+  }
+
+  _processGroup->isend(header, dstRank);
+  _processGroup->isend(tensor.detach(), dstRank);
+}
+
+torch::Tensor PipelineParallel::recvTensor(int srcRank) {
+  torch::Tensor header = torch::zeros({kHeaderSize}, torch::kInt64);
+  _processGroup->recv(header, srcRank);
+
+  const int64_t* headerPtr = header.data_ptr<int64_t>();
+  const std::vector<int64_t> sizes(headerPtr + 1, headerPtr + 1 + headerPtr[0]);
+
+  torch::Tensor tensor = torch::empty(sizes, _options);
+  _processGroup->recv(tensor, srcRank);
+
+  return tensor;
+}
+
+void PipelineParallel::gatherParameters(torch::nn::Module& module) {
+  torch::NoGradGuard no_grad;
+
+  const int rank = _processGroup->getRank();
+
+  for (int stage = 1; stage < getNumStages(); ++stage) {
+    if (rank != 0 && rank != stage) {
+      continue;
+    }
+
+    for (torch::Tensor param : getStageParameters(module, stage)) {
+      if (rank == 0) {
+        _processGroup->recv(param, stage);
+      } else {
+        _processGroup->send(param, 0);
+      }
+    }
+  }
+}
+
+int PipelineParallel::getBlockStage(int block) const {
+  return static_cast<int>(std::upper_bound(_stageBoundaries.begin(), _stageBoundaries.end(), block) - _stageBoundaries.begin()) - 1;
+}
+
+int PipelineParallel::getSkipProducer(int block) const {
+  // Up block i > 0 takes the output of down block (nDepth - 1 - i), the deepest up block none
+  return block > _nDepth ? 2 * _nDepth - 1 - block : -1;
+}
+
+int PipelineParallel::getSkipConsumer(int block) const {
+  return block < _nDepth - 1 ? 2 * _nDepth - 1 - block : -1;
+}
+
+}  // namespace dmcpp::trainer
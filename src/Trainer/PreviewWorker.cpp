@@ -0,0 +1,160 @@
+#include <ATen/CPUGeneratorImpl.h>
+#include <omp.h>
+
+#include <DiffusionModelC++/Diffusion/Sampler.hpp>
+#include <DiffusionModelC++/Trainer/PreviewWorker.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/ImageUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <chrono>
+
+namespace dmcpp::trainer {
+
+PreviewWorker::PreviewWorker(const config::Config& config, const torch::Device& device)
+    : _config(config),
+      _device(device),
+      _generator(at::detail::createCPUGenerator(static_cast<uint64_t>(config.seed))),
+      _thread(),
+      _mutex(),
+      _condition(),
+      _hasJob(false),
+      _isBusy(false),
+      _toStop(false),
+      _step(0),
+      _nSkipped(0) {
+  // NOTE: The weights are copied from the EMA model on every submit
+  _model = getDiffusionModel(config, true);
+  _model->to(_device);
+  _model->eval();
+
+  for (auto& param : _model->parameters()) {
+    param.set_requires_grad(false);
+  }
+
+  _thread = std::thread(&PreviewWorker::run, this);
+}
+
+PreviewWorker::~PreviewWorker() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _toStop = true;
+  }
+
+  _condition.notify_all();
+  _thread.join();
+}
+
+bool PreviewWorker::submit(diffusion::KarrasDiffusion& emaModel, int64_t step) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_hasJob || _isBusy) {
+      ++_nSkipped;
+      LOG_WARN("Preview of step " + std::to_string(step) + " is skipped, the previous one is still rendering.");
+      return false;
+    }
+  }
+
+  // Snapshot the EMA weights, the worker is idle so nobody reads them meanwhile
+  {
+    torch::NoGradGuard no_grad;
+
+    const auto& srcParams = emaModel->parameters();
+    const auto& dstParams = _model->parameters();
+
+    for (size_t i = 0; i < srcParams.size(); ++i) {
+      dstParams[i].copy_(srcParams[i]);
+    }
+
+    const auto& srcBuffers = emaModel->buffers();
+    const auto& dstBuffers = _model->buffers();
+
+    for (size_t i = 0; i < srcBuffers.size(); ++i) {
+      dstBuffers[i].copy_(srcBuffers[i]);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _hasJob = true;
+    _step = step;
+  }
+
+  _condition.notify_all();
+
+  return true;
+}
+
+void PreviewWorker::wait() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _condition.wait(lock, [this]() { return !_hasJob && !_isBusy; });
+}
+
+int64_t PreviewWorker::getNumSkipped() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _nSkipped;
+}
+
+void PreviewWorker::run() {
+  // NOTE: The OpenMP thread count is per thread, so this does not change the budget of the training thread
+  omp_set_num_threads(static_cast<int>(std::max<int64_t>(1, _config.previewThreads)));
+
+  while (true) {
+    int64_t step;
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _condition.wait(lock, [this]() { return _hasJob || _toStop; });
+
+      if (_toStop && !_hasJob) {
+        break;
+      }
+
+      _hasJob = false;
+      _isBusy = true;
+      step = _step;
+    }
+
+    try {
+      render(step);
+    } catch (const std::exception& e) {
+      LOG_ERROR("Failed to render preview of step " + std::to_string(step) + " : " + e.what());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _isBusy = false;
+    }
+
+    _condition.notify_all();
+  }
+}
+
+void PreviewWorker::render(int64_t step) {
+  torch::NoGradGuard no_grad;
+
+  const auto startTime = std::chrono::high_resolution_clock::now();
+
+  // NOTE: Same noise for every preview, so that previews are comparable across steps
+  {
+    std::lock_guard<std::mutex> lock(_generator.mutex());
+    _generator.set_current_seed(static_cast<uint64_t>(_config.seed));
+  }
+
+  const torch::Tensor& x = torch::randn({_config.nSamples, _config.model.inChannels, _config.imageSize, _config.imageSize}, _generator).to(_device) * _config.sampler.sigmaMax;
+  const torch::Tensor& sigmas = diffusion::getSigmasKarras(50, _config.sampler.sigmaMin, _config.sampler.sigmaMax, 7.0, _device);
+  const torch::Tensor& sampled = diffusion::sample_heun(_model, x, sigmas, 0.0f, 0.0f, std::numeric_limits<float>::infinity(), 1.0f, _config.sampler.featureCacheInterval, _generator);
+
+  const std::string sampleDirPath = util::FileUtil::join(util::FileUtil::join(_config.logDir, "sampled"), "step=" + std::to_string(step));
+  util::FileUtil::mkdirs(sampleDirPath);
+
+  for (int64_t iImage = 0; iImage < _config.nSamples; ++iImage) {
+    const std::string& filePath = util::FileUtil::join(sampleDirPath, "sample_" + std::to_string(iImage) + ".png");
+    const cv::Mat& image = util::tensorToCv2Mat(sampled[iImage]);
+    util::saveImage(image, filePath);
+  }
+
+  LOG_INFO("Preview of step " + std::to_string(step) + " written to " + sampleDirPath + " in " + std::to_string(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count()) + " [sec]");
+}
+
+}  // namespace dmcpp::trainer
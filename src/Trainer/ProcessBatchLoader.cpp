@@ -0,0 +1,402 @@
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Trainer/ProcessBatchLoader.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+namespace dmcpp::trainer {
+
+namespace {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory counters must be lock-free");
+static_assert(sizeof(size_t) == sizeof(uint64_t), "Sample indices are stored as uint64");
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Spin briefly, then back off to short sleeps. `onSlow` is called every second or so while waiting.
+template <typename Predicate, typename OnSlow>
+void waitUntil(const Predicate& predicate, const OnSlow& onSlow) {
+  for (int64_t iSpin = 0; !predicate(); ++iSpin) {
+    if (iSpin < 256) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    if (iSpin % 10000 == 0) {
+      onSlow();
+    }
+  }
+}
+
+// Integer environment variable, or `defaultValue` when it is not set or not a number
+int getEnvInt(const char* name, int defaultValue) {
+  const char* text = std::getenv(name);
+
+  if (text == nullptr) {
+    return defaultValue;
+  }
+
+  char* end = nullptr;
+  const long value = std::strtol(text, &end, 10);
+
+  return end != text && *end == '\0' ? static_cast<int>(value) : defaultValue;
+}
+
+// The cores of this process's affinity mask that belong to this local rank. Local ranks started on the same
+// machine inherit the same mask, so it is split into LOCAL_WORLD_SIZE contiguous ranges, one per LOCAL_RANK.
+std::vector<int> getLocalCores() {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  sched_getaffinity(0, sizeof(cpuSet), &cpuSet);
+
+  std::vector<int> cores;
+
+  for (int iCore = 0; iCore < CPU_SETSIZE; ++iCore) {
+    if (CPU_ISSET(iCore, &cpuSet)) {
+      cores.push_back(iCore);
+    }
+  }
+
+  const int localWorldSize = getEnvInt("LOCAL_WORLD_SIZE", 1);
+  const int localRank = getEnvInt("LOCAL_RANK", 0);
+
+  // NOTE: With more local ranks than cores, the ranks share the whole mask
+  if (localWorldSize <= 1 || localRank < 0 || localRank >= localWorldSize || cores.size() < static_cast<size_t>(localWorldSize)) {
+    return cores;
+  }
+
+  const size_t begin = cores.size() * localRank / localWorldSize;
+  const size_t end = cores.size() * (localRank + 1) / localWorldSize;
+
+  return std::vector<int>(cores.begin() + static_cast<std::ptrdiff_t>(begin), cores.begin() + static_cast<std::ptrdiff_t>(end));
+}
+
+// sched_setaffinity only applies to one thread, so the mask is set on every thread of the process. This covers
+// the intra-op pool threads that already exist; threads created later inherit the mask of their creator.
+void setProcessAffinity(const cpu_set_t& cpuSet) {
+  std::error_code error;
+
+  for (const auto& entry : std::filesystem::directory_iterator("/proc/self/task", error)) {
+    char* end = nullptr;
+    const std::string name = entry.path().filename().string();
+    const long tid = std::strtol(name.c_str(), &end, 10);
+
+    if (end != name.c_str() && *end == '\0') {
+      sched_setaffinity(static_cast<pid_t>(tid), sizeof(cpuSet), &cpuSet);
+    }
+  }
+
+  if (error) {
+    sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
+  }
+}
+
+}  // namespace
+
+// ====================================================================================================
+// Shared region
+// ====================================================================================================
+// [control of each worker][slots]. A slot holds the number of indices, the indices and the batch data.
+class ProcessBatchLoader::SharedRegion {
+ public:
+  struct alignas(64) WorkerControl {
+    std::atomic<uint64_t> nRequested;  // Written by the trainer
+    std::atomic<uint64_t> nDone;       // Written by the worker
+    std::atomic<uint32_t> toStop;
+  };
+
+  SharedRegion(size_t nWorkers, size_t nSlots, size_t batchSize, size_t dataBytes)
+      : busy(std::make_unique<std::atomic<bool>[]>(nSlots)),
+        _base(nullptr),
+        _bytes(0),
+        _controlBytes(alignUp(nWorkers * sizeof(WorkerControl), 4096)),
+        _indexBytes(alignUp((batchSize + 1) * sizeof(uint64_t), 64)),
+        _slotBytes(alignUp(_indexBytes + dataBytes, 4096)) {
+    _bytes = _controlBytes + nSlots * _slotBytes;
+
+    // NOTE: Anonymous shared mappings are inherited by forked children, so no name is needed
+    void* base = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+      LOG_CRITICAL("Failed to map " + std::to_string(_bytes) + " bytes of shared memory : " + std::strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    _base = static_cast<uint8_t*>(base);
+
+    for (size_t iWorker = 0; iWorker < nWorkers; ++iWorker) {
+      WorkerControl* control = new (_base + iWorker * sizeof(WorkerControl)) WorkerControl();
+      control->nRequested.store(0);
+      control->nDone.store(0);
+      control->toStop.store(0);
+    }
+
+    for (size_t iSlot = 0; iSlot < nSlots; ++iSlot) {
+      busy[iSlot].store(false);
+    }
+  }
+
+  ~SharedRegion() {
+    munmap(_base, _bytes);
+  }
+
+  WorkerControl& getControl(size_t iWorker) {
+    return *reinterpret_cast<WorkerControl*>(_base + iWorker * sizeof(WorkerControl));
+  }
+
+  // The number of indices, then the indices
+  uint64_t* getIndices(size_t slot) {
+    return reinterpret_cast<uint64_t*>(_base + _controlBytes + slot * _slotBytes);
+  }
+
+  void* getData(size_t slot) {
+    return _base + _controlBytes + slot * _slotBytes + _indexBytes;
+  }
+
+  // Trainer side only: the slot holds a request or a batch that is still referenced
+  std::unique_ptr<std::atomic<bool>[]> busy;
+
+ private:
+  uint8_t* _base;
+  size_t _bytes;
+  size_t _controlBytes;
+  size_t _indexBytes;
+  size_t _slotBytes;
+};
+
+// ====================================================================================================
+// Process batch loader
+// ====================================================================================================
+
+ProcessBatchLoader::ProcessBatchLoader(GetBatchFunc getBatch,
+                                       ResumableRandomSampler sampler,
+                                       std::vector<int64_t> sampleShape,
+                                       size_t batchSize,
+                                       size_t nWorkers,
+                                       size_t slotsPerWorker)
+    : _region(),
+      _sampler(std::move(sampler)),
+      _batchShape(),
+      _batchSize(batchSize),
+      _nWorkers(std::max<size_t>(1, nWorkers)),
+      _slotsPerWorker(std::max<size_t>(2, slotsPerWorker)),
+      _workerPids(),
+      _nIssued(0),
+      _nConsumed(0),
+      _isExhausted(true) {
+  _batchShape.push_back(static_cast<int64_t>(_batchSize));
+  _batchShape.insert(_batchShape.end(), sampleShape.begin(), sampleShape.end());
+
+  const size_t dataBytes = static_cast<size_t>(c10::multiply_integers(_batchShape)) * sizeof(float);
+
+  _region = std::make_shared<SharedRegion>(_nWorkers, _nWorkers * _slotsPerWorker, _batchSize, dataBytes);
+
+  // Workers take the last cores of this local rank's share of the affinity mask, the trainer keeps the others
+  const std::vector<int>& cores = getLocalCores();
+
+  const bool toPin = _nWorkers < cores.size();
+
+  for (size_t iWorker = 0; iWorker < _nWorkers; ++iWorker) {
+    const int core = toPin ? cores[cores.size() - _nWorkers + iWorker] : -1;
+
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+      LOG_CRITICAL("Failed to fork a data loader worker : " + std::string(std::strerror(errno)));
+      exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+      work(iWorker, getBatch, core);
+    }
+
+    _workerPids.push_back(pid);
+  }
+
+  if (toPin) {
+    const size_t nTrainerCores = cores.size() - _nWorkers;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    for (size_t iCore = 0; iCore < nTrainerCores; ++iCore) {
+      CPU_SET(cores[iCore], &cpuSet);
+    }
+
+    setProcessAffinity(cpuSet);
+    torch::set_num_threads(static_cast<int>(nTrainerCores));
+
+    LOG_INFO("Started " + std::to_string(_nWorkers) + " data loader processes on their own cores, the trainer keeps " + std::to_string(nTrainerCores) + " cores");
+  } else {
+    LOG_WARN("Started " + std::to_string(_nWorkers) + " data loader processes, too many to give each its own core");
+  }
+}
+
+ProcessBatchLoader::~ProcessBatchLoader() {
+  for (size_t iWorker = 0; iWorker < _nWorkers; ++iWorker) {
+    _region->getControl(iWorker).toStop.store(1, std::memory_order_release);
+  }
+
+  for (const pid_t pid : _workerPids) {
+    waitpid(pid, nullptr, 0);
+  }
+}
+
+void ProcessBatchLoader::reset() {
+  // Let the workers finish the requests of the previous pass, then drop the batches nobody took
+  for (uint64_t sequence = _nConsumed; sequence < _nIssued; ++sequence) {
+    waitForBatch(sequence);
+    _region->busy[getSlot(sequence)].store(false, std::memory_order_release);
+  }
+
+  _nConsumed = _nIssued;
+
+  _sampler.reset();
+  _isExhausted = false;
+
+  issue();
+}
+
+torch::optional<torch::Tensor> ProcessBatchLoader::next() {
+  issue();
+
+  if (_nConsumed == _nIssued) {
+    TORCH_CHECK(_isExhausted, "All loader slots are still referenced, drop the previous batches before asking for more");
+    return torch::nullopt;
+  }
+
+  const uint64_t sequence = _nConsumed++;
+  const size_t slot = getSlot(sequence);
+
+  waitForBatch(sequence);
+
+  // NOTE: A view of the slot, which is released for the next request when the last reference goes away
+  const std::shared_ptr<SharedRegion> region = _region;
+
+  torch::Tensor batch = torch::from_blob(
+      _region->getData(slot),
+      _batchShape,
+      [region, slot](void*) { region->busy[slot].store(false, std::memory_order_release); },
+      torch::kFloat32);
+
+  issue();
+
+  return batch;
+}
+
+size_t ProcessBatchLoader::getSlot(uint64_t sequence) const {
+  const size_t iWorker = sequence % _nWorkers;
+  const size_t position = (sequence / _nWorkers) % _slotsPerWorker;
+
+  return iWorker * _slotsPerWorker + position;
+}
+
+void ProcessBatchLoader::issue() {
+  while (!_isExhausted) {
+    const size_t slot = getSlot(_nIssued);
+
+    if (_region->busy[slot].load(std::memory_order_acquire)) {
+      return;
+    }
+
+    const auto indices = _sampler.next(_batchSize);
+
+    // Incomplete batches are dropped
+    if (!indices.has_value() || indices->size() < _batchSize) {
+      _isExhausted = true;
+      return;
+    }
+
+    uint64_t* slotIndices = _region->getIndices(slot);
+    slotIndices[0] = indices->size();
+    std::memcpy(slotIndices + 1, indices->data(), indices->size() * sizeof(uint64_t));
+
+    _region->busy[slot].store(true, std::memory_order_relaxed);
+
+    const size_t iWorker = _nIssued % _nWorkers;
+    _region->getControl(iWorker).nRequested.store(_nIssued / _nWorkers + 1, std::memory_order_release);
+
+    ++_nIssued;
+  }
+}
+
+void ProcessBatchLoader::waitForBatch(uint64_t sequence) {
+  const size_t iWorker = sequence % _nWorkers;
+  const uint64_t nDone = sequence / _nWorkers + 1;
+  auto& control = _region->getControl(iWorker);
+
+  waitUntil(
+      [&]() { return control.nDone.load(std::memory_order_acquire) >= nDone; },
+      [&]() {
+        if (waitpid(_workerPids[iWorker], nullptr, WNOHANG) != 0) {
+          LOG_CRITICAL("Data loader worker " + std::to_string(iWorker) + " has exited");
+          exit(EXIT_FAILURE);
+        }
+      });
+}
+
+void ProcessBatchLoader::work(size_t iWorker, const GetBatchFunc& getBatch, int core) {
+  // Do not outlive the trainer
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+  if (core >= 0) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
+  }
+
+  // NOTE: One thread per worker. This also keeps the thread pools inherited from the parent, which are not
+  //       usable after fork, out of the way.
+  torch::set_num_threads(1);
+  cv::setNumThreads(1);
+
+  auto& control = _region->getControl(iWorker);
+  uint64_t nDone = 0;
+
+  try {
+    while (true) {
+      waitUntil(
+          [&]() { return control.toStop.load(std::memory_order_acquire) != 0 || control.nRequested.load(std::memory_order_acquire) > nDone; },
+          []() {});
+
+      if (control.toStop.load(std::memory_order_acquire) != 0) {
+        break;
+      }
+
+      const size_t slot = iWorker * _slotsPerWorker + nDone % _slotsPerWorker;
+      const uint64_t* slotIndices = _region->getIndices(slot);
+
+      const torch::ArrayRef<size_t> indices(reinterpret_cast<const size_t*>(slotIndices + 1), slotIndices[0]);
+      const torch::Tensor& batch = getBatch(indices).to(torch::kFloat32).contiguous();
+
+      TORCH_CHECK(batch.sizes() == torch::IntArrayRef(_batchShape), "Unexpected batch shape from the dataset");
+
+      std::memcpy(_region->getData(slot), batch.data_ptr<float>(), batch.numel() * sizeof(float));
+
+      control.nDone.store(++nDone, std::memory_order_release);
+    }
+  } catch (const std::exception& e) {
+    LOG_CRITICAL("Data loader worker " + std::to_string(iWorker) + " failed : " + e.what());
+    _exit(EXIT_FAILURE);
+  }
+
+  _exit(EXIT_SUCCESS);
+}
+
+}  // namespace dmcpp::trainer
@@ -0,0 +1,398 @@
+#include <DiffusionModelC++/Trainer/TarShardLoader.hpp>
+#include <DiffusionModelC++/Util/ImageUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+namespace dmcpp::trainer {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint64_t kTarBlockSize = 512;
+
+uint64_t parseTarNumber(const char* field, size_t length) {
+  // NOTE: GNU tar stores sizes that do not fit in octal as big-endian base-256, flagged by the high bit
+  if (static_cast<unsigned char>(field[0]) & 0x80) {
+    uint64_t value = 0;
+
+    for (size_t i = 1; i < length; ++i) {
+      value = (value << 8) | static_cast<unsigned char>(field[i]);
+    }
+
+    return value;
+  }
+
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < length && field[i] != '\0'; ++i) {
+    if (field[i] >= '0' && field[i] <= '7') {
+      value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    }
+  }
+
+  return value;
+}
+
+uint64_t getPadding(uint64_t size) {
+  return (kTarBlockSize - size % kTarBlockSize) % kTarBlockSize;
+}
+
+// "path" record of a pax extended header, or empty
+std::string parsePaxPath(const std::string& records) {
+  size_t offset = 0;
+
+  while (offset < records.size()) {
+    const size_t space = records.find(' ', offset);
+
+    if (space == std::string::npos) {
+      break;
+    }
+
+    // NOTE: Parsed by hand, since this runs on the worker threads where an exception would end the process
+    size_t length = 0;
+    bool isValid = space > offset && space - offset <= 9;
+
+    for (size_t i = offset; isValid && i < space; ++i) {
+      isValid = records[i] >= '0' && records[i] <= '9';
+      length = length * 10 + static_cast<size_t>(records[i] - '0');
+    }
+
+    // A malformed record ends the header, the entry then keeps its ustar name
+    if (!isValid || length < space - offset + 2 || offset + length > records.size()) {
+      break;
+    }
+
+    // "<length> <key>=<value>\n"
+    const std::string record = records.substr(space + 1, offset + length - space - 2);
+
+    if (record.rfind("path=", 0) == 0) {
+      return record.substr(5);
+    }
+
+    offset += length;
+  }
+
+  return "";
+}
+
+}  // namespace
+
+// ====================================================================================================
+// Tar reader
+// ====================================================================================================
+
+TarReader::TarReader(const std::string& filePath, size_t bufferBytes)
+    : _buffer(bufferBytes),
+      _file() {
+  // NOTE: The buffer has to be installed before opening the file
+  _file.rdbuf()->pubsetbuf(_buffer.data(), static_cast<std::streamsize>(_buffer.size()));
+  _file.open(filePath, std::ios::binary);
+}
+
+bool TarReader::isOpen() const {
+  return _file.is_open();
+}
+
+bool TarReader::readHeader(std::string& name, uint64_t& size) {
+  std::string longName;
+  char header[kTarBlockSize];
+
+  while (_file.read(header, kTarBlockSize)) {
+    // Two zero blocks end the archive
+    if (header[0] == '\0') {
+      return false;
+    }
+
+    size = parseTarNumber(header + 124, 12);
+    const char typeFlag = header[156];
+
+    if (typeFlag == 'L' || typeFlag == 'x') {
+      // GNU long name or pax extended header of the next member
+      std::string data(size, '\0');
+      _file.read(data.data(), static_cast<std::streamsize>(size));
+      _file.ignore(static_cast<std::streamsize>(getPadding(size)));
+
+      longName = typeFlag == 'L' ? std::string(data.c_str()) : parsePaxPath(data);
+      continue;
+    }
+
+    if (typeFlag != '0' && typeFlag != '\0') {
+      // Directories, links and global headers
+      _file.seekg(static_cast<std::streamoff>(size + getPadding(size)), std::ios::cur);
+      longName.clear();
+      continue;
+    }
+
+    if (!longName.empty()) {
+      name = longName;
+    } else {
+      name = std::string(header, strnlen(header, 100));
+
+      // ustar splits long names into a prefix and a name
+      if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+        name = std::string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+      }
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+bool TarReader::next(std::string& name, std::vector<uchar>& data) {
+  uint64_t size = 0;
+
+  if (!readHeader(name, size)) {
+    return false;
+  }
+
+  data.resize(size);
+
+  if (!_file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(size))) {
+    return false;
+  }
+
+  _file.ignore(static_cast<std::streamsize>(getPadding(size)));
+
+  return true;
+}
+
+bool TarReader::skip(std::string& name) {
+  uint64_t size = 0;
+
+  if (!readHeader(name, size)) {
+    return false;
+  }
+
+  return static_cast<bool>(_file.seekg(static_cast<std::streamoff>(size + getPadding(size)), std::ios::cur));
+}
+
+std::vector<std::string> listTarShards(const std::string& root) {
+  return listImageFiles(root, ".tar");
+}
+
+// ====================================================================================================
+// Tar shard loader
+// ====================================================================================================
+
+TarShardLoader::TarShardLoader(const std::string& root,
+                               const int& imageWidth,
+                               const int& imageHeight,
+                               const std::string& extension,
+                               size_t batchSize,
+                               size_t nWorkers,
+                               size_t shuffleBuffer,
+                               std::shared_ptr<SamplerPosition> position,
+                               uint64_t seed,
+                               int rank,
+                               int worldSize)
+    : _imageWidth(imageWidth),
+      _imageHeight(imageHeight),
+      _extension(extension),
+      _batchSize(batchSize),
+      _shuffleBuffer(),
+      _position(std::move(position)),
+      _seed(seed),
+      _rank(rank),
+      _nImages(0),
+      _nBatchesPerEpoch(0),
+      _nBatchesLeft(0),
+      _batches(),
+      _maxQueuedBatches(),
+      _mutex(),
+      _notEmpty(),
+      _notFull(),
+      _toStop(false),
+      _workers() {
+  const std::vector<std::string>& shardPaths = listTarShards(root);
+  const int64_t nShards = static_cast<int64_t>(shardPaths.size());
+
+  if (nShards < worldSize) {
+    LOG_CRITICAL("Found " + std::to_string(nShards) + " tar shards in " + root + ", at least one per rank is needed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Count the images of all shards, which only seeks over the member data
+  int64_t nImages = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+ : nImages)
+  for (int64_t iShard = 0; iShard < nShards; ++iShard) {
+    TarReader reader(shardPaths[iShard], kTarBlockSize * 8);
+    std::string name;
+
+    while (reader.skip(name)) {
+      if (fs::path(name).extension() == extension) {
+        ++nImages;
+      }
+    }
+  }
+
+  _nImages = nImages;
+  _nBatchesPerEpoch = _nImages / static_cast<int64_t>(worldSize * _batchSize);
+
+  LOG_INFO("Found " + std::to_string(_nImages) + " images in " + std::to_string(nShards) + " tar shards in " + root);
+
+  // NOTE: An epoch without batches would never end the training loop
+  if (_nBatchesPerEpoch == 0) {
+    LOG_CRITICAL("Not enough images in " + root + " for a batch of " + std::to_string(_batchSize) + " on each of " + std::to_string(worldSize) + " ranks");
+    exit(EXIT_FAILURE);
+  }
+
+  // Deal the shards to the ranks, then to the workers
+  std::vector<std::string> rankShardPaths;
+
+  for (int64_t iShard = rank; iShard < nShards; iShard += worldSize) {
+    rankShardPaths.push_back(shardPaths[iShard]);
+  }
+
+  nWorkers = std::clamp<size_t>(nWorkers, 1, rankShardPaths.size());
+
+  _shuffleBuffer = std::max<size_t>(1, shuffleBuffer / nWorkers);
+  _maxQueuedBatches = 2 * nWorkers;
+
+  for (size_t iWorker = 0; iWorker < nWorkers; ++iWorker) {
+    std::vector<std::string> workerShardPaths;
+
+    for (size_t iShard = iWorker; iShard < rankShardPaths.size(); iShard += nWorkers) {
+      workerShardPaths.push_back(rankShardPaths[iShard]);
+    }
+
+    _workers.emplace_back(&TarShardLoader::work, this, iWorker, std::move(workerShardPaths));
+  }
+}
+
+TarShardLoader::~TarShardLoader() {
+  // NOTE: Set under the lock, so a worker cannot check the predicate in push() and then miss the notification
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _toStop = true;
+  }
+
+  _notFull.notify_all();
+
+  for (auto& worker : _workers) {
+    worker.join();
+  }
+}
+
+void TarShardLoader::reset() {
+  const int64_t nSeenBatches = _position->index / static_cast<int64_t>(_batchSize);
+  _nBatchesLeft = std::max<int64_t>(0, _nBatchesPerEpoch - nSeenBatches);
+}
+
+torch::optional<torch::Tensor> TarShardLoader::next() {
+  if (_nBatchesLeft <= 0) {
+    return torch::nullopt;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _notEmpty.wait(lock, [this]() { return !_batches.empty(); });
+
+  torch::Tensor batch = std::move(_batches.front());
+  _batches.pop_front();
+  --_nBatchesLeft;
+
+  lock.unlock();
+  _notFull.notify_one();
+
+  return batch;
+}
+
+int64_t TarShardLoader::getNumImages() const {
+  return _nImages;
+}
+
+int64_t TarShardLoader::getNumBatchesPerEpoch() const {
+  return _nBatchesPerEpoch;
+}
+
+void TarShardLoader::push(torch::Tensor batch) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _notFull.wait(lock, [this]() { return _toStop || _batches.size() < _maxQueuedBatches; });
+
+  if (_toStop) {
+    return;
+  }
+
+  _batches.push_back(std::move(batch));
+
+  lock.unlock();
+  _notEmpty.notify_one();
+}
+
+void TarShardLoader::work(size_t iWorker, std::vector<std::string> shardPaths) {
+  std::seed_seq seedSeq{_seed, static_cast<uint64_t>(_rank), static_cast<uint64_t>(iWorker)};
+  std::mt19937_64 generator(seedSeq);
+  std::uniform_int_distribution<size_t> pickBuffered(0, _shuffleBuffer - 1);
+
+  std::vector<cv::Mat> shuffleBuffer;
+  std::vector<cv::Mat> images;
+  std::string name;
+  std::vector<uchar> data;
+
+  while (!_toStop) {
+    std::shuffle(shardPaths.begin(), shardPaths.end(), generator);
+
+    int64_t nDecoded = 0;
+
+    for (const std::string& shardPath : shardPaths) {
+      TarReader reader(shardPath);
+
+      if (!reader.isOpen()) {
+        LOG_ERROR("Could not open " + shardPath);
+        continue;
+      }
+
+      while (!_toStop && reader.next(name, data)) {
+        if (fs::path(name).extension() != _extension) {
+          continue;
+        }
+
+        cv::Mat image = cv::imdecode(data, cv::IMREAD_COLOR);
+
+        if (image.empty()) {
+          LOG_WARN("Could not decode " + name + " in " + shardPath);
+          continue;
+        }
+
+        image = util::resize(image, _imageWidth, _imageHeight);
+        ++nDecoded;
+
+        if (shuffleBuffer.size() < _shuffleBuffer) {
+          shuffleBuffer.push_back(std::move(image));
+          continue;
+        }
+
+        std::swap(shuffleBuffer[pickBuffered(generator)], image);
+        images.push_back(std::move(image));
+
+        if (images.size() == _batchSize) {
+          torch::Tensor batch = torch::empty({static_cast<int64_t>(_batchSize), 3, _imageHeight, _imageWidth});
+
+          for (size_t iImage = 0; iImage < images.size(); ++iImage) {
+            batch[static_cast<int64_t>(iImage)].copy_(util::cv2MatToTensor(images[iImage]));
+          }
+
+          images.clear();
+          push(std::move(batch));
+        }
+      }
+
+      if (_toStop) {
+        return;
+      }
+    }
+
+    if (nDecoded == 0) {
+      LOG_CRITICAL("No " + _extension + " images could be read from the tar shards of worker " + std::to_string(iWorker));
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+}  // namespace dmcpp::trainer
@@ -1,9 +1,16 @@
+#include <DiffusionModelC++/Model/ConvAutotuner.hpp>
+#include <DiffusionModelC++/Trainer/DatasetManifest.hpp>
 #include <DiffusionModelC++/Trainer/LRScheduler.hpp>
+#include <DiffusionModelC++/Trainer/Optimizer.hpp>
+#include <DiffusionModelC++/Trainer/PackedDataset.hpp>
+#include <DiffusionModelC++/Trainer/ProcessBatchLoader.hpp>
+#include <DiffusionModelC++/Trainer/TarShardLoader.hpp>
 #include <DiffusionModelC++/Trainer/Trainer.hpp>
 #include <DiffusionModelC++/Util/FileUtil.hpp>
 #include <DiffusionModelC++/Util/ImageUtil.hpp>
 #include <DiffusionModelC++/Util/Logging.hpp>
 #include <chrono>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include <utility>
 
@@ -15,7 +22,10 @@ Trainer::Trainer(const config::Config& config,
     : _config(config),
       _model(model),
       _modelEMA(emaModel),
-      _step() {
+      _step(),
+      _epoch(),
+      _batchInEpoch(),
+      _checkpointBlockedTime(0.0) {
   // Create log dir
   LOG_INFO("Set log dir to" + _config.logDir);
   util::FileUtil::mkdirs(_config.logDir);
@@ -27,22 +37,153 @@ Trainer::Trainer(const config::Config& config,
     _device = torch::Device(torch::kCPU);
   }
 
+  // Data-parallel process group, from the RANK / WORLD_SIZE / MASTER_ADDR / MASTER_PORT environment variables
+  _processGroup = distributed::ProcessGroup::fromEnv();
+
+  if (!isMaster()) {
+    simview::util::Logging::setLevel("warn");
+  }
+
   // Move models to device
   _model->to(_device);
   _modelEMA->to(_device);
 
+  // Conv autotuner (CPU only), the distinct conv shapes are tuned during the first step
+  if (config.convAutotune && _device.is_cpu()) {
+    model::ConvAutotuner::getInstance().enable(config.convTuningCache);
+  }
+
   // NOTE: Clone model to EMA model
   // _modelEMA = std::dynamic_pointer_cast<diffusion::KarrasDiffusionImpl>(_model->clone());
 
-  // Set optimizer
+  if (config.pipelineParallel && _processGroup == nullptr) {
+    LOG_WARN("pipeline_parallel needs several processes, ignored.");
+  }
+
+  // With pipeline parallelism, the processes split the model instead of the data
+  const bool usePipeline = config.pipelineParallel && _processGroup != nullptr;
+  const bool useDataParallel = _processGroup != nullptr && !usePipeline;
+
+  if (config.zeroSharding && !useDataParallel) {
+    LOG_WARN("zero_sharding only applies to data-parallel training, ignored.");
+  }
+
+  const bool useZeroSharding = config.zeroSharding && useDataParallel;
+
+  // NOTE: The sharded optimizer only sees one flat 1-D parameter, so Adafactor could never factor its second moment
+  if (useZeroSharding && config.optimizer.type == dmcpp::config::OptimizerType::ADAFACTOR) {
+    LOG_CRITICAL("zero_sharding cannot be used with the adafactor optimizer, which needs the parameter shapes to factor its state");
+    exit(EXIT_FAILURE);
+  }
+
+  // Parameter arenas, before the optimizer takes the parameters
+  // NOTE: Data-parallel training reduces the flat gradient buffer, so it always uses them.
+  //       Pipeline stages only update their own parameters and do without.
+  if ((config.paramArena && !usePipeline) || useDataParallel) {
+    const int64_t nShards = useZeroSharding ? _processGroup->getWorldSize() : 1;
+
+    _paramArena = std::make_unique<ParameterArena>(*_model, true, nShards);
+
+    // NOTE: With ZeRO sharding, only rank 0 keeps a full EMA model (for previews and checkpoints),
+    //       the other ranks release theirs and keep the EMA of their shard only.
+    //       The EMA arena takes the same padding, so the gathered shards map onto it one to one.
+    if (!useZeroSharding || isMaster()) {
+      _paramArenaEMA = std::make_unique<ParameterArena>(*_modelEMA, false, nShards);
+    } else {
+      torch::NoGradGuard no_grad;
+
+      for (auto& param : _modelEMA->parameters()) {
+        param.set_data(torch::empty({0}, param.options()));
+      }
+    }
+  }
+
+  if (usePipeline) {
+    torch::NoGradGuard no_grad;
+
+    LOG_INFO("Pipeline-parallel training on " + std::to_string(_processGroup->getWorldSize()) + " processes");
+
+    // Start every stage from the weights of rank 0
+    for (const diffusion::KarrasDiffusion& model : {_model, _modelEMA}) {
+      for (torch::Tensor param : model->parameters()) {
+        _processGroup->broadcast(param, 0);
+      }
+
+      for (torch::Tensor buffer : model->buffers()) {
+        _processGroup->broadcast(buffer, 0);
+      }
+    }
+
+    // NOTE: All ranks keep the same seed, so they draw the same batch, noise and sigmas
+    _pipeline = std::make_unique<PipelineParallel>(_processGroup, _model, config.microBatchSize);
+  }
+
+  if (useDataParallel) {
+    torch::NoGradGuard no_grad;
+
+    LOG_INFO("Data-parallel training on " + std::to_string(_processGroup->getWorldSize()) + " processes");
+
+    // Start every rank from the weights of rank 0. A sharded EMA is taken from the broadcast model.
+    for (ParameterArena* arena : {_paramArena.get(), useZeroSharding ? nullptr : _paramArenaEMA.get()}) {
+      if (arena == nullptr) {
+        continue;
+      }
+
+      torch::Tensor flatParams = arena->getFlatParams();
+      _processGroup->broadcast(flatParams, 0);
+
+      for (torch::Tensor buffer : arena->getBuffers()) {
+        _processGroup->broadcast(buffer, 0);
+      }
+    }
+
+    _gradReducer = std::make_unique<GradReducer>(_processGroup, *_paramArena, config.ddpBucketMB * 1024 * 1024);
+
+    if (useZeroSharding) {
+      _zeroSharding = std::make_unique<ZeroSharding>(_processGroup, *_paramArena);
+    }
+
+    // Different noise, sigmas and flips on every rank
+    torch::manual_seed(static_cast<uint64_t>(config.seed + _processGroup->getRank()));
+  }
+
+  // Set optimizer, on this rank's shard only with ZeRO sharding, on this rank's stage only with pipeline parallelism
+  std::vector<torch::Tensor> params = _model->parameters();
+
+  if (_zeroSharding != nullptr) {
+    params = {_zeroSharding->getShardParam()};
+  } else if (_pipeline != nullptr) {
+    params = _pipeline->getStageParameters(*_model);
+  }
+
   switch (config.optimizer.type) {
     case dmcpp::config::OptimizerType::ADAMW:
-      _optimizer = std::make_shared<torch::optim::AdamW>(_model->parameters(),
+      _optimizer = std::make_shared<torch::optim::AdamW>(params,
                                                          torch::optim::AdamWOptions(config.optimizer.lr)
                                                              .betas({config.optimizer.betas[0], config.optimizer.betas[1]})
                                                              .eps(config.optimizer.eps)
                                                              .weight_decay(config.optimizer.weightDecay));
       break;
+    case dmcpp::config::OptimizerType::FUSED_ADAMW:
+      _optimizer = std::make_shared<FusedAdamW>(params,
+                                                torch::optim::AdamWOptions(config.optimizer.lr)
+                                                    .betas({config.optimizer.betas[0], config.optimizer.betas[1]})
+                                                    .eps(config.optimizer.eps)
+                                                    .weight_decay(config.optimizer.weightDecay));
+      break;
+    case dmcpp::config::OptimizerType::ADAFACTOR:
+      // NOTE: Adafactor keeps its own eps and no first moment, only lr and weight decay are taken from the config
+      _optimizer = std::make_shared<Adafactor>(params,
+                                               AdafactorOptions(config.optimizer.lr)
+                                                   .weight_decay(config.optimizer.weightDecay));
+      break;
+    case dmcpp::config::OptimizerType::ADAMW_8BIT:
+      _optimizer = std::make_shared<AdamW8bit>(params,
+                                               AdamW8bitOptions(config.optimizer.lr)
+                                                   .betas({config.optimizer.betas[0], config.optimizer.betas[1]})
+                                                   .eps(config.optimizer.eps)
+                                                   .weight_decay(config.optimizer.weightDecay));
+      break;
     default:
       LOG_CRITICAL("Invalid optimizer type");
       exit(EXIT_FAILURE);
@@ -61,94 +202,262 @@ Trainer::Trainer(const config::Config& config,
   // EMA scheduler
   _EMAScheduler = std::make_shared<EMAWarmup>(1.0, config.ema.power, 0.0, config.ema.maxValue);
 
-  // Dataset
-  auto dataset = ImageFolderDataset(config.dataset.root,
-                                    config.imageSize,
-                                    config.imageSize,
-                                    config.dataset.extension);
-  auto mappedDataset = dataset.map(torch::data::transforms::Stack<>());
-
   // DataLoader
-  _dataLoader = torch::data::make_data_loader<torch::data::samplers::RandomSampler>(
-      std::move(mappedDataset),
-      torch::data::DataLoaderOptions()
-          .batch_size(config.dataset.batchSize)
-          .drop_last(true)
-          .workers(config.dataset.numWorkers));
+  // NOTE: The data order only depends on the seed and the epoch, and the random flip is applied on the batch
+  //       by the prefetcher with a per-batch generator, so both are reproduced on resume.
+  const auto dataLoaderOptions = torch::data::DataLoaderOptions()
+                                     .batch_size(config.dataset.batchSize)
+                                     .drop_last(true)
+                                     .workers(config.dataset.numWorkers);
+  const std::vector<int64_t> sampleShape = {3, config.imageSize, config.imageSize};
+  const std::string manifestPath = config.dataset.manifest == "auto"
+                                       ? getDefaultManifestPath(config.dataset.root, config.dataset.extension, config.logDir)
+                                       : config.dataset.manifest;
+  const auto makeDataSampler = [&](int64_t nImages) {
+    ResumableRandomSampler dataSampler(nImages,
+                                       static_cast<uint64_t>(config.seed),
+                                       useDataParallel ? _processGroup->getRank() : 0,
+                                       useDataParallel ? _processGroup->getWorldSize() : 1);
+    _samplerPosition = dataSampler.getPosition();
+    return dataSampler;
+  };
+
+  if (config.dataset.mode == config::DatasetMode::SHARDS) {
+    _samplerPosition = std::make_shared<SamplerPosition>();
+    _dataLoader = std::make_unique<TarShardLoader>(config.dataset.root,
+                                                   config.imageSize,
+                                                   config.imageSize,
+                                                   config.dataset.extension,
+                                                   config.dataset.batchSize,
+                                                   config.dataset.numWorkers,
+                                                   config.dataset.shuffleBuffer,
+                                                   _samplerPosition,
+                                                   static_cast<uint64_t>(config.seed),
+                                                   useDataParallel ? _processGroup->getRank() : 0,
+                                                   useDataParallel ? _processGroup->getWorldSize() : 1);
+  } else if (config.dataset.mode == config::DatasetMode::PACKED || (config.dataset.mode == config::DatasetMode::MEMORY && config.dataset.sharedCache)) {
+    // NOTE: With the shared cache, the decoded images of the memory mode live in a packed file in /dev/shm that
+    //       concurrent jobs on the host map instead of decoding their own copy
+    const std::string packPath = config.dataset.mode == config::DatasetMode::PACKED
+                                     ? config.dataset.root
+                                     : acquireSharedPackedDataset(config.dataset.root, config.dataset.extension, config.imageSize, manifestPath);
+
+    auto dataset = PackedImageDataset(packPath);
+
+    if (dataset.getImageWidth() != config.imageSize || dataset.getImageHeight() != config.imageSize) {
+      LOG_CRITICAL("The packed dataset was written at " + std::to_string(dataset.getImageWidth()) + "x" + std::to_string(dataset.getImageHeight()) + ", not at image_size");
+      exit(EXIT_FAILURE);
+    }
+
+    const int64_t nImages = static_cast<int64_t>(*dataset.size());
+
+    if (config.dataset.workerProcesses) {
+      _dataLoader = makeProcessBatchLoader(std::move(dataset), makeDataSampler(nImages), sampleShape, config.dataset.batchSize, config.dataset.numWorkers);
+    } else {
+      _dataLoader = makeImageBatchLoader(torch::data::make_data_loader(std::move(dataset), makeDataSampler(nImages), dataLoaderOptions));
+    }
+  } else {
+    auto dataset = ImageFolderDataset(config.dataset.root,
+                                      config.imageSize,
+                                      config.imageSize,
+                                      config.dataset.extension,
+                                      false,
+                                      config.dataset.mode,
+                                      config.dataset.cacheMB * 1024 * 1024,
+                                      config.dataset.encodedQuality,
+                                      manifestPath);
+    const int64_t nImages = static_cast<int64_t>(*dataset.size());
+
+    if (config.dataset.workerProcesses) {
+      _dataLoader = makeProcessBatchLoader(std::move(dataset), makeDataSampler(nImages), sampleShape, config.dataset.batchSize, config.dataset.numWorkers);
+    } else {
+      _dataLoader = makeImageBatchLoader(torch::data::make_data_loader(std::move(dataset), makeDataSampler(nImages), dataLoaderOptions));
+    }
+  }
 
   // Sampler
   _sampler = std::make_shared<diffusion::CosineInterpolatedSampler>(config);
+
+  // Prefetcher, with different flips, noise and sigmas on every data-parallel rank
+  _prefetcher = std::make_unique<BatchPrefetcher>(*_dataLoader,
+                                                  _sampler,
+                                                  _device,
+                                                  config.dataset.prefetchDepth,
+                                                  static_cast<uint64_t>(config.seed + (useDataParallel ? _processGroup->getRank() : 0)));
+
+  if (isMaster()) {
+    // Checkpoint writer
+    _checkpointWriter = std::make_unique<CheckpointWriter>();
+
+    // Preview worker
+    _previewWorker = std::make_unique<PreviewWorker>(config, _device);
+  }
 }
 
-Trainer::~Trainer() = default;
+Trainer::~Trainer() {
+  if (_previewWorker != nullptr) {
+    _previewWorker->wait();
+  }
+
+  if (_checkpointWriter != nullptr) {
+    _checkpointWriter->wait();
+  }
+}
 
 void Trainer::fit() {
   LOG_INFO("Start training ...");
 
   bool toContinue = true;
+  bool hasReportedOptimizerState = false;
+  int64_t accumCount = 0;
+  torch::Tensor accumLoss;
+  // Time the training thread waited for data since the last log [ms]
+  double dataWaitTime = 0.0;
   auto startTime = std::chrono::high_resolution_clock::now();
 
   while (toContinue) {
-    for (auto& batch : *_dataLoader) {
-      const torch::Tensor& image = batch.data.to(_device);
-      const torch::Tensor& noise = torch::randn_like(image);
+    _samplerPosition->epoch = _epoch;
+    _samplerPosition->index = _batchInEpoch * _config.dataset.batchSize;
 
-      const torch::Tensor& sigma = _sampler->sample({image.size(0)}, _device, torch::kFloat32);
+    _prefetcher->start(_epoch, _batchInEpoch);
 
-      model::ImageUNetModelForwardArgs args;
+    while (true) {
+      const auto waitStartTime = std::chrono::high_resolution_clock::now();
 
-      torch::Tensor loss = _model->loss(image, noise, sigma, args).mean();
+      const auto batch = _prefetcher->next();
 
-      loss.backward();
+      dataWaitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStartTime).count();
+
+      if (!batch.has_value()) {
+        break;
+      }
+
+      ++_batchInEpoch;
+
+      const torch::Tensor& image = batch->image;
+      const torch::Tensor& noise = batch->noise;
+      const torch::Tensor& sigma = batch->sigma;
+
+      // Forward and backward in micro-batches. Each micro-batch loss is weighted by its share of the effective
+      // batch, so the accumulated gradient equals the one of the mean loss over the effective batch.
+      const int64_t batchSize = image.size(0);
+      const int64_t microBatchSize = _config.microBatchSize > 0 ? std::min(_config.microBatchSize, batchSize) : batchSize;
+      const double effectiveBatchSize = static_cast<double>(batchSize * _config.gradAccumSteps);
+
+      // The pipeline runs its own micro-batch schedule
+      if (_pipeline != nullptr) {
+        const torch::Tensor& loss = _pipeline->forwardBackward(image, noise, sigma, 1.0 / effectiveBatchSize);
+        accumLoss = accumLoss.defined() ? accumLoss + loss : loss;
+      }
+
+      for (int64_t offset = 0; _pipeline == nullptr && offset < batchSize; offset += microBatchSize) {
+        const int64_t length = std::min(microBatchSize, batchSize - offset);
+
+        model::ImageUNetModelForwardArgs args;
+
+        torch::Tensor loss = _model->loss(image.narrow(0, offset, length), noise.narrow(0, offset, length), sigma.narrow(0, offset, length), args).sum() / effectiveBatchSize;
+
+        // Gradients are only averaged over the ranks in the last backward before the optimizer step
+        if (_gradReducer != nullptr) {
+          _gradReducer->setSyncEnabled(offset + length >= batchSize && accumCount + 1 == _config.gradAccumSteps);
+        }
+
+        loss.backward();
+
+        if (_gradReducer != nullptr) {
+          _gradReducer->finish();
+        }
+
+        accumLoss = accumLoss.defined() ? accumLoss + loss.detach() : loss.detach();
+      }
+
+      if (++accumCount < _config.gradAccumSteps) {
+        continue;
+      }
+
+      accumCount = 0;
+
+      torch::Tensor loss = accumLoss;
+      accumLoss = torch::Tensor();
+
+      const bool toLog = (_step + 1) % _config.logEveryStep == 0;
+      const double gradNorm = (toLog && _paramArena != nullptr) ? _paramArena->gradNorm() : 0.0;
 
       _optimizer->step();
       _lrScheduler->step();
-      _optimizer->zero_grad();
+
+      if (_zeroSharding != nullptr) {
+        _zeroSharding->allGatherParams();
+      }
+
+      if (_paramArena != nullptr) {
+        _paramArena->zeroGrad();
+      } else {
+        _optimizer->zero_grad();
+      }
 
       ++_step;
 
+      // Optimizer states are allocated lazily, so report them after the first step
+      if (!hasReportedOptimizerState) {
+        LOG_INFO("Optimizer state : " + std::to_string(static_cast<double>(getOptimizerStateBytes(*_optimizer)) / (1024.0 * 1024.0)) + " [MiB]");
+        hasReportedOptimizerState = true;
+      }
+
       // EMA update
       {
         torch::NoGradGuard no_grad;
 
         const double& emaDecay = _EMAScheduler->get_value();
-        updateEMAModel(_model, _modelEMA, emaDecay);
+
+        if (_zeroSharding != nullptr) {
+          _zeroSharding->updateEMA(emaDecay);
+        } else if (_pipeline != nullptr) {
+          updateEMAModel(_pipeline->getStageParameters(*_model), _pipeline->getStageParameters(*_modelEMA), emaDecay);
+        } else if (_paramArena != nullptr) {
+          updateEMAModel(*_paramArena, *_paramArenaEMA, emaDecay);
+        } else {
+          updateEMAModel(_model, _modelEMA, emaDecay);
+        }
       }
 
-      if (_step % _config.logEveryStep == 0) {
+      if (toLog) {
         torch::NoGradGuard no_grad;
 
+        // Mean over the data-parallel ranks, or the loss of the last pipeline stage (zero on the others)
+        if (_processGroup != nullptr) {
+          loss = loss.to(torch::kCPU, torch::kFloat64).reshape({1});
+          _processGroup->allReduce(loss, _pipeline != nullptr ? 1.0 : 1.0 / static_cast<double>(_processGroup->getWorldSize()));
+        }
+
         auto currentTime = std::chrono::high_resolution_clock::now();
         double elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - startTime).count();
 
-        LOG_INFO("Step " + std::to_string(_step) + " / " + std::to_string(_config.maxSteps) + " , Loss : " + std::to_string(loss.item<double>()) + " , Elapsed time : " + std::to_string(elapsedTime * 1e-6) + " [sec]");
+        LOG_INFO("Step " + std::to_string(_step) + " / " + std::to_string(_config.maxSteps) + " , Loss : " + std::to_string(loss.item<double>()) +
+                 (_paramArena != nullptr ? " , Grad norm : " + std::to_string(gradNorm) : "") +
+                 " , Data wait : " + std::to_string(dataWaitTime / static_cast<double>(_config.logEveryStep)) + " [ms/step]" +
+                 " , Elapsed time : " + std::to_string(elapsedTime * 1e-6) + " [sec]");
+
+        dataWaitTime = 0.0;
       }
 
       if (_step % _config.sampleEveryStep == 0) {
-        torch::NoGradGuard no_grad;
-        LOG_INFO("Sampling ...");
-
-        const torch::Tensor& x = torch::randn({_config.nSamples, _config.model.inChannels, _config.imageSize, _config.imageSize}, torch::TensorOptions(_device)) * _config.sampler.sigmaMax;
-        const torch::Tensor& sigmas = diffusion::getSigmasKarras(50, _config.sampler.sigmaMin, _config.sampler.sigmaMax, 7.0, _device);
-        const torch::Tensor& sampled = diffusion::sample_heun(_modelEMA, x, sigmas);
-
-        const std::string sampleDirPath = util::FileUtil::join(util::FileUtil::join(_config.logDir, "sampled"), "step=" + std::to_string(_step));
-        util::FileUtil::mkdirs(sampleDirPath);
-
-        for (int64_t iImage = 0; iImage < _config.nSamples; ++iImage) {
-          const std::string& filePath = util::FileUtil::join(sampleDirPath, "sample_" + std::to_string(iImage) + ".png");
-          const cv::Mat& image = util::tensorToCv2Mat(sampled[iImage]);
-          util::saveImage(image, filePath);
+        if (_zeroSharding != nullptr) {
+          gatherEMAModel();
+        } else if (_pipeline != nullptr) {
+          _pipeline->gatherParameters(*_modelEMA);
         }
 
-        LOG_INFO("Done.");
+        if (_previewWorker != nullptr) {
+          _previewWorker->submit(_modelEMA, _step);
+        }
       }
 
       if (_step % _config.checkpointEveryStep == 0) {
         torch::NoGradGuard no_grad;
 
-        const std::string filePath = util::FileUtil::join(getCheckpointDirPath(), "checkpoint_step=" + std::to_string(_step) + ".pth");
-        save(filePath);
+        const std::string dirPath = util::FileUtil::join(getCheckpointDirPath(), "checkpoint_step=" + std::to_string(_step));
+        save(dirPath);
       }
 
       if (_step == _config.maxSteps) {
@@ -156,57 +465,296 @@ void Trainer::fit() {
         break;
       }
     }
+
+    if (toContinue) {
+      ++_epoch;
+      _batchInEpoch = 0;
+    }
   }
 
+  _prefetcher->stop();
+
   LOG_INFO("Done.");
 
-  const std::string filePath = util::FileUtil::join(getCheckpointDirPath(), "checkpoint_last.pth");
-  save(filePath);
+  const std::string dirPath = util::FileUtil::join(getCheckpointDirPath(), "checkpoint_last");
+  save(dirPath);
+
+  if (isMaster()) {
+    _checkpointWriter->wait();
+    _previewWorker->wait();
+
+    LOG_INFO("Skipped previews : " + std::to_string(_previewWorker->getNumSkipped()));
+    LOG_INFO("Last checkpoint : blocked " + std::to_string(getCheckpointBlockedTime()) + " [ms], written in " + std::to_string(getCheckpointWriteTime()) + " [ms]");
+  }
 }
 
-void Trainer::save(const std::string& filePath) {
+void Trainer::save(const std::string& dirPath) {
   torch::NoGradGuard no_grad;
 
-  LOG_INFO("Saving checkpoint ...");
+  const auto startTime = std::chrono::high_resolution_clock::now();
 
-  torch::serialize::OutputArchive archive;
+  // RNG states, of all ranks when training data-parallel. This is a collective, so every rank takes part.
+  torch::Tensor cpuRngState = torch::globalContext().defaultGenerator(torch::kCPU).get_state();
+  torch::Tensor deviceRngState = _device.is_cpu() ? torch::Tensor() : torch::globalContext().defaultGenerator(_device).get_state();
 
-  {
-    torch::serialize::OutputArchive tmpArchive;
-    _model->save(tmpArchive);
-    archive.write("model", tmpArchive);
+  if (_processGroup != nullptr) {
+    cpuRngState = _processGroup->allGather(cpuRngState);
+
+    if (deviceRngState.defined()) {
+      deviceRngState = _processGroup->allGather(deviceRngState);
+    }
+  }
+
+  // Sharded state: the full models and the optimizer shards of all ranks are collected on rank 0
+  std::vector<std::string> optimizerShards;
+
+  if (_zeroSharding != nullptr) {
+    gatherEMAModel();
+  } else if (_pipeline != nullptr) {
+    _pipeline->gatherParameters(*_model);
+    _pipeline->gatherParameters(*_modelEMA);
+  }
+
+  if (hasShardedOptimizer()) {
+    torch::serialize::OutputArchive archive;
+    _optimizer->save(archive);
+    optimizerShards = _processGroup->gatherBytes(util::serializeArchive(archive), 0);
+  }
+
+  if (!isMaster()) {
+    return;
+  }
+
+  // NOTE: Waits for the previous checkpoint, if it is still being written
+  _checkpointWriter->wait();
+
+  std::vector<CheckpointShard> shards(3);
+
+  shards[0].fileName = "model.pt";
+  shards[0].tensors = _paramArena != nullptr ? _paramArena->snapshot() : util::snapshotNamedTensors(*_model);
+
+  shards[1].fileName = "ema_model.pt";
+  shards[1].tensors = _paramArenaEMA != nullptr ? _paramArenaEMA->snapshot() : util::snapshotNamedTensors(*_modelEMA);
+
+  if (hasShardedOptimizer()) {
+    for (size_t rank = 0; rank < optimizerShards.size(); ++rank) {
+      CheckpointShard shard;
+      shard.fileName = "optimizer_rank" + std::to_string(rank) + ".pt";
+      shard.bytes = std::move(optimizerShards[rank]);
+      shards.push_back(std::move(shard));
+    }
+  } else {
+    torch::serialize::OutputArchive archive;
+    _optimizer->save(archive);
+
+    CheckpointShard shard;
+    shard.fileName = "optimizer.pt";
+    shard.bytes = util::serializeArchive(archive);
+    shards.push_back(std::move(shard));
   }
 
   {
-    torch::serialize::OutputArchive tmpArchive;
-    _modelEMA->save(tmpArchive);
-    archive.write("ema_model", tmpArchive);
+    torch::serialize::OutputArchive archive;
+
+    {
+      torch::serialize::OutputArchive tmpArchive;
+      const auto& stateDict = _EMAScheduler->state_dict();
+
+      for (auto iter = stateDict.begin(); iter != stateDict.end(); ++iter) {
+        tmpArchive.write(iter->first, iter->second);
+      }
+
+      archive.write("ema_sched", tmpArchive);
+    }
+
+    archive.write("step", _step);
+    archive.write("epoch", _epoch);
+    archive.write("batch_in_epoch", _batchInEpoch);
+    archive.write("lr_sched_step", getLRSchedulerStepCount());
+    archive.write("cpu_rng", cpuRngState);
+
+    if (deviceRngState.defined()) {
+      archive.write("device_rng", deviceRngState);
+    }
+
+    if (hasShardedOptimizer()) {
+      archive.write("optimizer_shards", static_cast<int64_t>(_processGroup->getWorldSize()));
+    }
+
+    shards[2].fileName = "state.pt";
+    shards[2].bytes = util::serializeArchive(archive);
+  }
+
+  util::FileUtil::mkdirs(util::FileUtil::dirPath(dirPath));
+
+  _checkpointWriter->submit(dirPath, std::move(shards));
+
+  _checkpointBlockedTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+  LOG_INFO("Saving checkpoint to " + dirPath + " (step blocked for " + std::to_string(_checkpointBlockedTime) + " [ms], previous write took " + std::to_string(getCheckpointWriteTime()) + " [ms])");
+}
+
+void Trainer::resume(const std::string& checkpointDirPath) {
+  torch::NoGradGuard no_grad;
+
+  std::string dirPath = checkpointDirPath;
+
+  while (dirPath.size() > 1 && dirPath.back() == '/') {
+    dirPath.pop_back();
+  }
+
+  // A crash while the checkpoint writer was publishing leaves only the previous checkpoint, moved aside
+  if (!util::FileUtil::exists(dirPath) && util::FileUtil::exists(dirPath + ".old")) {
+    LOG_WARN(dirPath + " is missing, resuming from the previous checkpoint " + dirPath + ".old");
+    dirPath += ".old";
+  }
+
+  LOG_INFO("Resuming from " + dirPath + " ...");
+
+  if (!util::FileUtil::exists(util::FileUtil::join(dirPath, "state.pt"))) {
+    LOG_CRITICAL("Not a checkpoint directory: " + dirPath);
+    exit(EXIT_FAILURE);
+  }
+
+  torch::serialize::InputArchive archive;
+  archive.load_from(util::FileUtil::join(dirPath, "state.pt"));
+
+  util::loadModuleState(*_model, util::FileUtil::join(dirPath, "model.pt"));
+
+  std::string optimizerFileName = "optimizer.pt";
+
+  if (hasShardedOptimizer()) {
+    c10::IValue nShards;
+
+    if (!archive.try_read("optimizer_shards", nShards) || nShards.toInt() != _processGroup->getWorldSize()) {
+      LOG_CRITICAL("Resuming sharded (ZeRO or pipeline) training needs a checkpoint written with the same sharding and number of ranks");
+      exit(EXIT_FAILURE);
+    }
+
+    optimizerFileName = "optimizer_rank" + std::to_string(_processGroup->getRank()) + ".pt";
+  }
+
+  if (_zeroSharding != nullptr) {
+    // Every rank takes its shard of the full EMA, only rank 0 keeps the full EMA model
+    _zeroSharding->loadEMA(_paramArena->flatten(util::loadNamedTensors(util::FileUtil::join(dirPath, "ema_model.pt"))));
+  }
+
+  if (_paramArenaEMA != nullptr || _zeroSharding == nullptr) {
+    util::loadModuleState(*_modelEMA, util::FileUtil::join(dirPath, "ema_model.pt"));
   }
 
   {
-    torch::serialize::OutputArchive tmpArchive;
-    _optimizer->save(tmpArchive);
-    archive.write("optimizer", tmpArchive);
+    torch::serialize::InputArchive optimizerArchive;
+    optimizerArchive.load_from(util::FileUtil::join(dirPath, optimizerFileName), _device);
+    _optimizer->load(optimizerArchive);
   }
 
   {
-    torch::serialize::OutputArchive tmpArchive;
-    const auto& stateDict = _EMAScheduler->state_dict();
+    torch::serialize::InputArchive tmpArchive;
+    archive.read("ema_sched", tmpArchive);
+
+    std::unordered_map<std::string, double> stateDict = _EMAScheduler->state_dict();
 
     for (auto iter = stateDict.begin(); iter != stateDict.end(); ++iter) {
-      tmpArchive.write(iter->first, iter->second);
+      c10::IValue value;
+      tmpArchive.read(iter->first, value);
+      iter->second = value.toDouble();
     }
 
-    archive.write("ema_sched", stateDict);
+    _EMAScheduler->load_state_dict(stateDict);
   }
 
-  archive.write("step", _step);
+  c10::IValue value;
+
+  archive.read("step", value);
+  _step = value.toInt();
+
+  archive.read("epoch", value);
+  _epoch = value.toInt();
+
+  archive.read("batch_in_epoch", value);
+  _batchInEpoch = value.toInt();
 
-  util::FileUtil::mkdirs(util::FileUtil::dirPath(filePath));
+  archive.read("lr_sched_step", value);
+  setLRSchedulerStepCount(value.toInt());
+
+  // Data-parallel checkpoints hold one RNG state per rank
+  const auto restoreRngState = [this](torch::Tensor rngState, const torch::Device& device) {
+    if (rngState.dim() == 2) {
+      const int64_t rank = _processGroup != nullptr ? _processGroup->getRank() : 0;
+      const int64_t worldSize = _processGroup != nullptr ? _processGroup->getWorldSize() : 1;
+
+      if (rngState.size(0) != worldSize) {
+        LOG_WARN("The checkpoint was written by " + std::to_string(rngState.size(0)) + " processes, RNG states are not restored");
+        return;
+      }
+
+      rngState = rngState[rank].contiguous();
+    }
+
+    auto generator = torch::globalContext().defaultGenerator(device);
+    std::lock_guard<std::mutex> lock(generator.mutex());
+    generator.set_state(rngState);
+  };
+
+  {
+    torch::Tensor rngState;
+    archive.read("cpu_rng", rngState);
+    restoreRngState(rngState, torch::kCPU);
+  }
 
-  archive.save_to(filePath);
+  if (!_device.is_cpu()) {
+    torch::Tensor rngState;
+
+    if (archive.try_read("device_rng", rngState)) {
+      restoreRngState(rngState, _device);
+    }
+  }
+
+  LOG_INFO("Resumed at step " + std::to_string(_step) + " (epoch " + std::to_string(_epoch) + ", batch " + std::to_string(_batchInEpoch) + ")");
+}
+
+int64_t Trainer::getLRSchedulerStepCount() const {
+  const auto lrScheduler = std::dynamic_pointer_cast<ConstantLRWithWarmup>(_lrScheduler);
+  return lrScheduler != nullptr ? lrScheduler->getStepCount() : 0;
+}
+
+void Trainer::setLRSchedulerStepCount(int64_t stepCount) {
+  const auto lrScheduler = std::dynamic_pointer_cast<ConstantLRWithWarmup>(_lrScheduler);
+
+  if (lrScheduler != nullptr) {
+    lrScheduler->setStepCount(stepCount);
+  }
+}
+
+double Trainer::getCheckpointBlockedTime() const {
+  return _checkpointBlockedTime;
+}
+
+double Trainer::getCheckpointWriteTime() const {
+  return _checkpointWriter->getLastWriteTime();
+}
+
+void Trainer::gatherEMAModel() {
+  torch::NoGradGuard no_grad;
+
+  const torch::Tensor& flatEMA = _zeroSharding->gatherEMA(0);
+
+  if (_paramArenaEMA != nullptr) {
+    _paramArenaEMA->getFlatParams().copy_(flatEMA);
+
+    for (size_t i = 0; i < _paramArenaEMA->getBuffers().size(); ++i) {
+      _paramArenaEMA->getBuffers()[i].copy_(_paramArena->getBuffers()[i]);
+    }
+  }
+}
+
+bool Trainer::hasShardedOptimizer() const {
+  return _zeroSharding != nullptr || _pipeline != nullptr;
+}
 
-  LOG_INFO("Saving checkpoint to " + filePath);
+bool Trainer::isMaster() const {
+  return _processGroup == nullptr || _processGroup->getRank() == 0;
 }
 
 std::string Trainer::getCheckpointDirPath() const {
@@ -0,0 +1,67 @@
+#include <DiffusionModelC++/Trainer/ZeroSharding.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+namespace dmcpp::trainer {
+
+ZeroSharding::ZeroSharding(std::shared_ptr<distributed::ProcessGroup> processGroup,
+                           ParameterArena& arena)
+    : _processGroup(std::move(processGroup)),
+      _flatParams(arena.getFlatParams()),
+      _shardParam(),
+      _shardEMA(),
+      _shardOffset(0),
+      _shardNumel(0) {
+  torch::NoGradGuard no_grad;
+
+  const int64_t worldSize = _processGroup->getWorldSize();
+
+  TORCH_CHECK(_flatParams.numel() % worldSize == 0, "The parameter arena must be built with nShards = world size");
+  TORCH_CHECK(arena.getFlatGrads().defined(), "ZeroSharding needs a parameter arena with gradients");
+
+  _shardNumel = _flatParams.numel() / worldSize;
+  _shardOffset = _shardNumel * _processGroup->getRank();
+
+  // NOTE: A detached view shares the storage, so the optimizer updates the arena in place
+  _shardParam = _flatParams.narrow(0, _shardOffset, _shardNumel).detach();
+  _shardParam.mutable_grad() = arena.getFlatGrads().narrow(0, _shardOffset, _shardNumel);
+
+  // The EMA starts as a copy of the model
+  _shardEMA = _shardParam.clone();
+
+  LOG_INFO("ZeRO sharding : " + std::to_string(_shardNumel) + " of " + std::to_string(_flatParams.numel()) + " elements per rank");
+}
+
+const torch::Tensor& ZeroSharding::getShardParam() const {
+  return _shardParam;
+}
+
+int64_t ZeroSharding::getShardOffset() const {
+  return _shardOffset;
+}
+
+int64_t ZeroSharding::getShardNumel() const {
+  return _shardNumel;
+}
+
+void ZeroSharding::allGatherParams() {
+  _processGroup->allGatherInPlace(_flatParams);
+}
+
+void ZeroSharding::updateEMA(double decay) {
+  torch::NoGradGuard no_grad;
+  _shardEMA.lerp_(_shardParam, 1.0 - decay);
+}
+
+torch::Tensor ZeroSharding::gatherEMA(int root) {
+  const torch::Tensor& gathered = _processGroup->gather(_shardEMA, root);
+  return gathered.defined() ? gathered.view({-1}) : gathered;
+}
+
+void ZeroSharding::loadEMA(const torch::Tensor& flatEMA) {
+  torch::NoGradGuard no_grad;
+
+  TORCH_CHECK(flatEMA.numel() == _flatParams.numel(), "EMA size mismatch");
+  _shardEMA.copy_(flatEMA.narrow(0, _shardOffset, _shardNumel));
+}
+
+}  // namespace dmcpp::trainer
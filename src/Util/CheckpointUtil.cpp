@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <DiffusionModelC++/Util/CheckpointUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+namespace dmcpp::util {
+
+NamedTensors snapshotNamedTensors(torch::nn::Module& module) {
+  torch::NoGradGuard no_grad;
+
+  NamedTensors tensors;
+
+  for (const auto& item : module.named_parameters(true)) {
+    tensors.emplace_back(item.key(), item.value().detach().to(torch::kCPU, item.value().scalar_type(), false, true));
+  }
+
+  for (const auto& item : module.named_buffers(true)) {
+    tensors.emplace_back(item.key(), item.value().detach().to(torch::kCPU, item.value().scalar_type(), false, true));
+  }
+
+  return tensors;
+}
+
+std::string serializeArchive(torch::serialize::OutputArchive& archive) {
+  std::string bytes;
+
+  archive.save_to([&bytes](const void* data, size_t size) -> size_t {
+    bytes.append(static_cast<const char*>(data), size);
+    return size;
+  });
+
+  return bytes;
+}
+
+void saveNamedTensors(const NamedTensors& tensors, const std::string& filePath) {
+  c10::Dict<std::string, torch::Tensor> dict;
+
+  for (const auto& tensor : tensors) {
+    dict.insert(tensor.first, tensor.second);
+  }
+
+  torch::serialize::OutputArchive archive;
+  archive.write("tensors", c10::IValue(dict));
+  archive.save_to(filePath);
+}
+
+std::unordered_map<std::string, torch::Tensor> loadNamedTensors(const std::string& filePath) {
+  torch::serialize::InputArchive archive;
+  archive.load_from(filePath);
+
+  c10::IValue value;
+  archive.read("tensors", value);
+
+  std::unordered_map<std::string, torch::Tensor> tensors;
+
+  for (const auto& item : value.toGenericDict()) {
+    tensors[item.key().toStringRef()] = item.value().toTensor();
+  }
+
+  return tensors;
+}
+
+void loadModuleState(torch::nn::Module& module, const std::string& filePath) {
+  torch::NoGradGuard no_grad;
+
+  const auto& tensors = loadNamedTensors(filePath);
+
+  const auto copy = [&](const std::string& name, torch::Tensor& dst) {
+    const auto iter = tensors.find(name);
+
+    if (iter == tensors.end()) {
+      LOG_CRITICAL("Missing tensor '" + name + "' in " + filePath);
+      exit(EXIT_FAILURE);
+    }
+
+    dst.copy_(iter->second);
+  };
+
+  for (auto& item : module.named_parameters(true)) {
+    copy(item.key(), item.value());
+  }
+
+  for (auto& item : module.named_buffers(true)) {
+    copy(item.key(), item.value());
+  }
+}
+
+void writeFile(const std::string& filePath, const std::string& bytes) {
+  const int fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + filePath);
+  }
+
+  size_t written = 0;
+
+  while (written < bytes.size()) {
+    const ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+
+    if (n < 0) {
+      close(fd);
+      throw std::runtime_error("Failed to write " + filePath);
+    }
+
+    written += static_cast<size_t>(n);
+  }
+
+  close(fd);
+}
+
+void syncFile(const std::string& filePath) {
+  const int fd = open(filePath.c_str(), O_RDONLY);
+
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+void syncDirectory(const std::string& dirPath) {
+  const int fd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY);
+
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+}  // namespace dmcpp::util
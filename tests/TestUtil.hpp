@@ -0,0 +1,24 @@
+#pragma once
+
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <string>
+
+namespace dmcpp {
+namespace test {
+
+// Log a failed check, and return the condition so that results can be accumulated with &=
+inline bool check(bool condition, const std::string& name) {
+  if (!condition) {
+    LOG_ERROR(name + " failed");
+  }
+
+  return condition;
+}
+
+// Same, for the tests that run on several ranks
+inline bool check(bool condition, const std::string& name, int rank) {
+  return check(condition, "Rank " + std::to_string(rank) + " : " + name);
+}
+
+}  // namespace test
+}  // namespace dmcpp
@@ -29,18 +29,17 @@ int main() {
                                              imageSize,
                                              imageSize,
                                              ".jpg");
-  auto mappedDataset = dataset.map(torch::data::transforms::Stack<>());
 
   // DataLoader
   auto dataLoader = torch::data::make_data_loader<torch::data::samplers::RandomSampler>(
-      std::move(mappedDataset),
+      std::move(dataset),
       torch::data::DataLoaderOptions()
           .batch_size(32)
           .drop_last(true)
           .workers(32));
 
   for (auto& batch : *dataLoader) {
-    torch::Tensor images = batch.data;
+    torch::Tensor images = batch;
 
     images = images.to(torch::kCUDA);
 
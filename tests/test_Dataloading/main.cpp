@@ -12,18 +12,17 @@ int main() {
                                                     128,
                                                     128,
                                                     ".jpg");
-  auto mappedDataset = dataset.map(torch::data::transforms::Stack<>());
 
   // DataLoader
   auto dataLoader = torch::data::make_data_loader<torch::data::samplers::RandomSampler>(
-      std::move(mappedDataset),
+      std::move(dataset),
       torch::data::DataLoaderOptions()
           .batch_size(32)
           .drop_last(true)
           .workers(32));
 
   for (auto& batch : *dataLoader) {
-    torch::Tensor images = batch.data;
+    torch::Tensor images = batch;
 
     for (int64_t iImage = 0; iImage < images.size(0); ++iImage) {
       const std::string& filePath = dmcpp::util::FileUtil::join("output_test_Dataloading", "sample_" + std::to_string(iImage) + ".png");
@@ -0,0 +1,152 @@
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/DataParallel.hpp>
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+int main(int argc, char* argv[]) {
+  const int nProcs = argc > 1 ? std::stoi(argv[1]) : 3;
+
+  setenv("MASTER_PORT", "29731", 0);
+
+  int exitCode = EXIT_SUCCESS;
+
+  if (distributed::spawnLocalProcesses(nProcs, exitCode)) {
+    LOG_INFO(exitCode == EXIT_SUCCESS ? "All ranks passed." : "Some ranks failed.");
+    return exitCode;
+  }
+
+  const auto processGroup = distributed::ProcessGroup::fromEnv();
+  const int rank = processGroup->getRank();
+  const int worldSize = processGroup->getWorldSize();
+
+  bool isPassed = true;
+
+  // All-reduce, with a size that does not split evenly
+  {
+    torch::Tensor tensor = torch::full({1001}, static_cast<float>(rank + 1));
+    processGroup->allReduce(tensor);
+
+    const float expected = static_cast<float>(worldSize * (worldSize + 1) / 2);
+    isPassed &= check(torch::allclose(tensor, torch::full({1001}, expected)), "allReduce", rank);
+  }
+
+  // Asynchronous all-reduce with averaging, several in flight
+  {
+    std::vector<torch::Tensor> tensors;
+    std::vector<std::future<void>> works;
+
+    for (int i = 0; i < 4; ++i) {
+      tensors.push_back(torch::full({257 * (i + 1)}, static_cast<double>(rank), torch::kFloat64));
+      works.push_back(processGroup->allReduceAsync(tensors.back(), 1.0 / worldSize));
+    }
+
+    for (int i = 0; i < 4; ++i) {
+      works[i].get();
+      isPassed &= check(torch::allclose(tensors[i], torch::full_like(tensors[i], (worldSize - 1) / 2.0)), "allReduceAsync", rank);
+    }
+  }
+
+  // Broadcast
+  {
+    torch::Tensor tensor = rank == 1 ? torch::arange(100, torch::kFloat32) : torch::zeros({100});
+    processGroup->broadcast(tensor, 1);
+    isPassed &= check(torch::equal(tensor, torch::arange(100, torch::kFloat32)), "broadcast", rank);
+  }
+
+  // All-gather
+  {
+    const torch::Tensor& gathered = processGroup->allGather(torch::full({2, 3}, rank, torch::kInt64));
+    isPassed &= check(gathered.sizes() == torch::IntArrayRef({worldSize, 2, 3}), "allGather shape", rank);
+
+    for (int i = 0; i < worldSize; ++i) {
+      isPassed &= check(torch::equal(gathered[i], torch::full({2, 3}, i, torch::kInt64)), "allGather", rank);
+    }
+  }
+
+  // Reduce-scatter
+  {
+    const torch::Tensor& input = torch::arange(4 * worldSize, torch::kFloat32);
+    const torch::Tensor& output = processGroup->reduceScatter(input);
+    isPassed &= check(torch::allclose(output, input.narrow(0, 4 * rank, 4) * worldSize), "reduceScatter", rank);
+  }
+
+  // Send / recv around a ring
+  {
+    torch::Tensor received = torch::zeros({16});
+    const torch::Tensor& sent = torch::full({16}, static_cast<float>(rank));
+
+    if (rank % 2 == 0) {
+      processGroup->send(sent, (rank + 1) % worldSize);
+      processGroup->recv(received, (rank + worldSize - 1) % worldSize);
+    } else {
+      processGroup->recv(received, (rank + worldSize - 1) % worldSize);
+      processGroup->send(sent, (rank + 1) % worldSize);
+    }
+
+    isPassed &= check(torch::equal(received, torch::full({16}, static_cast<float>((rank + worldSize - 1) % worldSize))), "send/recv", rank);
+  }
+
+  // Queued sends in both directions at once, larger than the socket buffers
+  {
+    const int peer = rank ^ 1;
+
+    if (peer < worldSize) {
+      torch::Tensor received = torch::zeros({1 << 22});
+      processGroup->isend(torch::full({1 << 22}, static_cast<float>(rank)), peer);
+      processGroup->recv(received, peer);
+      processGroup->flush();
+
+      isPassed &= check(torch::equal(received, torch::full({1 << 22}, static_cast<float>(peer))), "isend", rank);
+    }
+  }
+
+  // Gradient reducer against the mean of the per-rank gradients, in a single backward and with accumulation
+  {
+    torch::manual_seed(0);
+
+    torch::nn::Sequential module(torch::nn::Linear(5, 7), torch::nn::ReLU(), torch::nn::Linear(7, 3));
+    trainer::ParameterArena arena(*module, true);
+    // Small buckets, so several of them are in flight
+    trainer::GradReducer reducer(processGroup, arena, 64);
+
+    torch::manual_seed(1 + rank);
+    const std::vector<torch::Tensor> inputs = {torch::randn({4, 5}), torch::randn({4, 5})};
+
+    const auto backward = [&](const torch::Tensor& input) {
+      module->forward(input).pow(2).sum().backward();
+    };
+
+    for (const int nMicroBatches : {1, 2}) {
+      // Local gradients, then their mean over the ranks
+      arena.zeroGrad();
+      reducer.setSyncEnabled(false);
+
+      for (int i = 0; i < nMicroBatches; ++i) {
+        backward(inputs[i]);
+      }
+
+      const torch::Tensor& expected = processGroup->allGather(arena.getFlatGrads().clone()).mean(0);
+
+      // Reduced gradients, only synchronized in the last micro-batch
+      arena.zeroGrad();
+
+      for (int i = 0; i < nMicroBatches; ++i) {
+        reducer.setSyncEnabled(i + 1 == nMicroBatches);
+        backward(inputs[i]);
+      }
+
+      reducer.finish();
+
+      isPassed &= check(torch::allclose(arena.getFlatGrads(), expected, 1e-5, 1e-6), "GradReducer " + std::to_string(nMicroBatches) + " micro-batches", rank);
+    }
+  }
+
+  processGroup->barrier();
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,239 @@
+#include <DiffusionModelC++/Trainer/Optimizer.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <cmath>
+#include <sstream>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+namespace {
+
+// Parameters of a few shapes, including sizes that do not split evenly over the threads
+std::vector<torch::Tensor> makeParams() {
+  return {torch::randn({37}), torch::randn({5, 7}), torch::randn({4, 3, 3, 3})};
+}
+
+std::vector<torch::Tensor> cloneParams(const std::vector<torch::Tensor>& params) {
+  std::vector<torch::Tensor> clones;
+
+  for (const auto& param : params) {
+    clones.push_back(param.detach().clone());
+  }
+
+  return clones;
+}
+
+// The same random gradients on both sets of parameters
+void setGrads(const std::vector<torch::Tensor>& params, const std::vector<torch::Tensor>& otherParams) {
+  for (size_t i = 0; i < params.size(); ++i) {
+    const torch::Tensor& grad = torch::randn_like(params[i]);
+    params[i].mutable_grad() = grad.clone();
+    otherParams[i].mutable_grad() = grad.clone();
+  }
+}
+
+bool isClose(const std::vector<torch::Tensor>& params, const std::vector<torch::Tensor>& otherParams) {
+  bool isSame = true;
+
+  for (size_t i = 0; i < params.size(); ++i) {
+    isSame &= torch::allclose(params[i], otherParams[i], 1e-5, 1e-6);
+  }
+
+  return isSame;
+}
+
+// Optimizer state through an archive, as in a checkpoint
+void copyState(const torch::optim::Optimizer& source, torch::optim::Optimizer& target) {
+  std::stringstream stream;
+
+  {
+    torch::serialize::OutputArchive archive;
+    source.save(archive);
+    archive.save_to(stream);
+  }
+
+  torch::serialize::InputArchive archive;
+  archive.load_from(stream);
+  target.load(archive);
+}
+
+bool testFusedAdamW() {
+  const auto options = torch::optim::AdamWOptions(1e-2).betas({0.9, 0.99}).weight_decay(0.05).eps(1e-8);
+  constexpr int nSteps = 5;
+
+  bool isPassed = true;
+
+  std::vector<torch::Tensor> params = makeParams();
+  std::vector<torch::Tensor> refParams = cloneParams(params);
+
+  trainer::FusedAdamW optimizer(params, options);
+  torch::optim::AdamW reference(refParams, options);
+
+  // Same updates as torch::optim::AdamW
+  for (int iStep = 0; iStep < nSteps; ++iStep) {
+    setGrads(params, refParams);
+    optimizer.step();
+    reference.step();
+  }
+
+  isPassed &= check(isClose(params, refParams), "FusedAdamW step");
+
+  // FusedAdamW state -> torch::optim::AdamW
+  {
+    std::vector<torch::Tensor> loadedParams = cloneParams(params);
+    torch::optim::AdamW loaded(loadedParams, options);
+    copyState(optimizer, loaded);
+
+    setGrads(params, loadedParams);
+    optimizer.step();
+    loaded.step();
+
+    isPassed &= check(isClose(params, loadedParams), "FusedAdamW state loaded into AdamW");
+  }
+
+  // torch::optim::AdamW state -> FusedAdamW
+  {
+    std::vector<torch::Tensor> loadedParams = cloneParams(refParams);
+    trainer::FusedAdamW loaded(loadedParams, options);
+    copyState(reference, loaded);
+
+    setGrads(refParams, loadedParams);
+    reference.step();
+    loaded.step();
+
+    isPassed &= check(isClose(refParams, loadedParams), "AdamW state loaded into FusedAdamW");
+  }
+
+  return isPassed;
+}
+
+// Reference Adafactor step of a matrix (beta1 = 0, no weight decay), from the row and column averages of grad^2
+torch::Tensor adafactorReference(const torch::Tensor& param,
+                                 const torch::Tensor& grad,
+                                 torch::Tensor& row,
+                                 torch::Tensor& col,
+                                 int64_t step,
+                                 const trainer::AdafactorOptions& options) {
+  const double beta2 = 1.0 - std::pow(static_cast<double>(step), options.decay_rate());
+  const torch::Tensor& gradSq = grad * grad + options.eps();
+
+  row = row * beta2 + gradSq.mean(1) * (1.0 - beta2);
+  col = col * beta2 + gradSq.mean(0) * (1.0 - beta2);
+
+  const torch::Tensor& v = row.unsqueeze(1) * col.unsqueeze(0) / row.mean();
+  torch::Tensor update = grad / v.sqrt();
+  update /= std::max(1.0, update.pow(2).mean().sqrt().item<double>() / options.clip_threshold());
+
+  return param - options.lr() * update;
+}
+
+bool testAdafactor() {
+  const auto options = trainer::AdafactorOptions(1e-2);
+  constexpr int nSteps = 3;
+
+  bool isPassed = true;
+
+  torch::Tensor matrix = torch::randn({6, 10});
+  torch::Tensor expected = matrix.clone();
+  torch::Tensor row = torch::zeros({6});
+  torch::Tensor col = torch::zeros({10});
+
+  trainer::Adafactor optimizer({matrix}, options);
+
+  for (int iStep = 1; iStep <= nSteps; ++iStep) {
+    const torch::Tensor& grad = torch::randn({6, 10});
+    matrix.mutable_grad() = grad.clone();
+    optimizer.step();
+
+    expected = adafactorReference(expected, grad, row, col, iStep, options);
+  }
+
+  isPassed &= check(torch::allclose(matrix, expected, 1e-5, 1e-6), "Adafactor factored update");
+
+  // Only the row and column averages are kept
+  const auto& state = static_cast<const trainer::AdafactorParamState&>(*optimizer.state().at(matrix.unsafeGetTensorImpl()));
+  isPassed &= check(state.exp_avg_sq_row().sizes() == torch::IntArrayRef({6}) && state.exp_avg_sq_col().sizes() == torch::IntArrayRef({10}) &&
+                        !state.exp_avg_sq().defined(),
+                    "Adafactor factored state");
+
+  // A rank-1 grad^2 is factored exactly, so the first update of a conv weight (viewed as [out, in * kh * kw]) is
+  // lr * sign(grad)
+  {
+    torch::Tensor weight = torch::randn({4, 3, 3, 3});
+    const torch::Tensor initial = weight.clone();
+    const torch::Tensor& grad = torch::outer(torch::rand({4}) + 0.5, torch::rand({27}) + 0.5).view({4, 3, 3, 3}) * torch::randn({4, 3, 3, 3}).sign();
+
+    weight.mutable_grad() = grad;
+    trainer::Adafactor conv({weight}, options);
+    conv.step();
+
+    isPassed &= check(torch::allclose(weight, initial - options.lr() * grad.sign(), 1e-5, 1e-6), "Adafactor rank-1 update");
+  }
+
+  return isPassed;
+}
+
+bool testAdamW8bit() {
+  const auto options = torch::optim::AdamWOptions(1e-2).betas({0.9, 0.999}).eps(1e-8);
+  constexpr int64_t numel = 600;  // The last block is padded
+
+  bool isPassed = true;
+
+  // Gradients over four orders of magnitude within each block, bounded away from 0
+  const torch::Tensor& grad = torch::randn({numel}).sign() * (torch::rand({numel}) + 0.5) * torch::pow(10.0, torch::rand({numel}) * -4.0);
+
+  torch::Tensor param = torch::randn({numel});
+  torch::Tensor refParam = param.clone();
+  param.mutable_grad() = grad.clone();
+  refParam.mutable_grad() = grad.clone();
+
+  trainer::AdamW8bit optimizer({param}, options);
+  torch::optim::AdamW reference({refParam}, options);
+
+  optimizer.step();
+  reference.step();
+
+  // The first step is computed before the moments are quantized
+  isPassed &= check(torch::allclose(param, refParam, 1e-5, 1e-6), "AdamW8bit first step");
+
+  // Dequantize the stored moments and compare them with the exact ones
+  const auto& state = static_cast<const trainer::AdamW8bitParamState&>(*optimizer.state().at(param.unsafeGetTensorImpl()));
+  const auto& refState = static_cast<const torch::optim::AdamWParamState&>(*reference.state().at(refParam.unsafeGetTensorImpl()));
+
+  const int64_t blockSize = trainer::AdamW8bit::kBlockSize;
+
+  const torch::Tensor& expAvg = (state.exp_avg().to(torch::kFloat32) * (state.exp_avg_scale() / 127.0)).flatten().narrow(0, 0, numel);
+  const torch::Tensor& expAvgScale = state.exp_avg_scale().expand({-1, blockSize}).flatten().narrow(0, 0, numel);
+
+  isPassed &= check(((expAvg - refState.exp_avg()).abs() <= expAvgScale / 254.0 + 1e-12).all().item<bool>(), "AdamW8bit first moment round trip");
+
+  const torch::Tensor& code = state.exp_avg_sq().to(torch::kFloat32);
+  const torch::Tensor& expAvgSqrt = torch::where(code > 0.0,
+                                                 torch::exp2((code - 255.0) / trainer::AdamW8bit::kSqrtCodesPerOctave) * state.exp_avg_sq_scale(),
+                                                 torch::zeros_like(code));
+  const torch::Tensor& expAvgSq = expAvgSqrt.pow(2).flatten().narrow(0, 0, numel);
+
+  // Half a code step on the square root, so about 9 % on v, and no non-zero v dequantized to 0
+  const torch::Tensor& ratio = expAvgSq / refState.exp_avg_sq();
+  isPassed &= check((ratio - 1.0).abs().max().item<double>() < 0.1, "AdamW8bit second moment round trip");
+
+  return isPassed;
+}
+
+}  // namespace
+
+int main() {
+  torch::manual_seed(0);
+
+  bool isPassed = true;
+
+  isPassed &= testFusedAdamW();
+  isPassed &= testAdafactor();
+  isPassed &= testAdamW8bit();
+
+  LOG_INFO(isPassed ? "Passed." : "Failed.");
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,54 @@
+#include <DiffusionModelC++/Trainer/Dataloader.hpp>
+#include <DiffusionModelC++/Trainer/PackedDataset.hpp>
+#include <DiffusionModelC++/Util/FileUtil.hpp>
+#include <DiffusionModelC++/Util/ImageUtil.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+int main() {
+  const std::string dirPath = "output_test_PackedDataset";
+  const std::string packPath = util::FileUtil::join(dirPath, "images.pack");
+  const int64_t nImages = 10;
+  const int imageSize = 32;
+
+  // Random images of another size, so the packer has to resize them
+  util::FileUtil::mkdirs(dirPath);
+
+  for (int64_t iImage = 0; iImage < nImages; ++iImage) {
+    cv::Mat image(48, 40, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    util::saveImage(image, util::FileUtil::join(dirPath, "image_" + std::to_string(iImage) + ".png"));
+  }
+
+  const std::vector<std::string>& imagePaths = trainer::listImageFiles(dirPath, ".png");
+  trainer::writePackedDataset(imagePaths, imageSize, packPath, 4);
+
+  trainer::PackedImageDataset packed(packPath);
+  trainer::ImageFolderDataset folder(dirPath, imageSize, imageSize, ".png", false);
+
+  bool isPassed = true;
+
+  isPassed &= check(packed.size().value() == static_cast<size_t>(nImages), "size");
+  isPassed &= check(packed.getImageWidth() == imageSize && packed.getImageHeight() == imageSize, "image size");
+
+  // Records hold what the folder dataset decodes, at uint8 precision
+  const std::vector<size_t> indices = {7, 0, 3, 3, 9};
+  const torch::Tensor& batch = packed.get_batch(indices);
+
+  isPassed &= check(batch.sizes() == torch::IntArrayRef({5, 3, imageSize, imageSize}), "batch shape");
+
+  const torch::Tensor& expected = folder.get_batch(indices);
+
+  for (size_t i = 0; i < indices.size(); ++i) {
+    isPassed &= check(torch::allclose(batch[static_cast<int64_t>(i)], expected[static_cast<int64_t>(i)], 0.0, 1e-5), "record " + std::to_string(indices[i]));
+    isPassed &= check(packed.getSourcePath(indices[i]) == imagePaths[indices[i]], "source path " + std::to_string(indices[i]));
+  }
+
+  LOG_INFO(isPassed ? "Passed." : "Failed.");
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
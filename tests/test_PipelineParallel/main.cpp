@@ -0,0 +1,104 @@
+#include <DiffusionModelC++/Diffusion/KarrasDiffusion.hpp>
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/EMA.hpp>
+#include <DiffusionModelC++/Trainer/PipelineParallel.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+int main(int argc, char* argv[]) {
+  const int nProcs = argc > 1 ? std::stoi(argv[1]) : 3;
+
+  setenv("MASTER_PORT", "29732", 0);
+
+  int exitCode = EXIT_SUCCESS;
+
+  if (distributed::spawnLocalProcesses(nProcs, exitCode)) {
+    LOG_INFO(exitCode == EXIT_SUCCESS ? "All ranks passed." : "Some ranks failed.");
+    return exitCode;
+  }
+
+  const auto processGroup = distributed::ProcessGroup::fromEnv();
+  const int rank = processGroup->getRank();
+
+  // A small model, the same on every rank
+  config::Config config;
+  config.model.inFeatures = 32;
+  config.model.depth = {1, 1, 1};
+  config.model.channels = {16, 32, 32};
+  config.model.selfAttenDepth = {false, false, true};
+  config.model.crossAttenDepth = {false, false, false};
+
+  torch::manual_seed(0);
+
+  diffusion::KarrasDiffusion model = getDiffusionModel(config);
+  diffusion::KarrasDiffusion reference = getDiffusionModel(config);
+
+  {
+    torch::NoGradGuard no_grad;
+
+    // NOTE: Zero-initialized output layers would leave most gradients at zero
+    for (auto& param : model->parameters()) {
+      param.normal_(0.0, 0.05);
+    }
+
+    trainer::copyEMAModel(model, reference);
+  }
+
+  const int64_t batchSize = 6;
+  const torch::Tensor& image = torch::randn({batchSize, 3, 16, 16});
+  const torch::Tensor& noise = torch::randn_like(image);
+  const torch::Tensor& sigma = torch::rand({batchSize}) * 2.0 + 0.1;
+
+  bool isPassed = true;
+
+  // Pipeline gradients against a single-process forward and backward
+  {
+    model::ImageUNetModelForwardArgs args;
+    const torch::Tensor& referenceLoss = reference->loss(image, noise, sigma, args).sum() / static_cast<double>(batchSize);
+    referenceLoss.backward();
+
+    trainer::PipelineParallel pipeline(processGroup, model, 2);
+
+    const torch::Tensor& loss = pipeline.forwardBackward(image, noise, sigma, 1.0 / static_cast<double>(batchSize));
+
+    if (pipeline.isLastStage()) {
+      isPassed &= check(torch::allclose(loss, referenceLoss.detach(), 1e-4, 1e-5), "loss", rank);
+    }
+
+    const std::vector<torch::Tensor>& params = pipeline.getStageParameters(*model);
+    const std::vector<torch::Tensor>& referenceParams = pipeline.getStageParameters(*reference);
+
+    isPassed &= check(!params.empty() && params.size() == referenceParams.size(), "stage parameters", rank);
+
+    for (size_t i = 0; i < params.size() && i < referenceParams.size(); ++i) {
+      isPassed &= check(params[i].grad().defined() && torch::allclose(params[i].grad(), referenceParams[i].grad(), 1e-3, 1e-5), "gradient " + std::to_string(i), rank);
+    }
+
+    // Gather the stage parameters on rank 0
+    {
+      torch::NoGradGuard no_grad;
+
+      for (auto& param : params) {
+        param.fill_(static_cast<float>(rank));
+      }
+    }
+
+    pipeline.gatherParameters(*model);
+
+    if (rank == 0) {
+      for (int stage = 0; stage < pipeline.getNumStages(); ++stage) {
+        for (const auto& param : pipeline.getStageParameters(*model, stage)) {
+          isPassed &= check(torch::all(param == static_cast<float>(stage)).item<bool>(), "gatherParameters", rank);
+        }
+      }
+    }
+  }
+
+  processGroup->barrier();
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,98 @@
+#include <DiffusionModelC++/Model/Resample.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+#include <functional>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+namespace {
+
+using ResampleFunc = std::function<torch::Tensor(const torch::Tensor&)>;
+
+// Compare the output and the input gradient of a fast path kernel against the ATen reference
+bool compare(const ResampleFunc& kernel, const ResampleFunc& reference, const torch::Tensor& input, const std::string& name) {
+  const torch::Tensor& x = input.detach().clone().requires_grad_(true);
+  const torch::Tensor& xRef = input.detach().clone().requires_grad_(true);
+
+  const torch::Tensor& y = kernel(x);
+  const torch::Tensor& yRef = reference(xRef);
+
+  bool isPassed = true;
+
+  isPassed &= check(y.sizes() == yRef.sizes(), name + " shape");
+
+  if (!isPassed) {
+    return false;
+  }
+
+  isPassed &= check(torch::allclose(y, yRef, 1e-5, 1e-5), name + " forward");
+
+  const torch::Tensor& gradOutput = torch::randn_like(yRef);
+  y.backward(gradOutput);
+  yRef.backward(gradOutput);
+
+  isPassed &= check(torch::allclose(x.grad(), xRef.grad(), 1e-4, 1e-4), name + " backward");
+
+  return isPassed;
+}
+
+torch::Tensor interpolate(const torch::Tensor& x, double scale, torch::nn::functional::InterpolateFuncOptions::mode_t mode, bool alignCorners) {
+  auto options = torch::nn::functional::InterpolateFuncOptions()
+                     .mode(mode)
+                     .scale_factor(std::vector<double>({scale, scale}))
+                     .recompute_scale_factor(false);
+
+  if (alignCorners) {
+    options.align_corners(true);
+  }
+
+  return torch::nn::functional::interpolate(x, options);
+}
+
+}  // namespace
+
+int main() {
+  torch::manual_seed(0);
+
+  bool isPassed = true;
+
+  const std::vector<std::vector<int64_t>> shapes = {{2, 3, 8, 8}, {1, 5, 6, 10}, {3, 4, 2, 2}};
+
+  for (const auto& shape : shapes) {
+    for (const bool isChannelsLast : {false, true}) {
+      torch::Tensor x = torch::randn(shape);
+
+      if (isChannelsLast) {
+        x = x.contiguous(torch::MemoryFormat::ChannelsLast);
+      }
+
+      const std::string suffix = " " + torch::str(torch::IntArrayRef(shape)) + (isChannelsLast ? " channels-last" : " NCHW");
+
+      isPassed &= compare(
+          model::avgPoolDownsample2x,
+          [](const torch::Tensor& t) { return torch::nn::functional::avg_pool2d(t, torch::nn::functional::AvgPool2dFuncOptions(2)); },
+          x, "avg_pool down" + suffix);
+
+      isPassed &= compare(
+          model::nearestUpsample2x,
+          [](const torch::Tensor& t) { return interpolate(t, 2.0, torch::kNearest, false); },
+          x, "nearest up" + suffix);
+
+      isPassed &= compare(
+          model::bilinearUpsample2x,
+          [](const torch::Tensor& t) { return interpolate(t, 2.0, torch::kBilinear, true); },
+          x, "bilinear up" + suffix);
+
+      isPassed &= compare(
+          model::bilinearDownsample2x,
+          [](const torch::Tensor& t) { return interpolate(t, 0.5, torch::kBilinear, true); },
+          x, "bilinear down" + suffix);
+    }
+  }
+
+  LOG_INFO(isPassed ? "Passed." : "Failed.");
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
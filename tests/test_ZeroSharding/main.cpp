@@ -0,0 +1,144 @@
+#include <DiffusionModelC++/Distributed/ProcessGroup.hpp>
+#include <DiffusionModelC++/Trainer/ParameterArena.hpp>
+#include <DiffusionModelC++/Trainer/ZeroSharding.hpp>
+#include <DiffusionModelC++/Util/Logging.hpp>
+
+#include "TestUtil.hpp"
+
+using namespace dmcpp;
+using test::check;
+
+namespace {
+
+torch::nn::Sequential makeModule() {
+  // NOTE: Segment sizes that are not multiples of the alignment, so the sharded arena is padded differently
+  //       from an unsharded one
+  return torch::nn::Sequential(torch::nn::Linear(5, 7), torch::nn::ReLU(), torch::nn::Linear(7, 3));
+}
+
+std::unordered_map<std::string, torch::Tensor> toMap(const util::NamedTensors& tensors) {
+  return {tensors.begin(), tensors.end()};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int nProcs = argc > 1 ? std::stoi(argv[1]) : 3;
+
+  setenv("MASTER_PORT", "29733", 0);
+
+  int exitCode = EXIT_SUCCESS;
+
+  if (distributed::spawnLocalProcesses(nProcs, exitCode)) {
+    LOG_INFO(exitCode == EXIT_SUCCESS ? "All ranks passed." : "Some ranks failed.");
+    return exitCode;
+  }
+
+  const auto processGroup = distributed::ProcessGroup::fromEnv();
+  const int rank = processGroup->getRank();
+  const int worldSize = processGroup->getWorldSize();
+
+  constexpr double decay = 0.9;
+  constexpr double lr = 0.1;
+
+  // The same weights on every rank, as the trainer broadcasts them
+  torch::manual_seed(0);
+
+  torch::nn::Sequential module = makeModule();
+  torch::nn::Sequential moduleEMA = makeModule();
+  torch::nn::Sequential reference = makeModule();
+
+  {
+    torch::NoGradGuard no_grad;
+
+    const auto& params = module->parameters();
+
+    for (size_t i = 0; i < params.size(); ++i) {
+      moduleEMA->parameters()[i].copy_(params[i]);
+      reference->parameters()[i].copy_(params[i]);
+    }
+  }
+
+  // As in the trainer: a sharded arena on every rank, the full EMA arena on rank 0 only, with the same padding
+  trainer::ParameterArena arena(*module, true, worldSize);
+  std::unique_ptr<trainer::ParameterArena> arenaEMA = rank == 0 ? std::make_unique<trainer::ParameterArena>(*moduleEMA, false, worldSize) : nullptr;
+  trainer::ZeroSharding zeroSharding(processGroup, arena);
+
+  bool isPassed = true;
+
+  // One step of SGD on the shard with the same gradient on every rank, all-gather and EMA update
+  const torch::Tensor& input = torch::randn({4, 5});
+
+  {
+    arena.zeroGrad();
+    module->forward(input).pow(2).sum().backward();
+
+    {
+      torch::NoGradGuard no_grad;
+      zeroSharding.getShardParam().add_(zeroSharding.getShardParam().grad(), -lr);
+    }
+
+    zeroSharding.allGatherParams();
+    zeroSharding.updateEMA(decay);
+  }
+
+  // Single-process reference
+  std::vector<torch::Tensor> expectedEMA;
+
+  {
+    reference->forward(input).pow(2).sum().backward();
+
+    torch::NoGradGuard no_grad;
+
+    for (auto& param : reference->parameters()) {
+      const torch::Tensor& initial = param.clone();
+      param.add_(param.grad(), -lr);
+      expectedEMA.push_back(initial.lerp(param, 1.0 - decay));
+    }
+
+    const auto& params = module->parameters();
+
+    for (size_t i = 0; i < params.size(); ++i) {
+      isPassed &= check(torch::allclose(params[i], reference->parameters()[i], 1e-5, 1e-6), "step " + std::to_string(i), rank);
+    }
+  }
+
+  // Gather the EMA into the full EMA model on rank 0, as for previews and checkpoints
+  {
+    torch::NoGradGuard no_grad;
+
+    const torch::Tensor& flatEMA = zeroSharding.gatherEMA(0);
+
+    if (rank == 0) {
+      isPassed &= check(flatEMA.numel() == arenaEMA->getFlatParams().numel(), "gathered EMA size", rank);
+      arenaEMA->getFlatParams().copy_(flatEMA);
+
+      const auto& params = moduleEMA->parameters();
+
+      for (size_t i = 0; i < params.size(); ++i) {
+        isPassed &= check(torch::allclose(params[i], expectedEMA[i], 1e-5, 1e-6), "gathered EMA " + std::to_string(i), rank);
+      }
+    }
+  }
+
+  // Reload the EMA from the full weights of rank 0 (sent to every rank here, read from the checkpoint in the trainer)
+  {
+    torch::NoGradGuard no_grad;
+
+    torch::Tensor flatEMA = rank == 0 ? arena.flatten(toMap(arenaEMA->snapshot())) : torch::zeros_like(arena.getFlatParams());
+    processGroup->broadcast(flatEMA, 0);
+
+    zeroSharding.updateEMA(0.0);
+    zeroSharding.loadEMA(flatEMA);
+
+    const torch::Tensor& gathered = zeroSharding.gatherEMA(0);
+
+    if (rank == 0) {
+      isPassed &= check(torch::equal(gathered, arenaEMA->getFlatParams()), "reloaded EMA", rank);
+    }
+  }
+
+  processGroup->barrier();
+
+  return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}